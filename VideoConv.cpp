@@ -1,7 +1,7 @@
 /**********************************************************************
 
     程序名称：将带有H264视频流的带壳视频文件分离出纯H264流
-    程序版本：REV 0.5
+    程序版本：REV 3.0
     设计编写：rainhenry
     创建日期：20210331
 
@@ -12,10 +12,174 @@
         REV 0.3  20210408  rainhenry   增加打印当前正在处理的视频文件名字
         REV 0.4  20210423  rainhenry   不丢弃非关键帧，并增加检查
         REV 0.5  20210714  rainhenry   将输出信息文件增加每一帧的数据字节长度
+        REV 0.6  20261018              将单文件转换流程拆分为读取/替换/写入三级
+                                       增加流水线模式,三级分别运行在独立线程中
+        REV 0.7  20261018              增加清单文件输入、分片、出错继续、结果报告和报告合并
+        REV 0.8  20261018              增加非H264输入的转码功能,多线程解码后重新编码为H264
+                                       实际帧数与总帧数不一致时修正视频信息文件头部
+        REV 0.9  20261018              增加校验模式,多线程解码输出的H264并与信息文件对比
+        REV 1.0  20261018              根据extradata和第一个包判断码流封装格式,
+                                       Annex-B格式(如MPEG-TS)直接透传,不再替换开始代码,
+                                       AVCC格式逐个NAL替换长度前缀,修正SPS/PPS长度计算,
+                                       总帧数未知时读取到文件结束
+        REV 1.1  20261018              增加实时推流输出,按帧率或时间戳节拍写入UNIX套接字或命名管道
+        REV 1.2  20261018              增加RTP输出(RFC 6184),支持单NAL、STAP-A和FU-A分片
+        REV 1.3  20261018              增加拼接模式,多个输入合并为一个码流和一个信息文件
+        REV 1.4  20261018              增加每帧CRC32C校验值(SSE4.2指令加速),以及离线检查模式
+        REV 1.5  20261018              增加按采样表预分配并内存映射写入H264文件
+        REV 1.6  20261018              增加码流分析报告(帧大小分布、峰值码率、GOP长度、B帧使用情况)
+        REV 1.7  20261018              增加SPS/VUI解析,信息文件头部增加解码器需求,不需要解码时不再打开解码器
+        REV 1.8  20261018              增加单个文件按关键帧分段并行转换
+        REV 1.9  20261018              增加自定义输入读取(大缓冲区、fadvise、后台预读)和读取统计
+        REV 2.0  20261018              增加预演模式,只根据容器的采样表生成信息文件和输出大小
+        REV 2.1  20261018              增加按DMA要求对齐每帧(填充零或填充数据NAL),以及插入AUD
+        REV 2.2  20261018              增加长度前缀格式的输出,设备不需要查找开始代码即可拆分NAL
+        REV 2.3  20261018              增加NAL子索引文件(.vnal),记录每帧中每个NAL的位置、长度和类型
+        REV 2.4  20261018              增加io_uring读写后端(编译时USE_IO_URING=1),多个读写请求同时在途
+        REV 2.5  20261018              增加跟随模式,转换正在录制的分片MP4,定期同步输出到磁盘
+        REV 2.6  20261018              增加在关键帧处定期保存断点,以及从断点继续转换
+        REV 2.7  20261018              增加时间线跟踪,记录打开、读取、替换、写入等事件,导出Chrome trace JSON
+        REV 2.8  20261018              增加包缓冲区池和流水线的内存预算,打印分配次数和峰值内存
+        REV 2.9  20261018              按编码特征类提取H264和H265,HEVC输入直接分离出纯H265流
+        REV 3.0  20261018              增加恢复模式,录制中断没有moov的MP4按参考的参数集扫描mdat重建每一帧
 
     设计说明
         将带有H264视频流的带壳视频文件分离出纯H264流,当不是H264的流的时候
-    程序会执行失败,并报错
+    程序会执行失败,并报错; 当开启--transcode时,非H264的流(如HEVC、VP9、MPEG-4)
+    会先多线程解码,再用本地libavcodec中的H264编码器重新编码后输出
+        HEVC输入(未开启--transcode时)直接分离出纯H265流,输出文件扩展名为.h265,
+    参数集按VPS、SPS、PPS的顺序写入,AUD和填充数据NAL使用H265的头部;
+    RTP输出和拼接模式只支持H264
+
+    命令行参数说明
+        VideoConv [选项] 视频文件1 视频文件2 ...
+        -o 目录                  设置输出目录(不设置时输出到源文件所在目录)
+        --pipeline               流水线模式,读取、替换开始代码、写入分别运行在独立线程中,
+                                 各级之间用有界无锁单生产者单消费者环形队列连接,
+                                 处理完成后打印各级的队列占用率和等待时间
+        --pipeline-depth N       流水线环形队列深度(包个数),默认64
+        --manifest 清单文件      从清单文件读取输入,可以与命令行中的文件混用
+        --shard i/N              只处理全部输入中序号 % N == i 的文件(i从0开始),
+                                 序号按命令行和清单中出现的顺序确定,多台机器各取一片
+        --keep-going             某个文件失败时继续处理后面的文件,最后返回第一个错误码
+        --report 报告文件        将每个文件的处理结果写入报告文件
+        --merge-reports 输出     合并模式,将后面给出的多个分片报告合并为一个报告
+        --transcode              输入不是H264时转码为H264,而不是报错
+        --tc-encoder 名字        转码使用的编码器,默认为libavcodec中第一个H264编码器(通常为libx264)
+        --tc-profile 名字        转码输出的profile,baseline/main/high,默认baseline
+        --tc-level 级别          转码输出的level,如4.0或40,默认4.0
+        --tc-preset 名字         编码器预设,速度与质量的折中,如ultrafast/veryfast/medium,默认veryfast
+        --tc-crf N               恒定质量模式的质量参数,默认23
+        --tc-bitrate N           目标码率(kbps),设置后代替crf
+        --tc-gop N               关键帧间隔(帧),默认为2秒对应的帧数
+        --tc-threads N           解码和编码的线程数,0为自动,默认0
+        --verify                 转换完成后校验输出: 帧数和每帧长度与信息文件一致,
+                                 每帧以开始代码开头且含有图像数据,第一帧含有SPS和PPS,
+                                 并用帧级多线程解码整个H264文件,打印解码帧率
+        --verify-source          校验时同时解码源文件,逐帧比较解码图像的哈希值
+        --verify-threads N       校验时解码的线程数,0为自动,默认0
+        --stream 目标            不生成H264文件,而是把码流实时写入目标,信息文件照常生成
+                                 unix:路径  连接到该路径上监听的UNIX域流式套接字
+                                 fifo:路径  打开该命名管道(会等待读端打开)
+                                 路径       根据文件类型自动判断
+                                 多个输入文件依次写入同一个目标
+        --pace 方式              推流节拍,fps按帧率,pts按包的时间戳,none不限速,默认fps
+                                 使用绝对时刻睡眠(clock_nanosleep TIMER_ABSTIME),误差不累积,
+                                 每个文件结束时打印迟到时间和抖动统计
+        --rtp 地址:端口          不生成H264文件,而是按RFC 6184打包为RTP通过UDP发送,IPv6地址写在方括号中(如[::1]:5004),
+                                 节拍同--pace,同时在输出目录生成接收端使用的.sdp文件,
+                                 例如 ffplay -protocol_whitelist file,udp,rtp xxx.sdp
+        --rtp-mtu N              RTP包的最大长度(含12字节RTP头部),默认1400
+        --rtp-pt N               RTP负载类型,默认96
+        --concat 名字            拼接模式,全部输入(分片后)依次写入同一个 名字.h264 和 名字.vinf,
+                                 SPS/PPS只在与前一个片段不同时(分辨率、profile变化)才重新写入,
+                                 信息文件中每个片段前插入一行片段标记
+        --crc                    信息文件中每帧长度后面增加该帧数据的CRC32C校验值
+        --check                  检查模式,输入为已经生成的.h264或.vinf文件(另一个文件在同一目录),
+                                 按信息文件中的CRC32C逐帧检查H264文件,用于批量巡检设备上的资源
+        --mmap                   按容器的采样表计算H264文件的最终大小,预先分配磁盘空间,
+                                 并通过内存映射直接写入,减少文件碎片和stdio缓冲区的拷贝
+                                 无法预估大小(如转码、没有采样表)或预分配失败(如磁盘空间不足)时
+                                 仍使用普通文件写入,写入中扩大映射时预分配失败按写入错误处理
+        --analyze  <报告文件>    转换的同时进行码流分析,每个文件在.vinf旁边生成同名的.json,
+                                 整个批次的汇总写入指定的报告文件,用于确定设备解码器的缓冲区大小
+        --analyze-window <秒>    峰值码率的滑动窗口长度,默认为1秒
+                                 帧大小的百分位由对数分桶的直方图给出(每个2的幂64个桶),
+                                 取桶的上界,最多偏大1/64,最大值是精确的,内存占用与帧数无关
+        --split  <分段数>        按采样表将单个文件在关键帧处分为若干段,每段在独立的线程中用独立的
+                                 解封装上下文转换,按预先计算的偏移直接写入H264文件,最后合并信息文件
+                                 要求输出长度与采样大小一致(4字节长度前缀或Annex-B),
+                                 不满足条件或读到的包与采样表不一致时自动改用普通方式
+        --io-buffer <KB>         使用自定义的输入读取,指定缓冲区大小,默认不使用(FFmpeg的文件协议)
+                                 每个文件结束时打印读取次数、字节数、平均读取长度和跳转次数
+        --readahead <MB>         配合--io-buffer使用,后台线程在当前读取位置之后预读指定大小到页缓存
+        --dry-run                预演模式,不读取视频数据(--aud时只读取第一个包),也不搜索流信息,只根据容器的采样表(如MP4的moov)
+                                 生成.vinf和.plan,不生成.h264,用于规划设备的内容更新,
+                                 已经存在.vinf(如实际转换的结果)时不覆盖,只生成.plan,不能与--transcode和--crc同时使用
+        --align  <字节数>        每帧在H264文件中的起始位置按指定字节数(2的幂,如512、4096)对齐,
+                                 设备可以直接从映射的文件DMA到解码器,每个文件结束时打印填充的开销
+        --pad  <zero|filler>     对齐时的填充方式,zero为末尾填充零(默认),filler为填充数据NAL(类型12)
+        --aud                    每帧之前插入访问单元分隔符(AUD),第一帧在SPS之前,
+                                 帧的第一个NAL已经是AUD时不再插入(第一帧的AUD移到参数集之前)
+        --framing  <annexb|avcc> 输出H264文件的封装格式,annexb为开始代码(默认),
+                                 avcc为每个NAL之前4字节大端长度,输入为4字节长度前缀时直接写出包的数据
+        --nal-index              同时生成.vnal,记录每帧中每个NAL的偏移、长度和NAL头部,
+                                 设备可以跳过SEI或只取第一个slice做快速预览,推流和预演模式时不生成
+        --io  <stdio|uring>      读写后端,默认stdio;uring时输入和H264输出都通过io_uring,
+                                 使用注册的缓冲区,同时在途最多URING_DEPTH个请求,没有--io-buffer时
+                                 输入缓冲区为URING_BLOCK,需要 make USE_IO_URING=1 编译,
+                                 内核不支持时自动使用stdio,每个文件结束时打印写入吞吐量用于对比
+        --follow  <秒>           跟随模式,用于正在录制的分片MP4(moof/mdat),读到文件末尾时等待文件增长,
+                                 录制程序关闭文件或者超过指定秒数没有新数据时结束,
+                                 关闭事件只能在开始跟随之后收到,第一次读到末尾时文件已经超过指定秒数
+                                 没有修改的视为录制已经结束,刚结束的录制仍然要等待到超时,
+                                 H264和信息文件随转换增量写入,信息文件头部的总帧数在结束时修正
+        --sync-ms  <毫秒>        跟随模式时输出同步到磁盘(fdatasync)的最大间隔,默认1000,
+                                 每次在帧的边界先同步H264文件再同步信息文件,掉电时最多丢失该间隔内的帧
+        --checkpoint  <秒>       每隔指定秒数,在关键帧之前把输出同步到磁盘并保存断点文件(.ckpt),
+                                 转换成功后删除断点文件,推流、转码、拼接和跟随模式时不保存
+        --resume                 存在断点文件且输入文件没有变化时,把输出截断到断点,
+                                 从断点的关键帧继续转换,断点无效时从头转换,没有--checkpoint时间隔为10秒
+        --trace  <文件.json>     记录每个文件的打开、搜索流信息、每次读取、替换、写入和同步的起止时间,
+                                 导出为Chrome trace JSON,可以在Perfetto(ui.perfetto.dev)或chrome://tracing中
+                                 查看每个文件(进程)、每个线程的延迟尖峰,事件先写入预分配的环形缓冲区,
+                                 由后台线程每TRACE_FLUSH_MS毫秒写入文件,缓冲区满时丢弃并在结束时打印丢弃个数
+        --mem-budget  <MB>       流水线模式中已经读取、还没有写出的包数据的字节数上限,超过时读取线程等待,
+                                 默认0为不限制(只受队列深度限制),每个文件结束时打印缓冲区池的取得和
+                                 实际分配次数、包的重复使用次数、在途字节数的峰值和进程的峰值内存(RSS)
+        --recover  参考文件      恢复模式,无法打开的文件(如录制中断、没有moov的MP4)不报错,而是顺序扫描mdat,
+                                 按长度前缀和NAL头部找出视频数据并拆分为帧,生成通常的H264和信息文件,
+                                 参考文件为同一设备录制的完整视频文件(取其中的avcC/hvcC、宽高和帧率),
+                                 或者单独保存的avcC/hvcC文件,第一个关键帧之前的帧丢弃,
+                                 预演、断点、分段并行和与源文件对比的校验不可用
+        --recover-fps  N         恢复时的帧率,默认使用参考文件的帧率,没有时为25
+
+    恢复模式说明
+        查找顶层的mdat,大小为0、超出文件或之后不是合法的box时延伸到文件结尾,
+        从mdat开始沿长度前缀逐个检查NAL,连续RECOVER_MIN_CHAIN个NAL的长度和头部都正确时确认为视频数据,
+        链断开(音频、损坏的数据)时用SSE2每次检查16个位置查找下一个确认的链,
+        两个链之间只接受能完整放入的单个NAL(紧接在链之后,或者为图像的第一个slice),
+        已经有图像数据时,遇到SEI、参数集、AUD或图像的第一个slice开始新的一帧
+
+    RTP打包说明
+        每个关键帧之前先发送一个STAP-A(类型24),其中聚合SPS和PPS,
+        不超过MTU的NAL用单NAL包发送,超过MTU的NAL用FU-A(类型28)分片,
+        一帧的最后一个包设置marker位,时间戳由包的pts换算为90kHz,
+        一帧内的RTP包用sendmmsg批量发送
+
+    清单文件格式
+        每行一个输入文件,空行和#开头的行忽略,路径含空格时用双引号括起来,
+        路径后面可以跟若干个 键=值 形式的单文件选项
+            out=目录             该文件的输出目录
+            pipeline=0/1         该文件是否使用流水线模式
+        例如
+            /data/a.mp4 out=/data/out_a
+            "/data/b c.mp4" pipeline=1
+
+    报告文件格式
+        第一行为 # VideoConv report shard=i/N total=输入总数
+        之后每行一个文件,用TAB分隔
+            序号  状态(OK/FAIL)  返回码  帧数  字节数  耗时(秒)  输入文件
 
     视频信息文件格式
         长       unsigned int
@@ -23,6 +187,87 @@
         帧率     float
         总帧数   unsigned long
         以上信息全部用空格分隔
+        之后每行为一帧的字节长度(第一帧包含SPS和PPS)
+        拼接模式时,每个片段的第一帧之前有一行片段标记
+            #CLIP 片段序号 起始帧号 宽 高 帧率 是否重新写入了SPS/PPS(0/1) 源文件名
+        以#开头的行不是帧长度,读取时需要跳过
+        开启--align时头部有一行 #ALIGN 对齐字节数 填充方式,此时每帧一行为
+            填充后的字节长度 有效数据长度 在H264文件中的偏移 [CRC32C]
+        填充后的长度总是对齐字节数的整数倍,只读取第一个数的设备仍然可以正常使用
+        H265时头部有一行 #CODEC h265,没有时为H264
+        开启--aud时头部有一行 #AUD
+        --framing avcc时头部有一行 #FRAMING avcc 4,此时H264文件中每个NAL为
+            4字节大端长度 + NAL数据
+        文件开头(第一帧的开始)依次为长度前缀的SPS和PPS,设备按信息文件取出一帧后
+        依次读取长度即可拆分NAL,对齐时只拆分到有效数据长度,之后为填充
+        能够解析SPS时,第一行之后有若干行扩展头部,格式为 #名字 值,依次为
+            #PROFILE      profile_idc constraint_set标志(十六进制) level_idc
+            #CHROMA       chroma_format_idc 亮度位深 色度位深
+            #CODED_SIZE   编码宽度 编码高度(宏块对齐)
+            #CROP         左 右 上 下 裁剪的像素数
+            #SIZE         裁剪后的宽度 高度
+            #REF_FRAMES   参考帧个数
+            #DPB_FRAMES   解码图像缓冲区需要的帧数(VUI中没有时按level推算)
+            #REORDER      显示重排序的最大帧数(VUI中没有时为-1)
+            #TIMING       num_units_in_tick time_scale fixed_frame_rate_flag(VUI中有时)
+            #CPB          HRD中第一个CPB的大小(位)和码率(位/秒)(VUI中有时)
+        开启--crc时每帧一行为 字节长度 CRC32C,CRC32C为8位十六进制,
+        覆盖该帧在H264文件中的全部字节(第一帧包含SPS和PPS),
+        多项式0x1EDC6F41(反射0x82F63B78),初值和结果异或0xFFFFFFFF
+
+    NAL子索引文件(.vnal)格式说明
+        二进制文件,前8个字节为头部
+            'V' 'N' 'A' 'L'  版本(1)  封装格式(0为Annex-B,1为4字节长度前缀)  编码(0为H264,1为H265)  0
+        之后依次为每一帧的NAL表,与信息文件中的帧一一对应
+            NAL个数(变长整数)
+            每个NAL为 与上一个NAL结尾的距离(变长整数) NAL长度(变长整数) NAL头部(1字节)
+        距离和长度以帧在H264文件中的起始位置为基准,不含开始代码或长度前缀,
+        每帧第一个NAL的距离就是该NAL在帧中的偏移,之后通常为前缀的长度(3或4)
+        NAL头部的低5位为nal_unit_type,第5~6位为nal_ref_idc;
+        H265时为NAL头部的第一个字节,第1~6位为nal_unit_type
+        变长整数每个字节低7位有效,低位在前,最高位为1表示后面还有字节
+        帧中包含插入的AUD、SPS/PPS和填充数据NAL,对齐时的零填充不记录
+
+    断点文件(.ckpt)格式说明
+        第一行为 #CKPT 2,之后每行为 名字 值
+            input   输入文件的字节数 修改时间(秒),继续时需要一致
+            layout  输出格式(annexb/avcc) 对齐字节数 填充方式(zero/filler) AUD(0/1) CRC(0/1),
+                    决定已写入部分的格式,继续时需要与命令行一致
+            frame   已经写入的帧数
+            h264    H264文件的字节数
+            vinf    信息文件的字节数
+            vnal    NAL子索引文件的字节数,没有时为-1
+            pad     已经填充的字节数
+            nal     已经记录的NAL个数
+            dts     继续转换的第一帧(关键帧)的解码时间戳
+            pos     该帧在输入文件中的位置,未知时为-1
+        先写入临时文件(.ckpt.tmp)并同步到磁盘,再改名为.ckpt,断点文件总是完整的
+
+    跟踪文件格式说明
+        Chrome trace JSON对象格式 {"traceEvents":[...],"displayTimeUnit":"ms"}
+        每个事件为完整事件(ph为X),ts为从程序开始的微秒数,dur为持续的微秒数,
+        pid为文件的序号加1(0为文件之外的事件),tid为线程编号,args中bytes为包的字节数,
+        file事件的args中code为该文件的返回码,结尾的元数据事件(ph为M)给出文件名和线程名
+            open     avformat_open_input()          probe    avformat_find_stream_info()
+            read     av_read_frame()                pread    自定义输入读取中的一次读取
+            follow   跟随模式等待文件增长            rewrite  替换开始代码
+            write    写入一帧                        sync     同步到磁盘
+            file     整个文件的转换
+
+    预演文件(.plan)格式说明
+        第一行为 #DRYRUN H264文件字节数 帧数 是否精确(1或0)
+        之后每帧一行为 在H264文件中的偏移 字节长度 是否关键帧 解码时间戳(毫秒)
+        4字节长度前缀和Annex-B格式的输入结果是精确的,1、2字节长度前缀时每个NAL
+        会增加字节,不读取数据无法知道NAL个数,此时给出的是下限
+
+    码流封装格式说明
+        AVCC格式(MP4、MOV、部分MKV)
+            extradata为avcC结构,第一个字节为1,第5个字节的低2位加1为长度前缀的字节数,
+            包中每个NAL前面是大端的长度前缀,需要逐个替换为开始代码
+        Annex-B格式(MPEG-TS、裸H264、部分MKV)
+            extradata为空或者为开始代码分隔的SPS/PPS,包中每个NAL前面已经是开始代码,
+            直接透传,不做任何修改
+        以extradata判断为准,第一个视频包的内容与之矛盾时以包的内容为准
 
     关键的NAL帧头说明
         00 00 00 01 67是SPS
@@ -96,6 +341,38 @@
 #include <cstring>
 #include <string>
 #include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <cmath>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif  //  __x86_64__ || __i386__
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif  //  __SSE2__
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#if USE_IO_URING
+#include <liburing.h>
+#endif  //  USE_IO_URING
+#include <netdb.h>
+#include <netinet/in.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -106,6 +383,10 @@ extern "C"
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libavutil/adler32.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/base64.h>
 #ifdef __cplusplus
 }
 #endif  //  __cplusplus
@@ -113,6 +394,18 @@ extern "C"
 //---------------------------------------------------------------------
 //  相关宏定义
 #define DEBUG_LOG                     0     //  是否开启打印Log
+#ifndef USE_IO_URING
+#define USE_IO_URING                  0     //  是否编译io_uring后端(需要liburing),由makefile传入
+#endif  //  USE_IO_URING
+#define URING_DEPTH                   8     //  io_uring同时在途的请求个数
+#define URING_BLOCK                   (1024 * 1024)   //  io_uring每个请求的字节数
+#define TRACE_RING_SIZE               65536 //  跟踪事件环形缓冲区的个数,必须为2的幂
+#define TRACE_FLUSH_MS                50    //  跟踪事件写入文件的间隔
+#define POOL_MIN_SHIFT                12    //  缓冲区池最小的一级为4KB
+#define POOL_CLASS_CNT                13    //  缓冲区池的级数,最大一级为16MB,更大的直接分配
+#define RECOVER_MIN_CHAIN             2     //  恢复时长度前缀连续正确的NAL个数达到该值才确认为视频数据
+#define ANALYZE_SUB_BITS              6     //  帧大小直方图每个2的幂分为2^6个桶,相对误差不超过1/64
+#define ANALYZE_HIST_CNT              (26 << ANALYZE_SUB_BITS)    //  直方图的桶数,覆盖到2GB
 
 //---------------------------------------------------------------------
 //  相关类型定义
@@ -122,8 +415,161 @@ typedef enum
 {
     EInputType_None = 0,       //  正常输入,可以为文件名,也可以为开关选项
     EInputType_OutputPath,     //  当为输出目录
+    EInputType_PipelineDepth,  //  当为流水线队列深度
+    EInputType_Manifest,       //  当为清单文件
+    EInputType_Shard,          //  当为分片设置
+    EInputType_Report,         //  当为报告文件
+    EInputType_MergeReports,   //  当为合并报告的输出文件
+    EInputType_TcEncoder,      //  当为转码编码器名字
+    EInputType_TcProfile,      //  当为转码profile
+    EInputType_TcLevel,        //  当为转码level
+    EInputType_TcPreset,       //  当为转码预设
+    EInputType_TcCrf,          //  当为转码质量参数
+    EInputType_TcBitrate,      //  当为转码码率
+    EInputType_TcGop,          //  当为转码关键帧间隔
+    EInputType_TcThreads,      //  当为转码线程数
+    EInputType_VerifyThreads,  //  当为校验线程数
+    EInputType_Stream,         //  当为推流目标
+    EInputType_StreamPace,     //  当为推流节拍方式
+    EInputType_Rtp,            //  当为RTP目标地址
+    EInputType_RtpMtu,         //  当为RTP MTU
+    EInputType_RtpPt,          //  当为RTP负载类型
+    EInputType_Concat,         //  当为拼接输出名字
+    EInputType_Analyze,        //  当为分析汇总报告文件
+    EInputType_AnalyzeWindow,  //  当为峰值码率窗口长度
+    EInputType_Split,          //  当为单个文件的分段数
+    EInputType_IoBuffer,       //  当为输入读取缓冲区大小
+    EInputType_Readahead,      //  当为后台预读大小
+    EInputType_Align,          //  当为帧对齐字节数
+    EInputType_Pad,            //  当为填充方式
+    EInputType_Framing,        //  当为输出封装格式
+    EInputType_Io,             //  当为读写后端
+    EInputType_Follow,         //  当为跟随模式的超时秒数
+    EInputType_SyncMs,         //  当为跟随模式的同步间隔
+    EInputType_Checkpoint,     //  当为断点间隔
+    EInputType_Trace,          //  当为跟踪文件
+    EInputType_MemBudget,      //  当为内存预算
+    EInputType_Recover,        //  当为恢复模式的参考文件
+    EInputType_RecoverFps,     //  当为恢复时的帧率
 }EInputType;
 
+//  读写后端
+typedef enum
+{
+    EIoMode_Stdio = 0,         //  FFmpeg读取和fwrite写入
+    EIoMode_Uring,             //  io_uring
+}EIoMode;
+
+//  io_uring读写上下文,只在USE_IO_URING时定义
+struct SUring;
+
+//  码流封装格式
+typedef enum
+{
+    EFraming_AVCC = 0,         //  长度前缀,需要替换为开始代码
+    EFraming_AnnexB,           //  已经是开始代码,直接透传
+}EFraming;
+
+//  视频编码,每个文件打开时确定
+typedef enum
+{
+    ECodec_H264 = 0,
+    ECodec_H265,
+}ECodec;
+
+//  编码特征
+//  H264和H265的提取流程相同,只有NAL头部、参数集和配置结构(avcC/hvcC)不同,
+//  差异定义为特征类的静态函数,逐个NAL处理的函数按特征类实例化为模板,
+//  每个包只按当前文件的编码选择一次模板,处理每个NAL时没有额外的分支和间接调用
+//  参数 pnal 指向NAL头部(不含开始代码或长度前缀)
+
+//  H264,NAL头部1字节,nal_unit_type为低5位
+struct SH264Traits
+{
+    static const int nal_head_len = 1;
+    static const bool has_vps = false;
+    static int NalType(const unsigned char* pnal) { return pnal[0] & 0x1F; }
+    static bool IsVcl(int type) { return (type >= 1) && (type <= 5); }
+    static bool IsSlice(int type) { return (type == 1) || (type == 5); }    //  可以解析slice类型
+    static bool IsSei(int type) { return type == 6; }
+    static bool IsAud(int type) { return type == 9; }
+    //  参数集的序号,0为VPS,1为SPS,2为PPS,不是参数集时为-1
+    static int ParamSetIndex(int type) { return (type == 7) ? 1 : ((type == 8) ? 2 : -1); }
+    static bool IsKey(int type) { return type == 5; }
+    //  出现在图像数据之后时开始新的访问单元(SEI、SPS、PPS、AUD等)
+    static bool IsAuPrefix(int type) { return ((type >= 6) && (type <= 9)) || ((type >= 14) && (type <= 18)); }
+    //  图像的第一个slice,first_mb_in_slice为0(ue编码的第一位为1)
+    static bool IsFirstSlice(const unsigned char* pnal, int len)
+    {
+        return (len > 1) && IsVcl(NalType(pnal)) && ((pnal[1] & 0x80) != 0);
+    }
+    static bool IsValidHead(const unsigned char* pnal);
+#if defined(__SSE2__)
+    static __m128i HeadMask(__m128i h0, __m128i h1);
+#endif  //  __SSE2__
+    static int ParseConfig(const unsigned char* pdat, int len);
+    static int SliceType(const unsigned char* pnal, int len);
+};
+
+//  H265,NAL头部2字节,nal_unit_type为第一个字节的第1~6位
+struct SH265Traits
+{
+    static const int nal_head_len = 2;
+    static const bool has_vps = true;
+    static int NalType(const unsigned char* pnal) { return (pnal[0] >> 1) & 0x3F; }
+    static bool IsVcl(int type) { return type < 32; }
+    static bool IsSlice(int type) { return type < 32; }
+    static bool IsSei(int type) { return (type == 39) || (type == 40); }  //  前缀和后缀SEI
+    static bool IsAud(int type) { return type == 35; }
+    static int ParamSetIndex(int type) { return ((type >= 32) && (type <= 34)) ? (type - 32) : -1; }
+    static bool IsKey(int type) { return (type >= 16) && (type <= 23); }     //  IRAP
+    static bool IsAuPrefix(int type)
+    {
+        return ((type >= 32) && (type <= 35)) || (type == 39) || ((type >= 41) && (type <= 44)) || ((type >= 48) && (type <= 55));
+    }
+    //  图像的第一个slice,first_slice_segment_in_pic_flag为1
+    static bool IsFirstSlice(const unsigned char* pnal, int len)
+    {
+        return (len > 2) && IsVcl(NalType(pnal)) && ((pnal[2] & 0x80) != 0);
+    }
+    static bool IsValidHead(const unsigned char* pnal);
+#if defined(__SSE2__)
+    static __m128i HeadMask(__m128i h0, __m128i h1);
+#endif  //  __SSE2__
+    static int ParseConfig(const unsigned char* pdat, int len);
+    static int SliceType(const unsigned char* pnal, int len);
+};
+
+//  SPS解析结果
+typedef struct
+{
+    int                 profile_idc;
+    int                 constraint_flags;  //  constraint_set0~5标志
+    int                 level_idc;
+    int                 chroma_format_idc;
+    int                 bit_depth_luma;
+    int                 bit_depth_chroma;
+    int                 frame_mbs_only;
+    int                 coded_width;       //  宏块对齐的宽度
+    int                 coded_height;      //  宏块对齐的高度
+    int                 crop_left;         //  裁剪的像素数
+    int                 crop_right;
+    int                 crop_top;
+    int                 crop_bottom;
+    int                 width;             //  裁剪后的宽度
+    int                 height;            //  裁剪后的高度
+    int                 num_ref_frames;
+    int                 dpb_frames;        //  解码图像缓冲区需要的帧数
+    int                 max_num_reorder;   //  -1为VUI中没有
+    bool                timing_present;
+    unsigned int        num_units_in_tick;
+    unsigned int        time_scale;
+    int                 fixed_frame_rate;
+    bool                hrd_present;
+    unsigned long long  cpb_size;          //  第一个CPB的大小,单位位
+    unsigned long long  hrd_bitrate;       //  第一个CPB的码率,单位位/秒
+}SSpsInfo;
+
 //  FFmpeg上下文数据结构
 typedef struct
 {
@@ -139,13 +585,36 @@ typedef struct
     AVStream*           audio_stream;      //  音频流
 
     //  要导出H264的一些必要信息
+    ECodec              codec;             //  视频编码,H265时输出.h265
+    unsigned char* vps_dat;                //  只有H265有
     unsigned char* sps_dat;
     unsigned char* pps_dat;
+    int vps_len;
     int sps_len;
     int pps_len;
+    int slice_extra_bits;                  //  H265 PPS中的num_extra_slice_header_bits
+
+    //  码流封装格式
+    EFraming            framing;           //  视频包的封装格式
+    int                 nal_length_size;   //  AVCC格式时长度前缀的字节数(1、2或4)
+    bool                framing_checked;   //  是否已经用第一个包确认过封装格式
 
     //  一些标志
     bool avcodec_open_already;             //  解码器的打开标志
+    bool transcode;                        //  当前文件是否需要转码
+
+    //  转码相关(仅在transcode为true时有效,p_codec_ctx为源视频的解码器)
+    AVCodecContext*     p_enc_ctx;         //  H264编码器
+    struct SwsContext*  p_sws_ctx;         //  像素格式和尺寸转换
+    AVFrame*            p_tc_frame;        //  转换后送入编码器的帧
+    unsigned long       decode_error_cnt;  //  解码器拒绝的包数(源文件损坏等)
+
+    //  自定义输入读取,为0时使用FFmpeg的文件协议
+    AVIOContext*        p_avio;
+
+    //  SPS解析结果
+    bool                sps_valid;         //  是否成功解析了SPS
+    SSpsInfo            sps_info;
 
     //  视频信息
     float               FrameRate;         //  帧率
@@ -154,6 +623,182 @@ typedef struct
     unsigned long       TotalFrame;        //  该视频总共帧数量
 }SFFmpegContext;
 
+//  单个视频文件的输出上下文
+typedef struct
+{
+    FILE*               pfile_outh264;     //  输出的纯H264码流文件
+    FILE*               pfile_outvinf;     //  输出的视频信息文件
+    FILE*               pfile_outvnal;     //  输出的NAL子索引文件,为0时不生成
+    int                 frame_byte_cnt;    //  累计本帧字节数(第一帧包含SPS和PPS)
+    unsigned long       frame_cnt;         //  已经写入的帧数
+    unsigned long long  byte_cnt;          //  已经写入H264码流文件的总字节数
+    unsigned long       clip_start;        //  拼接模式时当前片段的起始帧号
+    unsigned int        frame_crc;         //  本帧数据的CRC32C
+    unsigned long long  pad_cnt;           //  对齐填充的总字节数
+    int                 map_fd;            //  内存映射输出的文件描述符
+    unsigned char*      p_map;             //  内存映射输出的起始地址,为0时不使用内存映射
+    unsigned long long  map_size;          //  内存映射的大小
+    unsigned long long  map_pos;           //  内存映射当前写入的位置
+    SUring*             p_uring;           //  io_uring写入上下文,为0时使用fwrite
+    double              write_ms;          //  写入H264文件的耗时
+}SConvOutput;
+
+//  一个输入文件及其单文件选项
+typedef struct
+{
+    std::string         path;              //  输入文件路径
+    int                 index;             //  在全部输入中的序号(用于分片和报告)
+    std::string         out_path;          //  输出目录,为空时使用全局设置
+    int                 pipeline;          //  是否流水线模式,小于0时使用全局设置
+}SInputItem;
+
+//  一个文件的处理结果
+typedef struct
+{
+    int                 index;             //  在全部输入中的序号
+    int                 code;              //  返回码,0为成功
+    unsigned long       frames;            //  输出帧数
+    unsigned long long  bytes;             //  输出字节数
+    double              seconds;           //  耗时
+    std::string         path;              //  输入文件
+}SConvResult;
+
+//  推流节拍方式
+typedef enum
+{
+    EStreamPace_Fps = 0,       //  按帧率
+    EStreamPace_Pts,           //  按包的时间戳
+    EStreamPace_None,          //  不限速
+}EStreamPace;
+
+//  推流节拍和统计
+typedef struct
+{
+    bool                started;           //  是否已经开始计时
+    struct timespec     start;             //  第0帧的发送时刻
+    int64_t             first_ts;          //  第0帧的时间戳
+    unsigned long       frames;            //  已经发送的帧数
+    double              late_sum_us;       //  迟到时间累加
+    double              late_sq_sum_us;    //  迟到时间平方累加(用于计算抖动)
+    double              late_max_us;       //  最大迟到时间
+    unsigned long       late_cnt;          //  迟到超过1ms的帧数
+}SStreamPacer;
+
+//  RTP发送上下文
+#define RTP_HEAD_LEN                  12    //  RTP固定头部长度
+#define RTP_BATCH_MAX                 64    //  一次sendmmsg最多发送的包数
+typedef struct
+{
+    int                 fd;                //  UDP套接字,已经connect到接收端
+    int                 family;            //  接收端的地址族,AF_INET或AF_INET6
+    char                addr[INET6_ADDRSTRLEN];    //  接收端的数字地址,写入SDP
+    int                 mtu;               //  RTP包最大长度
+    int                 pt;                //  负载类型
+    unsigned short      seq;               //  序号
+    unsigned int        ts_base;           //  时间戳起始值
+    unsigned int        ssrc;              //  同步源
+    int64_t             first_pts;         //  当前文件第一个包的pts
+    unsigned int        ts_offset;         //  当前文件起始的时间戳偏移(多个文件连续发送)
+    unsigned int        last_ts;           //  上一帧的时间戳
+
+    //  批量发送缓存,iov[0]指向头部,iov[1]指向帧数据
+    int                 batch_cnt;
+    struct mmsghdr      msgs[RTP_BATCH_MAX];
+    struct iovec        iovs[RTP_BATCH_MAX][2];
+    unsigned char       heads[RTP_BATCH_MAX][RTP_HEAD_LEN + 2];
+    unsigned char       stap[1500 * 4];    //  STAP-A的负载
+
+    //  统计
+    unsigned long       packets;
+    unsigned long long  bytes;
+    unsigned long       single_cnt;
+    unsigned long       stap_cnt;
+    unsigned long       fua_cnt;
+    unsigned long       send_calls;
+    unsigned long       backoff_cnt;       //  发送缓存满时等待的次数
+}SRtpContext;
+
+//  读入的视频信息文件
+typedef struct
+{
+    int                 Width;             //  宽度
+    int                 Height;            //  高度
+    float               FrameRate;         //  帧率
+    unsigned long       TotalFrame;        //  头部中的总帧数
+    std::vector<int>    frame_size;        //  每一帧的字节长度
+    bool                has_crc;           //  是否含有每帧的CRC32C
+    int                 align;             //  对齐字节数,没有对齐时为0
+    bool                avcc;              //  H264文件是否为4字节长度前缀格式
+    ECodec              codec;             //  视频编码格式
+    std::vector<int>    payload_size;      //  每一帧的有效数据长度
+    std::vector<unsigned int> frame_crc;   //  每一帧的CRC32C
+}SVinfInfo;
+
+//  有界无锁单生产者单消费者环形队列
+//  只允许一个线程Push,一个线程Pop,容量会向上取整到2的幂
+template<typename T>
+class CSpscRing
+{
+public:
+    explicit CSpscRing(int capacity)
+    {
+        size_t cap = 2;
+        while(cap < (size_t)capacity) cap <<= 1;
+        buf.resize(cap);
+        mask = cap - 1;
+        head.store(0);
+        tail.store(0);
+    }
+
+    //  尝试压入,队列满返回false
+    bool TryPush(const T& v)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) > mask) return false;
+        buf[t & mask] = v;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    //  尝试弹出,队列空返回false
+    bool TryPop(T& v)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire)) return false;
+        v = buf[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    //  当前占用个数(近似值,仅用于统计)
+    int Size(void) const
+    {
+        return (int)(tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+    }
+
+    //  容量
+    int Capacity(void) const
+    {
+        return (int)(mask + 1);
+    }
+
+private:
+    std::vector<T>      buf;
+    size_t              mask;
+    alignas(64) std::atomic<size_t> head;  //  消费者位置
+    alignas(64) std::atomic<size_t> tail;  //  生产者位置
+};
+
+//  流水线某一级的统计信息
+typedef struct
+{
+    double              busy_ms;           //  处理数据所用时间
+    double              wait_in_ms;        //  等待上游数据所用时间(输入队列为空)
+    double              wait_out_ms;       //  等待下游空位所用时间(输出队列已满)
+    unsigned long       occ_sum;           //  每次压入时输出队列占用个数的累加
+    unsigned long       occ_samples;       //  占用采样次数
+}SPipeStageStat;
+
 //---------------------------------------------------------------------
 //  相关变量
 
@@ -164,13 +809,369 @@ EInputType CurrentInputType = EInputType_None;   //  默认为正常输入
 SFFmpegContext ffmpeg_context;
 
 //  输出文件相关
-std::vector<std::string> InputFileVec;            //  输入的文件容器 
+std::vector<SInputItem> InputFileVec;             //  输入的文件容器 
 
 //  开始代码
 unsigned char startcode[4]={0x00, 0x00, 0x00, 0x01};
 
 std::string OutputPath = "";      //  输出的目录(当为空的时候,输出的原输入目录)
 
+//  流水线模式相关
+bool PipelineMode = false;        //  是否使用多线程流水线模式
+int PipelineDepth = 64;           //  流水线各级之间的队列深度
+
+//  批量处理相关
+int ShardIndex = 0;               //  当前分片序号
+int ShardCount = 1;               //  分片总数
+bool KeepGoing = false;           //  出错时是否继续处理后面的文件
+std::string ReportPath = "";      //  结果报告文件,为空时不输出
+std::string MergeOutputPath = ""; //  合并报告的输出文件,不为空时为合并模式
+
+//  转码相关
+bool TranscodeMode = false;             //  非H264输入时是否转码
+std::string TranscodeEncoder = "";      //  编码器名字,为空时自动选择
+std::string TranscodeProfile = "baseline";
+int TranscodeLevel = 40;                //  level乘以10,如40表示4.0
+std::string TranscodePreset = "veryfast";
+int TranscodeCrf = 23;
+int TranscodeBitrate = 0;               //  kbps,为0时使用crf
+int TranscodeGop = 0;                   //  为0时使用2秒对应的帧数
+int TranscodeThreads = 0;               //  为0时自动
+
+//  校验相关
+bool VerifyMode = false;                //  转换完成后是否校验
+bool VerifySource = false;              //  是否与源文件的解码结果对比
+int VerifyThreads = 0;                  //  校验解码线程数,为0时自动
+
+//  推流相关
+std::string StreamTarget = "";          //  推流目标,为空时输出到H264文件
+EStreamPace StreamPace = EStreamPace_Fps;
+int StreamFd = -1;                      //  推流目标的文件描述符
+SStreamPacer StreamPacer;               //  当前文件的节拍和统计
+
+//  RTP相关
+std::string RtpTarget = "";             //  RTP目标 地址:端口,为空时不使用
+int RtpMtu = 1400;
+int RtpPt = 96;
+SRtpContext RtpCtx;                     //  RTP发送上下文,fd小于0时未使用
+
+//  拼接相关
+std::string ConcatName = "";            //  拼接输出的名字,为空时不拼接
+SConvOutput ConcatOut;                  //  拼接输出上下文,在全部文件之间共享
+int ConcatClipCnt = 0;                  //  已经写入的片段个数
+std::vector<unsigned char> ConcatSps;   //  上一个片段的SPS
+std::vector<unsigned char> ConcatPps;   //  上一个片段的PPS
+
+//  CRC相关
+bool CrcMode = false;                   //  是否在信息文件中输出每帧的CRC32C
+bool CheckMode = false;                 //  检查模式
+
+//  内存映射输出相关
+bool MmapMode = false;                  //  是否预分配并内存映射写入H264文件
+
+//  码流分析统计
+typedef struct
+{
+    double              frame_rate;        //  帧率,用于计算码率
+    unsigned long       frame_cnt;         //  帧数
+    long long           total_bytes;       //  所有帧的字节数
+    int                 max_size;          //  最大帧的字节长度
+    long                max_idx;           //  最大帧的序号
+    unsigned long       size_hist[ANALYZE_HIST_CNT];   //  帧大小的对数分桶直方图,用于计算百分位
+    std::vector<int>    ring;              //  峰值码率窗口内每帧的字节长度,环形缓冲区
+    long long           window_sum;        //  当前窗口内的字节数
+    long long           peak_sum;          //  窗口内字节数的最大值
+    long                peak_start;        //  峰值窗口的起始帧
+    std::map<int, int>  gop_hist;          //  GOP长度分布,长度 -> 个数
+    int                 gop_len;           //  当前GOP已有的帧数
+    unsigned long       slice_cnt[4];      //  I、P、B、无法识别的帧数
+    int                 b_run;             //  当前连续B帧个数
+    int                 b_run_max;         //  最大连续B帧个数
+    double              peak_bps;          //  峰值码率,汇总时为各文件的最大值
+    int                 files;             //  汇总的文件个数
+}SAnalyze;
+
+//  码流分析相关
+std::string AnalyzeName = "";           //  分析汇总报告文件,为空时不分析
+double AnalyzeWindow = 1.0;             //  峰值码率的滑动窗口长度,单位秒
+SAnalyze FileAnalyze;                   //  当前文件的统计
+SAnalyze BatchAnalyze;                  //  整个批次的统计
+std::vector<std::string> AnalyzeFileSummary;    //  每个文件的摘要(JSON)
+
+//  采样表中的一帧,分段并行和预演模式使用
+typedef struct
+{
+    long long           pos;               //  在源文件中的位置
+    long long           ts;                //  时间戳,用于定位
+    long long           offset;            //  在输出数据区中的偏移
+    int                 size;              //  字节长度,输出与输入相同
+    bool                key;               //  是否为关键帧
+    unsigned int        crc;               //  输出数据的CRC32C
+    int                 type;              //  帧类型,码流分析时使用
+}SSplitFrame;
+
+//  分段并行中的一段
+typedef struct
+{
+    int                 first;             //  起始帧号,为关键帧
+    int                 last;              //  结束帧号(不含)
+    int                 code;              //  0为成功,-1为与采样表不一致,-3为写入失败
+    double              ms;                //  耗时
+}SSplitRange;
+
+//  分段并行相关
+int SplitCount = 0;                     //  单个文件的分段数,小于2时不分段
+
+//  预演模式相关
+bool DryRunMode = false;                //  只根据采样表生成信息文件
+
+//  帧对齐相关
+int AlignSize = 0;                      //  每帧的对齐字节数,小于2时不对齐
+bool PadFiller = false;                 //  使用填充数据NAL填充,否则填充零
+bool AudMode = false;                   //  每帧之前插入AUD
+
+//  访问单元分隔符,primary_pic_type为7(任意类型)
+unsigned char audnal[6]={0x00, 0x00, 0x00, 0x01, 0x09, 0xF0};
+
+//  H265的访问单元分隔符(类型35),pic_type为2(I、P、B)
+unsigned char audnal_h265[7]={0x00, 0x00, 0x00, 0x01, 0x46, 0x01, 0x50};
+
+//  输出封装格式,EFraming_AVCC时每个NAL之前为4字节大端长度
+EFraming OutFraming = EFraming_AnnexB;
+
+//  NAL子索引相关
+bool NalIndexMode = false;              //  是否生成NAL子索引文件
+std::vector<unsigned char> NalFrameBuf; //  当前帧的NAL表(不含个数)
+int NalFrameCnt = 0;                    //  当前帧的NAL个数
+int NalFrameEnd = 0;                    //  当前帧上一个NAL的结尾
+unsigned long long NalTotalCnt = 0ULL;  //  当前文件的NAL总数
+
+//  替换时记录的包中的一个NAL,随包传给写入级,写入时不需要再次拆分
+typedef struct
+{
+    int                 offset;            //  NAL头部在包中的偏移(不含前缀)
+    int                 len;               //  NAL长度(含头部)
+    unsigned char       hdr;               //  NAL头部的第一个字节
+}SNalEntry;
+
+//  在各级之间传递的包,NAL表由程序自己保存,不放在FFmpeg的包中
+//  流水线中通过环形队列传递,写入后还给读取线程重复使用,NAL表的内存也随之重用
+typedef struct
+{
+    AVPacket*               pkt;
+    std::vector<SNalEntry>  nals;          //  替换时记录的NAL,只在生成NAL子索引时填写
+}SConvPacket;
+
+//  自定义输入读取上下文
+typedef struct
+{
+    int                 fd;
+    long long           pos;               //  当前读取位置
+    long long           size;              //  文件大小
+    unsigned long       reads;             //  读取次数
+    unsigned long long  bytes;             //  读取的字节数
+    unsigned long       seeks;             //  位置跳转次数(不含顺序读取)
+    double              read_ms;           //  读取耗时
+    unsigned long long  ra_bytes;          //  后台预读的字节数
+    std::atomic<long long> ra_pos;         //  当前读取位置,供预读线程使用
+    std::atomic<bool>   ra_stop;           //  预读线程退出标志
+    std::thread*        p_ra_thread;       //  预读线程
+    SUring*             p_uring;           //  io_uring读取上下文,为0时使用pread
+    int                 notify_fd;         //  跟随模式监视文件变化的inotify,为-1时定时查询
+    bool                writer_closed;     //  跟随模式时录制程序已经关闭文件
+    unsigned long       follow_waits;      //  跟随模式等待文件增长的次数
+    double              follow_wait_ms;    //  跟随模式等待文件增长的总时间
+}SAvioInput;
+
+//  自定义输入读取相关
+int AvioBufferKB = 0;                   //  缓冲区大小,为0时使用FFmpeg的文件协议
+int AvioReadaheadMB = 0;                //  后台预读大小,为0时不预读
+SAvioInput AvioInput;
+
+//  读写后端
+EIoMode IoMode = EIoMode_Stdio;
+
+//  跟随模式相关
+bool FollowMode = false;                //  输入文件还在增长
+int FollowTimeoutSec = 30;              //  超过该时间没有新数据时结束
+int FollowSyncMs = 1000;                //  输出同步到磁盘的最大间隔
+double FollowLastSyncMs = 0.0;          //  上一次同步的时间
+
+//  断点文件内容
+typedef struct
+{
+    long long           input_size;        //  输入文件的字节数
+    long long           input_mtime;       //  输入文件的修改时间
+    unsigned long       frame_cnt;         //  已经写入的帧数
+    unsigned long long  h264_bytes;        //  H264文件的字节数
+    long long           vinf_bytes;        //  信息文件的字节数
+    long long           vnal_bytes;        //  NAL子索引文件的字节数,没有时为-1
+    unsigned long long  pad_cnt;           //  已经填充的字节数
+    unsigned long long  nal_cnt;           //  已经记录的NAL个数
+    long long           dts;               //  继续转换的第一帧的解码时间戳
+    long long           pos;               //  该帧在输入文件中的位置
+    char                layout[64];        //  决定输出格式的选项
+}SCheckpoint;
+
+//  断点相关
+int CkptSec = 0;                        //  保存断点的间隔,为0时不保存
+bool ResumeMode = false;                //  从断点继续
+std::string CkptName = "";              //  当前文件的断点文件名,为空时不保存
+SCheckpoint CkptInput;                  //  当前输入文件的字节数和修改时间
+double CkptLastMs = 0.0;                //  上一次保存断点的时间
+int CkptSaveCnt = 0;                    //  当前文件保存断点的次数
+AVPacket* ResumePkt = 0;                //  从断点继续时,定位时已经读取的第一个关键帧
+
+//  一个跟踪事件,seq为环形缓冲区的序号,生产者写完后设置为位置加1,消费者取走后设置为位置加容量
+typedef struct
+{
+    const char*         name;              //  事件名字,必须为字符串常量
+    double              ts;                //  开始时刻,毫秒
+    double              dur;               //  持续时间,毫秒
+    int                 pid;               //  文件序号加1
+    int                 tid;               //  线程编号
+    long long           arg;               //  字节数或返回码
+    std::atomic<unsigned long long> seq;
+}STraceEvent;
+
+//  跟踪上下文,多个线程写入事件,一个后台线程写入文件
+typedef struct
+{
+    FILE*               pfile;
+    STraceEvent*        p_ring;            //  预分配的环形缓冲区,为0时不跟踪
+    alignas(64) std::atomic<unsigned long long> head;      //  生产者位置
+    alignas(64) unsigned long long tail;   //  消费者位置,只有后台线程访问
+    std::atomic<unsigned long long> dropped;   //  缓冲区满时丢弃的个数
+    unsigned long long  written;           //  写入文件的个数
+    bool                first;             //  是否为第一个事件(逗号)
+    double              t0;                //  开始时刻
+    std::atomic<bool>   stop;              //  后台线程退出标志
+    std::thread*        p_thread;          //  后台线程
+    std::mutex          lock;              //  保护以下的名字表
+    std::vector<std::string> file_names;   //  pid对应的文件名,下标为pid-1
+    std::map<int, std::string> thread_names;   //  线程编号 -> 名字
+    std::set<std::pair<int, int> > seen;   //  出现过的pid和线程编号,只有后台线程访问
+}STraceContext;
+
+//  跟踪相关
+std::string TraceName = "";             //  跟踪文件,为空时不跟踪
+STraceContext TraceCtx;
+std::atomic<int> TracePid(0);           //  当前文件的pid
+std::atomic<int> TraceTidCnt(0);        //  已经分配的线程编号
+thread_local int TraceTid = 0;          //  当前线程的编号,为0时还没有分配
+
+//  AVBufferPool分配函数的参数类型,FFmpeg 5.0(libavutil 57)开始为size_t
+#if LIBAVUTIL_VERSION_MAJOR >= 57
+typedef size_t PoolAllocSize;
+#else
+typedef int PoolAllocSize;
+#endif  //  LIBAVUTIL_VERSION_MAJOR
+
+//  包缓冲区池,按2的幂分级,每级一个AVBufferPool
+typedef struct
+{
+    AVBufferPool*       p_pool[POOL_CLASS_CNT];
+    std::atomic<unsigned long> gets;       //  从池中取得缓冲区的次数
+    std::atomic<unsigned long> allocs;     //  池中实际分配内存的次数
+    std::atomic<unsigned long> large;      //  超过最大一级直接分配的次数
+    std::atomic<unsigned long> copies;     //  包不可写时复制的次数
+    std::atomic<unsigned long> pkt_allocs; //  流水线中新分配的包结构体个数
+    std::atomic<unsigned long> pkt_reuse;  //  流水线中重复使用的包结构体个数
+    std::atomic<long long> inflight;       //  流水线中已经读取、还没有写出的字节数
+    std::atomic<long long> inflight_peak;  //  在途字节数的最大值
+    unsigned long       budget_waits;      //  超过预算时读取等待的次数,只有读取线程访问
+    double              budget_wait_ms;    //  超过预算时读取等待的总时间
+}SBufPool;
+
+//  缓冲区池相关
+int MemBudgetMB = 0;                    //  流水线在途字节数的上限,为0时不限制
+SBufPool BufPool;
+
+//  损坏文件恢复上下文
+typedef struct
+{
+    //  参考的编码配置,所有文件共用
+    std::vector<unsigned char> config;     //  avcC/hvcC
+    ECodec              codec;
+    int                 Width;
+    int                 Height;
+    float               FrameRate;
+
+    //  当前文件
+    int                 fd;                //  输入文件,小于0时没有在恢复
+    const unsigned char* p_map;            //  输入文件的只读映射
+    unsigned long long  map_size;
+    std::vector<std::pair<unsigned long long, unsigned long long> > ranges;    //  每个mdat的数据区[起始,结束)
+    size_t              range_idx;         //  当前扫描的mdat
+    int                 length_size;       //  长度前缀的字节数
+    unsigned long long  pos;               //  扫描位置
+    unsigned long long  chain_end;         //  已经确认的NAL链的结束位置
+    unsigned long long  gap_end;           //  下一个确认的NAL链的开始,之间只接受能完整放入的单个NAL
+    bool                contiguous;        //  pos紧接在确认的NAL之后
+
+    //  正在组装的访问单元,连续的NAL合并为一段
+    std::vector<std::pair<unsigned long long, unsigned long long> > au_parts;
+    bool                au_vcl;            //  已经含有图像数据
+    bool                au_key;            //  含有IDR/IRAP
+    bool                pend;              //  已经读出、属于下一个访问单元的NAL
+    unsigned long long  pend_pos;
+    unsigned int        pend_len;
+    bool                started;           //  已经输出了第一个关键帧
+
+    //  统计
+    unsigned long       nal_cnt;
+    unsigned long       frame_cnt;
+    unsigned long       key_cnt;
+    unsigned long       lead_drop;         //  第一个关键帧之前丢弃的帧数
+    unsigned long       resync_cnt;        //  NAL链断开的次数
+    unsigned long long  skip_bytes;        //  跳过的字节数(音频、损坏的数据)
+}SRecoverContext;
+
+//  恢复相关
+std::string RecoverRef = "";            //  恢复模式的参考文件,为空时不恢复
+float RecoverFps = 0.0f;                //  恢复时的帧率,为0时使用参考文件的帧率
+SRecoverContext RecoverCtx;
+
+#if USE_IO_URING
+//  io_uring读写上下文
+//  缓冲区分为URING_DEPTH块并注册到内核,每块对应一个请求
+//  读取时空闲的块依次预读文件中之后的数据,写入时每凑满一块提交一次
+struct SUring
+{
+    struct io_uring     ring;
+    int                 fd;
+    unsigned char*      p_buf;                     //  注册的缓冲区
+    long long           block_pos[URING_DEPTH];    //  每块对应的文件位置
+    int                 block_len[URING_DEPTH];    //  每块的字节数,读取完成后为实际读取的字节数
+    bool                busy[URING_DEPTH];         //  是否有在途的请求
+    bool                valid[URING_DEPTH];        //  读取时数据是否可用
+    int                 cur;                       //  写入时当前填充的块
+    int                 fill;                      //  写入时当前块已填充的字节数
+    long long           next_pos;                  //  下一个请求的文件位置
+    int                 inflight;                  //  在途的请求个数
+    int                 max_inflight;              //  最大在途的请求个数
+    unsigned long       ops;                       //  完成的请求个数
+    bool                error;                     //  是否发生了错误
+};
+#endif  //  USE_IO_URING
+
+//---------------------------------------------------------------------
+//  函数声明
+int FFMpeg_OpenTranscode(void);
+void FFMpeg_CloseVideo(void);
+int Codec_GetParamSets(const unsigned char* pdat, int len);
+void H264_ParseCurrentSps(void);
+void H265_ParsePpsExtraBits(void);
+const char* Codec_Name(ECodec codec);
+void Recover_Close(void);
+int Vinf_Load(std::string vinf_name, SVinfInfo& info);
+double Pipe_NowMs(void);
+void Analyze_AddFrame(SAnalyze& ana, int size, AVPacket* pkt);
+void Analyze_AddFrameInfo(SAnalyze& ana, int size, bool key, int type);
+double Trace_Begin(void);
+void Trace_Add(const char* name, double t0, long long arg);
+void Trace_ThreadName(const char* name);
+
 //---------------------------------------------------------------------
 //  其他封装函数
 
@@ -339,534 +1340,6745 @@ std::string GetOnlyFilePath(std::string in_str)
     return re_str;
 }
 
+#if USE_IO_URING
 //---------------------------------------------------------------------
-//  打开一个视频文件
-int FFMpeg_OpenVideo(std::string filename)
-{
-    //  定义返回值
-    int re = -1;
+//  io_uring相关函数
 
-    //  打开视频文件
-    re = avformat_open_input(&ffmpeg_context.p_fmt_ctx,
-                             filename.c_str(),
-                             NULL, NULL
-                            );
-    if(re != 0)
+//  创建io_uring并注册缓冲区
+//  成功返回上下文,内核不支持或者资源不足时返回0(使用stdio)
+SUring* Uring_Create(int fd)
+{
+    SUring* pu = new SUring;
+    memset(pu, 0, sizeof(SUring));
+    pu->fd = fd;
+    int re = io_uring_queue_init(URING_DEPTH * 2, &pu->ring, 0);
+    if(re < 0)
     {
-        printf("ERROR:avformat_open_input()\r\n");
-        ffmpeg_context.p_fmt_ctx = 0;
-        return -1;
+        printf("[Uring] io_uring_queue_init() Error!! %s, use stdio\r\n", strerror(-re));
+        delete pu;
+        return 0;
     }
-
-    //  搜索流信息
-    re = avformat_find_stream_info(ffmpeg_context.p_fmt_ctx,
-                                   NULL
-                                  );
-    if(re != 0)
+    if(posix_memalign((void**)&pu->p_buf, 4096, (size_t)URING_BLOCK * URING_DEPTH) != 0)
     {
-        if(ffmpeg_context.p_fmt_ctx != 0)
-        {
-            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
-            ffmpeg_context.p_fmt_ctx = 0;
-        }
-        printf("ERROR:avformat_find_stream_info()\r\n");
-        return -2;
+        printf("[Uring] Alloc Buffer Error!! use stdio\r\n");
+        io_uring_queue_exit(&pu->ring);
+        delete pu;
+        return 0;
+    }
+    struct iovec iov[URING_DEPTH];
+    int i=0;
+    for(i=0;i<URING_DEPTH;i++)
+    {
+        iov[i].iov_base = pu->p_buf + (size_t)i * URING_BLOCK;
+        iov[i].iov_len = URING_BLOCK;
+    }
+    re = io_uring_register_buffers(&pu->ring, iov, URING_DEPTH);
+    if(re < 0)
+    {
+        printf("[Uring] io_uring_register_buffers() Error!! %s, use stdio\r\n", strerror(-re));
+        io_uring_queue_exit(&pu->ring);
+        free(pu->p_buf);
+        delete pu;
+        return 0;
     }
+    return pu;
+}
 
-    //  打印流信息
-#if DEBUG_LOG
-    av_dump_format(ffmpeg_context.p_fmt_ctx, 0, filename.c_str(), 0);
-#endif  //  FFMPEG_DEBUG_LOG
+//  释放io_uring,调用前需要没有在途的请求
+void Uring_Destroy(SUring* pu)
+{
+    if(pu == 0) return;
+    io_uring_queue_exit(&pu->ring);
+    free(pu->p_buf);
+    delete pu;
+}
 
-    //  查找第一个视频流 和 音频流
-    ffmpeg_context.v_idx = -1;
-    ffmpeg_context.a_idx = -1;
-    int i=0;
-    for (i=0; i<ffmpeg_context.p_fmt_ctx->nb_streams; i++)
+//  提交一块的读取或写入
+//  成功返回true
+bool Uring_Submit(SUring* pu, int idx, bool write, int len)
+{
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&pu->ring);
+    if(sqe == 0) return false;
+    unsigned char* pbuf = pu->p_buf + (size_t)idx * URING_BLOCK;
+    if(write) io_uring_prep_write_fixed(sqe, pu->fd, pbuf, len, pu->block_pos[idx], idx);
+    else      io_uring_prep_read_fixed(sqe, pu->fd, pbuf, len, pu->block_pos[idx], idx);
+    io_uring_sqe_set_data(sqe, (void*)(intptr_t)idx);
+    if(io_uring_submit(&pu->ring) < 0) return false;
+    pu->block_len[idx] = len;
+    pu->busy[idx] = true;
+    pu->inflight++;
+    if(pu->inflight > pu->max_inflight) pu->max_inflight = pu->inflight;
+    return true;
+}
+
+//  等待一个请求完成
+//  返回完成的块序号,失败返回-1
+int Uring_WaitOne(SUring* pu, bool write)
+{
+    struct io_uring_cqe* cqe = 0;
+    int re = 0;
+    do
     {
-        //  当为视频流
-        if (ffmpeg_context.p_fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
-        {
-            ffmpeg_context.v_idx = i;
-            ffmpeg_context.TotalFrame = ffmpeg_context.p_fmt_ctx->streams[i]->nb_frames;
-            printf("Find a video stream, index %d\r\n", ffmpeg_context.v_idx);
-            printf("Total Frame = %ld\r\n", ffmpeg_context.TotalFrame);
-            ffmpeg_context.FrameRate = 
-                (ffmpeg_context.p_fmt_ctx->streams[i]->avg_frame_rate.num * 1.0f)/
-                    ffmpeg_context.p_fmt_ctx->streams[i]->avg_frame_rate.den;
-            break;
-        }
-        //  当为音频流
-        if(ffmpeg_context.p_fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
-        {
-            ffmpeg_context.a_idx = i;
-            printf("Find a Audio stream, index %d\r\n", ffmpeg_context.a_idx);
-        }
+        re = io_uring_wait_cqe(&pu->ring, &cqe);
+    }while(re == -EINTR);
+    if(re < 0)
+    {
+        pu->error = true;
+        return -1;
     }
-    if (ffmpeg_context.v_idx == -1)
+    int idx = (int)(intptr_t)io_uring_cqe_get_data(cqe);
+    int res = cqe->res;
+    io_uring_cqe_seen(&pu->ring, cqe);
+    pu->busy[idx] = false;
+    pu->inflight--;
+    pu->ops++;
+
+    //  写入不完整时用pwrite补齐剩余部分
+    if(write)
     {
-        printf("ERROR:Cann't find a video stream\r\n");
-        if(ffmpeg_context.p_fmt_ctx != 0)
+        int done = (res > 0) ? res : 0;
+        while((res >= 0) && (done < pu->block_len[idx]))
         {
-            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
-            ffmpeg_context.p_fmt_ctx = 0;
+            ssize_t n = pwrite(pu->fd, pu->p_buf + (size_t)idx * URING_BLOCK + done,
+                               pu->block_len[idx] - done, (off_t)(pu->block_pos[idx] + done));
+            if((n < 0) && (errno == EINTR)) continue;
+            if(n <= 0) break;
+            done += n;
         }
-        return -3;
+        if(done != pu->block_len[idx]) pu->error = true;
+        return idx;
     }
-    ffmpeg_context.video_stream = 
-        ffmpeg_context.p_fmt_ctx->streams[ffmpeg_context.v_idx];
-    printf("frame_rate = %f fps\r\n", ffmpeg_context.FrameRate);
-    if(ffmpeg_context.a_idx == -1)
+
+    //  读取
+    if(res < 0)
     {
-#if FFMPEG_HINT_LOG
-        printf("WARNNING:Cann't find a audio stream\r\n");
-#endif  //  FFMPEG_HINT_LOG
+        pu->error = true;
+        res = 0;
     }
-    else
+    pu->block_len[idx] = res;
+    pu->valid[idx] = true;
+    return idx;
+}
+
+//  提交当前块的写入,并等待下一块空闲
+//  成功返回0
+int Uring_FlushBlock(SUring* pu)
+{
+    if(pu->fill == 0) return pu->error ? -1 : 0;
+    pu->block_pos[pu->cur] = pu->next_pos;
+    if(!Uring_Submit(pu, pu->cur, true, pu->fill)) return -1;
+    pu->next_pos += pu->fill;
+    pu->fill = 0;
+    pu->cur = (pu->cur + 1) % URING_DEPTH;
+    while(pu->busy[pu->cur])
     {
-        ffmpeg_context.audio_stream = 
-            ffmpeg_context.p_fmt_ctx->streams[ffmpeg_context.a_idx];
+        if(Uring_WaitOne(pu, true) < 0) return -1;
     }
+    return pu->error ? -1 : 0;
+}
 
-    //  为视频流构造解码器
-    //  获取解码器参数
-    ffmpeg_context.p_codec_par = 
-        ffmpeg_context.p_fmt_ctx->streams[ffmpeg_context.v_idx]->codecpar;
+//  写入数据,复制到当前块,凑满一块后提交
+//  成功返回len,失败返回-1
+int Uring_Write(SUring* pu, const void* pdat, int len)
+{
+    const unsigned char* psrc = (const unsigned char*)pdat;
+    int done = 0;
+    while(done < len)
+    {
+        int n = std::min(len - done, URING_BLOCK - pu->fill);
+        memcpy(pu->p_buf + (size_t)pu->cur * URING_BLOCK + pu->fill, psrc + done, n);
+        pu->fill += n;
+        done += n;
+        if((pu->fill == URING_BLOCK) && (Uring_FlushBlock(pu) != 0)) return -1;
+    }
+    return len;
+}
 
-    //  获取解码器
-    //  限制解码器
-    ffmpeg_context.p_codec = avcodec_find_decoder_by_name("h264");
-    if(ffmpeg_context.p_codec == NULL)
+//  写出剩余数据并等待全部请求完成
+//  成功返回0
+int Uring_Finish(SUring* pu)
+{
+    int re = Uring_FlushBlock(pu);
+    while(pu->inflight > 0)
     {
-        if(ffmpeg_context.p_fmt_ctx != 0)
-        {
-            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
-            ffmpeg_context.p_fmt_ctx = 0;
-        }
-        printf("ERROR:avcodec_find_decoder()\r\n");
-        return -4;
+        if(Uring_WaitOne(pu, true) < 0) return -1;
     }
+    return ((re != 0) || pu->error) ? -1 : 0;
+}
 
-    //  构造解码器
-    ffmpeg_context.p_codec_ctx = avcodec_alloc_context3(ffmpeg_context.p_codec);
-    if(ffmpeg_context.p_codec_ctx == NULL)
+//  空闲的块依次预读文件中之后的数据
+void Uring_Prefetch(SUring* pu, long long file_size)
+{
+    int i=0;
+    for(i=0;i<URING_DEPTH;i++)
     {
-        if(ffmpeg_context.p_fmt_ctx != 0)
-        {
-            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
-            ffmpeg_context.p_fmt_ctx = 0;
-        }
-        printf("ERROR:avcodec_alloc_context3()\r\n");
-        return -5;
+        if(pu->next_pos >= file_size) break;
+        if(pu->busy[i] || pu->valid[i]) continue;
+        int len = (int)std::min((long long)URING_BLOCK, file_size - pu->next_pos);
+        pu->block_pos[i] = pu->next_pos;
+        if(!Uring_Submit(pu, i, false, len)) break;
+        pu->next_pos += len;
     }
+}
 
-    //  解码器参数初始化
-    re = avcodec_parameters_to_context(ffmpeg_context.p_codec_ctx, 
-                                       ffmpeg_context.p_codec_par
-                                      );
-    if(re < 0)
+//  从预读的块中读取,数据还在读取中时等待
+//  位置不在任何块中(跳转)时丢弃全部预读,从该位置重新开始
+//  成功返回读取的字节数,文件结束返回0,失败返回-1
+int Uring_Read(SUring* pu, unsigned char* buf, int size, long long pos, long long file_size)
+{
+    if(pos >= file_size) return 0;
+    while(1)
     {
-        if(ffmpeg_context.p_codec_ctx != 0)
+        //  查找包含该位置的块,已经读过的块可以重新用于预读
+        int hit = -1;
+        int i=0;
+        for(i=0;i<URING_DEPTH;i++)
         {
-            avcodec_free_context(&ffmpeg_context.p_codec_ctx);
-            ffmpeg_context.p_codec_ctx = 0;
+            if(!pu->busy[i] && !pu->valid[i]) continue;
+            long long end = pu->block_pos[i] + pu->block_len[i];
+            if((pos >= pu->block_pos[i]) && (pos < end)) hit = i;
+            else if(!pu->busy[i] && (end <= pos)) pu->valid[i] = false;
         }
-        if(ffmpeg_context.p_fmt_ctx != 0)
+        if(hit < 0)
         {
-            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
-            ffmpeg_context.p_fmt_ctx = 0;
+            while(pu->inflight > 0)
+            {
+                if(Uring_WaitOne(pu, false) < 0) return -1;
+            }
+            for(i=0;i<URING_DEPTH;i++) pu->valid[i] = false;
+            pu->next_pos = pos;
+            Uring_Prefetch(pu, file_size);
+            if(pu->inflight == 0) return -1;
+            continue;
         }
-        printf("ERROR:avcodec_parameters_to_context()\r\n");
-        return -6;
-    }
 
-    //  打开解码器
-    re = avcodec_open2(ffmpeg_context.p_codec_ctx, ffmpeg_context.p_codec, NULL);
-    if(re < 0)
-    {
-        if(ffmpeg_context.p_codec_ctx != 0)
+        //  等待该块完成
+        while(pu->busy[hit])
         {
-            avcodec_free_context(&ffmpeg_context.p_codec_ctx);
-            ffmpeg_context.p_codec_ctx = 0;
+            if(Uring_WaitOne(pu, false) < 0) return -1;
         }
-        if(ffmpeg_context.p_fmt_ctx != 0)
+        if(pu->error) return -1;
+        if(pu->block_len[hit] == 0) return 0;
+        int off = (int)(pos - pu->block_pos[hit]);
+        if(off >= pu->block_len[hit])
         {
-            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
-            ffmpeg_context.p_fmt_ctx = 0;
+            //  读取不完整,从该位置重新读取
+            pu->valid[hit] = false;
+            continue;
         }
-        printf("ERROR:avcodec_open2()\r\n");
-        return -7;
+        int n = std::min(size, pu->block_len[hit] - off);
+        memcpy(buf, pu->p_buf + (size_t)hit * URING_BLOCK + off, n);
+        if(off + n >= pu->block_len[hit]) pu->valid[hit] = false;
+        Uring_Prefetch(pu, file_size);
+        return n;
     }
+}
+#endif  //  USE_IO_URING
 
-    //  解码器打开成功
+//---------------------------------------------------------------------
+//  H264输出写入后端相关函数
+
+//  H264文件使用io_uring时创建写入上下文
+void Io_OpenWriter(SConvOutput& out)
+{
+    out.p_uring = 0;
+    out.write_ms = 0.0;
+#if USE_IO_URING
+    if((IoMode == EIoMode_Uring) && (out.pfile_outh264 != 0)) out.p_uring = Uring_Create(fileno(out.pfile_outh264));
+    if(out.p_uring != 0) out.p_uring->next_pos = out.byte_cnt;
+#endif  //  USE_IO_URING
+}
+
+//  关闭H264文件,写出剩余数据,并打印写入吞吐量
+//  成功返回0,写入失败返回-3
+int Io_CloseWriter(SConvOutput& out)
+{
+    if(out.pfile_outh264 == 0) return 0;
+    int re = 0;
+    double t0 = Pipe_NowMs();
+    const char* backend = "stdio";
+#if USE_IO_URING
+    if(out.p_uring != 0)
+    {
+        backend = "uring";
+        if(Uring_Finish(out.p_uring) != 0) re = -3;
+        printf("[Uring] write ops=%lu max_inflight=%d\r\n", out.p_uring->ops, out.p_uring->max_inflight);
+        Uring_Destroy(out.p_uring);
+        out.p_uring = 0;
+    }
+#endif  //  USE_IO_URING
+    if(fclose(out.pfile_outh264) != 0) re = -3;
+    out.pfile_outh264 = 0;
+    out.write_ms += Pipe_NowMs() - t0;
+    printf("[IO] backend=%s write=%.1fMB %.1fms %.1fMB/s\r\n", backend, out.byte_cnt / 1048576.0, out.write_ms,
+           (out.write_ms > 0.0) ? (out.byte_cnt / 1048576.0 * 1000.0 / out.write_ms) : 0.0);
+    if(re != 0) printf("[Error] H264 Output Video File Close Error!!\r\n");
+    return re;
+}
+
+//---------------------------------------------------------------------
+//  自定义输入读取相关函数
+//  用大缓冲区减少小读取的次数,并通过fadvise和后台预读让内核提前读入页缓存
+
+//  跟随模式时读到文件末尾,等待文件增长
+//  文件增长返回true,录制程序关闭文件或者超时返回false
+//  inotify只能收到添加监视之后的关闭事件,第一次等待时用修改时间判断录制是否早已结束
+bool Avio_FollowWait(SAvioInput* pin)
+{
+    double t0 = Pipe_NowMs();
+    struct stat st0;
+    if((pin->follow_waits == 0) && (fstat(pin->fd, &st0) == 0) && (st0.st_size <= pin->pos) &&
+       (time(0) - st0.st_mtime >= FollowTimeoutSec))
+    {
+        printf("[Follow] Input not modified in %ds, treat as finished\r\n", FollowTimeoutSec);
+        pin->writer_closed = true;
+    }
+    pin->follow_waits++;
+    bool grown = false;
+    while(!grown)
+    {
+        //  等待文件变化,没有inotify时定时查询
+        if(pin->notify_fd >= 0)
+        {
+            struct pollfd pfd;
+            pfd.fd = pin->notify_fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if(poll(&pfd, 1, 200) > 0)
+            {
+                char evbuf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+                ssize_t len = read(pin->notify_fd, evbuf, sizeof(evbuf));
+                ssize_t k = 0;
+                while(k + (ssize_t)sizeof(struct inotify_event) <= len)
+                {
+                    const struct inotify_event* pev = (const struct inotify_event*)(evbuf + k);
+                    if((pev->mask & IN_CLOSE_WRITE) != 0) pin->writer_closed = true;
+                    k += sizeof(struct inotify_event) + pev->len;
+                }
+            }
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+
+        //  检查文件大小,关闭后也要读完最后写入的数据
+        struct stat st;
+        if((fstat(pin->fd, &st) == 0) && (st.st_size > pin->pos))
+        {
+            pin->size = st.st_size;
+            grown = true;
+        }
+        else if(pin->writer_closed)
+        {
+            printf("[Follow] Writer closed the file, finish\r\n");
+            break;
+        }
+        else if(Pipe_NowMs() - t0 >= FollowTimeoutSec * 1000.0)
+        {
+            printf("[Follow] No new data in %ds, finish\r\n", FollowTimeoutSec);
+            break;
+        }
+    }
+    pin->follow_wait_ms += Pipe_NowMs() - t0;
+    Trace_Add("follow", t0, pin->size);
+    return grown;
+}
+
+//  AVIOContext的读取回调
+int Avio_Read(void* opaque, uint8_t* buf, int size)
+{
+    SAvioInput* pin = (SAvioInput*)opaque;
+    double t0 = Pipe_NowMs();
+    ssize_t n = 0;
+#if USE_IO_URING
+    if(pin->p_uring != 0)
+    {
+        n = Uring_Read(pin->p_uring, buf, size, pin->pos, pin->size);
+        if(n < 0) errno = EIO;
+    }
+    else
+#endif  //  USE_IO_URING
+    do
+    {
+        n = pread(pin->fd, buf, size, (off_t)pin->pos);
+        if((n == 0) && FollowMode && Avio_FollowWait(pin)) n = -1;
+        else if((n < 0) && (errno != EINTR)) break;
+    }while(n < 0);
+    pin->read_ms += Pipe_NowMs() - t0;
+    pin->reads++;
+    Trace_Add("pread", t0, n);
+    if(n < 0) return AVERROR(errno);
+    if(n == 0) return AVERROR_EOF;
+    pin->pos += n;
+    pin->bytes += n;
+    pin->ra_pos = pin->pos;
+    return n;
+}
+
+//  AVIOContext的定位回调
+int64_t Avio_Seek(void* opaque, int64_t offset, int whence)
+{
+    SAvioInput* pin = (SAvioInput*)opaque;
+    if((whence & AVSEEK_SIZE) != 0) return FollowMode ? AVERROR(ENOSYS) : pin->size;
+
+    long long pos = 0;
+    switch(whence & ~AVSEEK_FORCE)
+    {
+        case SEEK_SET: pos = offset;             break;
+        case SEEK_CUR: pos = pin->pos + offset;  break;
+        case SEEK_END: pos = pin->size + offset; break;
+        default:       return AVERROR(EINVAL);
+    }
+    if(pos < 0) return AVERROR(EINVAL);
+    if(pos != pin->pos)
+    {
+        pin->seeks++;
+        pin->pos = pos;
+        pin->ra_pos = pos;
+    }
+    return pos;
+}
+
+//  后台预读线程,保持当前读取位置之后的AvioReadaheadMB已经在页缓存中
+//  读取位置跳转(如读取文件末尾的moov)后从新位置重新开始
+void Avio_ReadaheadThread(SAvioInput* pin)
+{
+    long long window = (long long)AvioReadaheadMB * 1024 * 1024;
+    long long chunk = window / 4;
+    if(chunk < 256 * 1024) chunk = 256 * 1024;
+    long long done = 0;
+    while(!pin->ra_stop)
+    {
+        long long pos = pin->ra_pos;
+        if((done < pos) || (done > pos + window + chunk)) done = pos;
+        if((done < pos + window) && (done < pin->size))
+        {
+            //  阻塞直到数据读入页缓存
+            if(readahead(pin->fd, (off64_t)done, (size_t)chunk) == 0) pin->ra_bytes += chunk;
+            done += chunk;
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+}
+
+//  创建自定义输入读取,并分配使用它的AVFormatContext
+//  成功返回0,不是本地文件时返回1(使用FFmpeg的文件协议),失败返回-1
+int Avio_Open(std::string filename)
+{
+    AvioInput.fd = open(filename.c_str(), O_RDONLY);
+    if(AvioInput.fd < 0) return 1;
+    struct stat st;
+    if((fstat(AvioInput.fd, &st) != 0) || !S_ISREG(st.st_mode))
+    {
+        close(AvioInput.fd);
+        return 1;
+    }
+    AvioInput.pos = 0;
+    AvioInput.size = st.st_size;
+    AvioInput.reads = 0UL;
+    AvioInput.bytes = 0ULL;
+    AvioInput.seeks = 0UL;
+    AvioInput.read_ms = 0.0;
+    AvioInput.ra_bytes = 0ULL;
+    AvioInput.ra_pos = 0;
+    AvioInput.ra_stop = false;
+    AvioInput.p_ra_thread = 0;
+    AvioInput.p_uring = 0;
+    AvioInput.notify_fd = -1;
+    AvioInput.writer_closed = false;
+    AvioInput.follow_waits = 0UL;
+    AvioInput.follow_wait_ms = 0.0;
+
+    //  告知内核顺序读取,并提前读入第一段
+    int buf_size = AvioBufferKB * 1024;
+    posix_fadvise(AvioInput.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(AvioInput.fd, 0, (off_t)buf_size * 4, POSIX_FADV_WILLNEED);
+
+    //  AVIOContext
+    unsigned char* pbuf = (unsigned char*)av_malloc(buf_size);
+    if(pbuf != 0)
+    {
+        ffmpeg_context.p_avio = avio_alloc_context(pbuf, buf_size, 0, &AvioInput, Avio_Read, NULL, Avio_Seek);
+    }
+    if(ffmpeg_context.p_avio == 0)
+    {
+        av_free(pbuf);
+        close(AvioInput.fd);
+        return -1;
+    }
+
+    //  使用该AVIOContext的AVFormatContext
+    ffmpeg_context.p_fmt_ctx = avformat_alloc_context();
+    if(ffmpeg_context.p_fmt_ctx == 0) return -1;
+    ffmpeg_context.p_fmt_ctx->pb = ffmpeg_context.p_avio;
+    ffmpeg_context.p_fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    //  跟随模式,文件还在增长,按不能定位的流读取(分片按顺序读取,不读取文件末尾的mfra)
+    if(FollowMode)
+    {
+        ffmpeg_context.p_avio->seekable = 0;
+        AvioInput.notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if((AvioInput.notify_fd >= 0) &&
+           (inotify_add_watch(AvioInput.notify_fd, filename.c_str(), IN_MODIFY | IN_CLOSE_WRITE) < 0))
+        {
+            close(AvioInput.notify_fd);
+            AvioInput.notify_fd = -1;
+        }
+        if(AvioInput.notify_fd < 0) printf("[Follow] inotify unavailable, poll file size\r\n");
+    }
+
+    //  io_uring读取,同时保持多个读取在途
+#if USE_IO_URING
+    if(IoMode == EIoMode_Uring) AvioInput.p_uring = Uring_Create(AvioInput.fd);
+#endif  //  USE_IO_URING
+
+    //  后台预读
+    if(AvioReadaheadMB > 0) AvioInput.p_ra_thread = new std::thread(Avio_ReadaheadThread, &AvioInput);
+    return 0;
+}
+
+//  释放自定义输入读取,并打印读取统计
+//  需要在avformat_close_input()之后调用
+void Avio_Close(void)
+{
+    if(ffmpeg_context.p_avio == 0) return;
+    if(AvioInput.p_ra_thread != 0)
+    {
+        AvioInput.ra_stop = true;
+        AvioInput.p_ra_thread->join();
+        delete AvioInput.p_ra_thread;
+        AvioInput.p_ra_thread = 0;
+    }
+    printf("[IO] reads=%lu bytes=%llu avg_read=%.1fKB seeks=%lu read=%.1fms readahead=%.1fMB\r\n",
+           AvioInput.reads, AvioInput.bytes,
+           (AvioInput.reads > 0) ? (AvioInput.bytes / 1024.0 / AvioInput.reads) : 0.0,
+           AvioInput.seeks, AvioInput.read_ms, AvioInput.ra_bytes / 1048576.0);
+#if USE_IO_URING
+    if(AvioInput.p_uring != 0)
+    {
+        //  等待在途的预读完成后释放
+        while(AvioInput.p_uring->inflight > 0)
+        {
+            if(Uring_WaitOne(AvioInput.p_uring, false) < 0) break;
+        }
+        printf("[Uring] read ops=%lu max_inflight=%d\r\n", AvioInput.p_uring->ops, AvioInput.p_uring->max_inflight);
+        Uring_Destroy(AvioInput.p_uring);
+        AvioInput.p_uring = 0;
+    }
+#endif  //  USE_IO_URING
+    if(FollowMode)
+    {
+        printf("[Follow] waits=%lu waited=%.1fs\r\n", AvioInput.follow_waits, AvioInput.follow_wait_ms / 1000.0);
+        if(AvioInput.notify_fd >= 0) close(AvioInput.notify_fd);
+        AvioInput.notify_fd = -1;
+    }
+    av_freep(&ffmpeg_context.p_avio->buffer);
+    avio_context_free(&ffmpeg_context.p_avio);
+    ffmpeg_context.p_avio = 0;
+    close(AvioInput.fd);
+}
+
+//---------------------------------------------------------------------
+//  打开一个视频文件
+int FFMpeg_OpenVideo(std::string filename)
+{
+    //  定义返回值
+    int re = -1;
+
+    //  使用自定义的输入读取
+    if(AvioBufferKB > 0)
+    {
+        re = Avio_Open(filename);
+        if(re < 0)
+        {
+            printf("ERROR:Avio_Open()\r\n");
+            return -1;
+        }
+    }
+
+    //  打开视频文件
+    double trace_t0 = Trace_Begin();
+    re = avformat_open_input(&ffmpeg_context.p_fmt_ctx,
+                             filename.c_str(),
+                             NULL, NULL
+                            );
+    Trace_Add("open", trace_t0, 0);
+    if(re != 0)
+    {
+        printf("ERROR:avformat_open_input()\r\n");
+        ffmpeg_context.p_fmt_ctx = 0;
+        return -1;
+    }
+
+    //  搜索流信息,预演模式时不搜索(需要读取视频数据)
+    re = 0;
+    if(!DryRunMode)
+    {
+        trace_t0 = Trace_Begin();
+        re = avformat_find_stream_info(ffmpeg_context.p_fmt_ctx,
+                                       NULL
+                                      );
+        Trace_Add("probe", trace_t0, 0);
+    }
+    if(re != 0)
+    {
+        if(ffmpeg_context.p_fmt_ctx != 0)
+        {
+            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
+            ffmpeg_context.p_fmt_ctx = 0;
+        }
+        printf("ERROR:avformat_find_stream_info()\r\n");
+        return -2;
+    }
+
+    //  打印流信息
+#if DEBUG_LOG
+    av_dump_format(ffmpeg_context.p_fmt_ctx, 0, filename.c_str(), 0);
+#endif  //  FFMPEG_DEBUG_LOG
+
+    //  查找第一个视频流 和 音频流
+    ffmpeg_context.v_idx = -1;
+    ffmpeg_context.a_idx = -1;
+    int i=0;
+    for (i=0; i<ffmpeg_context.p_fmt_ctx->nb_streams; i++)
+    {
+        //  当为视频流
+        if (ffmpeg_context.p_fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+        {
+            ffmpeg_context.v_idx = i;
+            ffmpeg_context.TotalFrame = ffmpeg_context.p_fmt_ctx->streams[i]->nb_frames;
+            if(FollowMode) ffmpeg_context.TotalFrame = 0UL;     //  文件还在增长,读到结束为止
+            printf("Find a video stream, index %d\r\n", ffmpeg_context.v_idx);
+            printf("Total Frame = %ld\r\n", ffmpeg_context.TotalFrame);
+            ffmpeg_context.FrameRate = 
+                (ffmpeg_context.p_fmt_ctx->streams[i]->avg_frame_rate.num * 1.0f)/
+                    ffmpeg_context.p_fmt_ctx->streams[i]->avg_frame_rate.den;
+            break;
+        }
+        //  当为音频流
+        if(ffmpeg_context.p_fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+        {
+            ffmpeg_context.a_idx = i;
+            printf("Find a Audio stream, index %d\r\n", ffmpeg_context.a_idx);
+        }
+    }
+    if (ffmpeg_context.v_idx == -1)
+    {
+        printf("ERROR:Cann't find a video stream\r\n");
+        if(ffmpeg_context.p_fmt_ctx != 0)
+        {
+            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
+            ffmpeg_context.p_fmt_ctx = 0;
+        }
+        return -3;
+    }
+    ffmpeg_context.video_stream = 
+        ffmpeg_context.p_fmt_ctx->streams[ffmpeg_context.v_idx];
+    printf("frame_rate = %f fps\r\n", ffmpeg_context.FrameRate);
+    if(ffmpeg_context.a_idx == -1)
+    {
+#if FFMPEG_HINT_LOG
+        printf("WARNNING:Cann't find a audio stream\r\n");
+#endif  //  FFMPEG_HINT_LOG
+    }
+    else
+    {
+        ffmpeg_context.audio_stream = 
+            ffmpeg_context.p_fmt_ctx->streams[ffmpeg_context.a_idx];
+    }
+
+    //  为视频流构造解码器
+    //  获取解码器参数
+    ffmpeg_context.p_codec_par = 
+        ffmpeg_context.p_fmt_ctx->streams[ffmpeg_context.v_idx]->codecpar;
+
+    //  H264和H265直接提取,开启了转码时H265仍然转码为H264
+    ffmpeg_context.codec = ECodec_H264;
+    ffmpeg_context.slice_extra_bits = 0;
+    if((ffmpeg_context.p_codec_par->codec_id == AV_CODEC_ID_HEVC) && !TranscodeMode)
+    {
+        ffmpeg_context.codec = ECodec_H265;
+    }
+    //  当不是H264的流
+    else if(ffmpeg_context.p_codec_par->codec_id != AV_CODEC_ID_H264)
+    {
+        printf("Video Codec is %s, not h264\r\n", avcodec_get_name(ffmpeg_context.p_codec_par->codec_id));
+
+        //  开启了转码时,打开解码器和编码器
+        if(TranscodeMode)
+        {
+            return FFMpeg_OpenTranscode();
+        }
+
+        //  否则报错
+        if(ffmpeg_context.p_fmt_ctx != 0)
+        {
+            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
+            ffmpeg_context.p_fmt_ctx = 0;
+        }
+        return -8;
+    }
+
+    //  获取参数集,同时判断封装格式
+    re = Codec_GetParamSets(ffmpeg_context.p_codec_par->extradata,
+                            ffmpeg_context.p_codec_par->extradata_size);
+    if(re != 0)
+    {
+        printf("ERROR:Bad avcC/hvcC extradata\r\n");
+        FFMpeg_CloseVideo();
+        return -9;
+    }
+#if DEBUG_LOG
+    printf("SPS len = %d(bytes)\r\n", ffmpeg_context.sps_len);
+    printf("PPS len = %d(bytes)\r\n", ffmpeg_context.pps_len);
+#endif  //  DEBUG_LOG
+    if(ffmpeg_context.codec == ECodec_H265) printf("Codec:H265 ");
+    printf("Framing:%s", (ffmpeg_context.framing == EFraming_AVCC) ? "AVCC" : "Annex-B (passthrough)");
+    if(ffmpeg_context.framing == EFraming_AVCC) printf(" nal_length_size=%d", ffmpeg_context.nal_length_size);
+    printf("\r\n");
+
+    //  H265不解析SPS,使用容器中的宽度、高度,slice类型需要PPS中的扩展位数
+    if(ffmpeg_context.codec == ECodec_H265)
+    {
+        ffmpeg_context.sps_valid = false;
+        H265_ParsePpsExtraBits();
+        ffmpeg_context.Width = ffmpeg_context.p_codec_par->width;
+        ffmpeg_context.Height = ffmpeg_context.p_codec_par->height;
+        printf("width=%d, height=%d\r\n", ffmpeg_context.Width, ffmpeg_context.Height);
+        if(!VerifySource) return 0;
+    }
+    //  从SPS中获取宽度、高度
+    else H264_ParseCurrentSps();
+    if(ffmpeg_context.sps_valid)
+    {
+        ffmpeg_context.Width = ffmpeg_context.sps_info.width;
+        ffmpeg_context.Height = ffmpeg_context.sps_info.height;
+        printf("width=%d, height=%d (SPS)\r\n", ffmpeg_context.Width, ffmpeg_context.Height);
+
+        //  不需要解码源文件时,不打开解码器
+        if(!VerifySource) return 0;
+    }
+
+    //  预演模式不打开解码器,使用容器中的宽度、高度
+    if(DryRunMode)
+    {
+        ffmpeg_context.Width = ffmpeg_context.p_codec_par->width;
+        ffmpeg_context.Height = ffmpeg_context.p_codec_par->height;
+        printf("width=%d, height=%d\r\n", ffmpeg_context.Width, ffmpeg_context.Height);
+        return 0;
+    }
+
+    //  获取解码器
+    //  限制解码器
+    ffmpeg_context.p_codec = avcodec_find_decoder_by_name(Codec_Name(ffmpeg_context.codec));
+    if(ffmpeg_context.p_codec == NULL)
+    {
+        if(ffmpeg_context.p_fmt_ctx != 0)
+        {
+            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
+            ffmpeg_context.p_fmt_ctx = 0;
+        }
+        printf("ERROR:avcodec_find_decoder()\r\n");
+        return -4;
+    }
+
+    //  构造解码器
+    ffmpeg_context.p_codec_ctx = avcodec_alloc_context3(ffmpeg_context.p_codec);
+    if(ffmpeg_context.p_codec_ctx == NULL)
+    {
+        if(ffmpeg_context.p_fmt_ctx != 0)
+        {
+            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
+            ffmpeg_context.p_fmt_ctx = 0;
+        }
+        printf("ERROR:avcodec_alloc_context3()\r\n");
+        return -5;
+    }
+
+    //  解码器参数初始化
+    re = avcodec_parameters_to_context(ffmpeg_context.p_codec_ctx, 
+                                       ffmpeg_context.p_codec_par
+                                      );
+    if(re < 0)
+    {
+        if(ffmpeg_context.p_codec_ctx != 0)
+        {
+            avcodec_free_context(&ffmpeg_context.p_codec_ctx);
+            ffmpeg_context.p_codec_ctx = 0;
+        }
+        if(ffmpeg_context.p_fmt_ctx != 0)
+        {
+            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
+            ffmpeg_context.p_fmt_ctx = 0;
+        }
+        printf("ERROR:avcodec_parameters_to_context()\r\n");
+        return -6;
+    }
+
+    //  校验时需要用该解码器解码源文件,开启帧级多线程
+    if(VerifySource)
+    {
+        ffmpeg_context.p_codec_ctx->thread_count = VerifyThreads;
+        ffmpeg_context.p_codec_ctx->thread_type = FF_THREAD_FRAME;
+    }
+
+    //  打开解码器
+    re = avcodec_open2(ffmpeg_context.p_codec_ctx, ffmpeg_context.p_codec, NULL);
+    if(re < 0)
+    {
+        if(ffmpeg_context.p_codec_ctx != 0)
+        {
+            avcodec_free_context(&ffmpeg_context.p_codec_ctx);
+            ffmpeg_context.p_codec_ctx = 0;
+        }
+        if(ffmpeg_context.p_fmt_ctx != 0)
+        {
+            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
+            ffmpeg_context.p_fmt_ctx = 0;
+        }
+        printf("ERROR:avcodec_open2()\r\n");
+        return -7;
+    }
+
+    //  解码器打开成功
+    ffmpeg_context.avcodec_open_already = true;
+
+    //  提示找到解码器的名字
+    printf("Find Codec Name:%s\r\n", ffmpeg_context.p_codec->name);
+
+    //  当解码器名字不匹配
+    std::string decodec_name = ffmpeg_context.p_codec->name;
+    if(decodec_name != Codec_Name(ffmpeg_context.codec))
+    {
+        //  依次释放资源
+        if(ffmpeg_context.avcodec_open_already)
+        {
+            avcodec_close(ffmpeg_context.p_codec_ctx);
+            ffmpeg_context.avcodec_open_already = false;
+        }
+        if(ffmpeg_context.p_codec_ctx != 0)
+        {
+            avcodec_free_context(&ffmpeg_context.p_codec_ctx);
+            ffmpeg_context.p_codec_ctx = 0;
+        }
+        if(ffmpeg_context.p_fmt_ctx != 0)
+        {
+            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
+            ffmpeg_context.p_fmt_ctx = 0;
+        }
+        return -8;
+    }
+
+    //  没有SPS时(参数集在码流中),使用解码器的宽度、高度
+    if(!ffmpeg_context.sps_valid)
+    {
+        ffmpeg_context.Width = ffmpeg_context.p_codec_ctx->width;
+        ffmpeg_context.Height = ffmpeg_context.p_codec_ctx->height;
+        printf("width=%d, height=%d\r\n", ffmpeg_context.Width, ffmpeg_context.Height);
+    }
+
+    //  操作成功
+    return 0;
+}
+
+//  关闭当前已经打开的视频文件
+void FFMpeg_CloseVideo(void)
+{
+    //  依次释放资源
+    if(ffmpeg_context.vps_dat != 0)
+    {
+        delete [] ffmpeg_context.vps_dat;
+        ffmpeg_context.vps_dat = 0;
+        ffmpeg_context.vps_len = 0;
+    }
+    if(ffmpeg_context.sps_dat != 0)
+    {
+        delete [] ffmpeg_context.sps_dat;
+        ffmpeg_context.sps_dat = 0;
+        ffmpeg_context.sps_len = 0;
+    }
+    if(ffmpeg_context.pps_dat != 0)
+    {
+        delete [] ffmpeg_context.pps_dat;
+        ffmpeg_context.pps_dat = 0;
+        ffmpeg_context.pps_len = 0;
+    }
+    if(ffmpeg_context.p_tc_frame != 0)
+    {
+        av_frame_free(&ffmpeg_context.p_tc_frame);
+        ffmpeg_context.p_tc_frame = 0;
+    }
+    if(ffmpeg_context.p_sws_ctx != 0)
+    {
+        sws_freeContext(ffmpeg_context.p_sws_ctx);
+        ffmpeg_context.p_sws_ctx = 0;
+    }
+    if(ffmpeg_context.p_enc_ctx != 0)
+    {
+        avcodec_free_context(&ffmpeg_context.p_enc_ctx);
+        ffmpeg_context.p_enc_ctx = 0;
+    }
+    ffmpeg_context.transcode = false;
+    ffmpeg_context.framing_checked = false;
+    ffmpeg_context.sps_valid = false;
+    if(ffmpeg_context.avcodec_open_already)
+    {
+        avcodec_close(ffmpeg_context.p_codec_ctx);
+        ffmpeg_context.avcodec_open_already = false;
+    }
+    if(ffmpeg_context.p_codec_ctx != 0)
+    {
+        avcodec_free_context(&ffmpeg_context.p_codec_ctx);
+        ffmpeg_context.p_codec_ctx = 0;
+    }
+    if(ffmpeg_context.p_fmt_ctx != 0)
+    {
+        avformat_close_input(&ffmpeg_context.p_fmt_ctx);
+        ffmpeg_context.p_fmt_ctx = 0;
+    }
+    Avio_Close();
+    Recover_Close();
+    if(ResumePkt != 0) av_packet_free(&ResumePkt);
+}
+
+//  采样表的条目个数
+//  FFmpeg 4.4开始AVStream中的index_entries不再公开,需要使用访问函数
+int FFMpeg_GetIndexCount(AVStream* st)
+{
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+    return avformat_index_get_entries_count(st);
+#else
+    return st->nb_index_entries;
+#endif  //  LIBAVFORMAT_VERSION_INT
+}
+
+//  采样表的一个条目,失败返回0
+const AVIndexEntry* FFMpeg_GetIndexEntry(AVStream* st, int idx)
+{
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+    return avformat_index_get_entry(st, idx);
+#else
+    if((idx < 0) || (idx >= st->nb_index_entries)) return 0;
+    return &st->index_entries[idx];
+#endif  //  LIBAVFORMAT_VERSION_INT
+}
+
+//---------------------------------------------------------------------
+//  H264解码相关函数
+
+//  将Annex-B格式(开始代码分隔)的数据拆分为多个NAL
+//  参数 pdat 为数据首地址
+//  参数 len 为数据有效长度
+//  每个NAL的起始偏移(不含开始代码)和长度依次存入nal_offset和nal_len
+//  返回NAL的个数
+int H264_SplitAnnexB(const unsigned char* pdat, int len,
+                     std::vector<int>& nal_offset, std::vector<int>& nal_len)
+{
+    nal_offset.clear();
+    nal_len.clear();
+
+    //  查找开始代码 00 00 01(4字节的开始代码前面多一个00)
+    int i = 0;
+    int start = -1;
+    while(i + 3 <= len)
+    {
+        if((pdat[i] == 0x00) && (pdat[i + 1] == 0x00) && (pdat[i + 2] == 0x01))
+        {
+            //  结束上一个NAL,去掉结尾的00(属于下一个开始代码或trailing_zero)
+            if(start >= 0)
+            {
+                int end = i;
+                while((end > start) && (pdat[end - 1] == 0x00)) end--;
+                nal_offset.push_back(start);
+                nal_len.push_back(end - start);
+            }
+            i += 3;
+            start = i;
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    //  最后一个NAL
+    if((start >= 0) && (start < len))
+    {
+        nal_offset.push_back(start);
+        nal_len.push_back(len - start);
+    }
+    return nal_offset.size();
+}
+
+//  保存一个参数集(SPS或PPS),已经保存过的忽略
+void H264_SaveParamSet(unsigned char*& pdst, int& dst_len, const unsigned char* pnal, int len)
+{
+    if((pdst != 0) || (len <= 0)) return;
+    pdst = new unsigned char[len];
+    memcpy(pdst, pnal, len);
+    dst_len = len;
+}
+
+//  按参数集的序号保存,0为VPS,1为SPS,2为PPS
+void Codec_SaveParamSet(int index, const unsigned char* pnal, int len)
+{
+    if(index == 0) H264_SaveParamSet(ffmpeg_context.vps_dat, ffmpeg_context.vps_len, pnal, len);
+    if(index == 1) H264_SaveParamSet(ffmpeg_context.sps_dat, ffmpeg_context.sps_len, pnal, len);
+    if(index == 2) H264_SaveParamSet(ffmpeg_context.pps_dat, ffmpeg_context.pps_len, pnal, len);
+}
+
+//  从avcC中获取第一个SPS和PPS以及长度前缀的字节数
+//  avcC结构
+//      [0]     configurationVersion = 1
+//      [1~3]   profile, compatibility, level
+//      [4]     低2位为长度前缀字节数减1
+//      [5]     低5位为SPS个数, 之后每个SPS为 2字节大端长度 + 数据
+//      之后1个字节为PPS个数, 之后每个PPS为 2字节大端长度 + 数据
+//  不是avcC返回1,成功返回0,结构错误返回-1
+int SH264Traits::ParseConfig(const unsigned char* pdat, int len)
+{
+    if((pdat == 0) || (len < 7) || (pdat[0] != 1)) return 1;
+    ffmpeg_context.nal_length_size = (pdat[4] & 0x03) + 1;
+    if(ffmpeg_context.nal_length_size == 3) return -1;
+
+    int pos = 5;
+    int pass = 0;
+    for(pass=0;pass<2;pass++)
+    {
+        if(pos >= len) return -1;
+        int cnt = (pass == 0) ? (pdat[pos] & 0x1F) : pdat[pos];
+        pos++;
+        int i=0;
+        for(i=0;i<cnt;i++)
+        {
+            if(pos + 2 > len) return -1;
+            int nal_len = (pdat[pos] << 8) | pdat[pos + 1];
+            pos += 2;
+            if(pos + nal_len > len) return -1;
+            Codec_SaveParamSet(pass + 1, pdat + pos, nal_len);
+            pos += nal_len;
+        }
+    }
+    return 0;
+}
+
+//  从hvcC中获取第一个VPS、SPS和PPS以及长度前缀的字节数
+//  hvcC结构
+//      [0]     configurationVersion = 1
+//      [1~20]  profile、level、色度格式、位深等
+//      [21]    低2位为长度前缀字节数减1
+//      [22]    数组个数, 之后每个数组为
+//              1字节(低6位为NAL类型) + 2字节大端NAL个数 + 每个NAL为 2字节大端长度 + 数据
+//  不是hvcC返回1,成功返回0,结构错误返回-1
+int SH265Traits::ParseConfig(const unsigned char* pdat, int len)
+{
+    if((pdat == 0) || (len < 23) || (pdat[0] != 1)) return 1;
+    ffmpeg_context.nal_length_size = (pdat[21] & 0x03) + 1;
+    if(ffmpeg_context.nal_length_size == 3) return -1;
+
+    int array_cnt = pdat[22];
+    int pos = 23;
+    int i=0;
+    for(i=0;i<array_cnt;i++)
+    {
+        if(pos + 3 > len) return -1;
+        int type = pdat[pos] & 0x3F;
+        int cnt = (pdat[pos + 1] << 8) | pdat[pos + 2];
+        pos += 3;
+        int k=0;
+        for(k=0;k<cnt;k++)
+        {
+            if(pos + 2 > len) return -1;
+            int nal_len = (pdat[pos] << 8) | pdat[pos + 1];
+            pos += 2;
+            if(pos + nal_len > len) return -1;
+            Codec_SaveParamSet(ParamSetIndex(type), pdat + pos, nal_len);
+            pos += nal_len;
+        }
+    }
+    return 0;
+}
+
+//  从extradata中获取第一组参数集,并根据extradata判断封装格式
+//  extradata为avcC/hvcC时为AVCC格式,
+//  其他情况按Annex-B处理,extradata中可能有用开始代码分隔的参数集,也可能为空(参数集在码流中)
+//  成功返回0,avcC/hvcC结构错误返回-1
+template<class T>
+int Codec_GetParamSetsT(const unsigned char* pdat, int len)
+{
+    //  AVCC格式
+    int re = T::ParseConfig(pdat, len);
+    if(re <= 0)
+    {
+        ffmpeg_context.framing = EFraming_AVCC;
+        return re;
+    }
+
+    //  Annex-B格式
+    ffmpeg_context.framing = EFraming_AnnexB;
+    ffmpeg_context.nal_length_size = 0;
+    if((pdat == 0) || (len <= 0)) return 0;
+    std::vector<int> nal_offset;
+    std::vector<int> nal_len;
+    int nal_cnt = H264_SplitAnnexB(pdat, len, nal_offset, nal_len);
+    int i=0;
+    for(i=0;i<nal_cnt;i++)
+    {
+        const unsigned char* pnal = pdat + nal_offset.at(i);
+        if(nal_len.at(i) < T::nal_head_len) continue;
+        Codec_SaveParamSet(T::ParamSetIndex(T::NalType(pnal)), pnal, nal_len.at(i));
+    }
+    return 0;
+}
+
+//  按当前文件的编码获取参数集
+int Codec_GetParamSets(const unsigned char* pdat, int len)
+{
+    if(ffmpeg_context.codec == ECodec_H265) return Codec_GetParamSetsT<SH265Traits>(pdat, len);
+    return Codec_GetParamSetsT<SH264Traits>(pdat, len);
+}
+
+//  当前文件的编码名字,与FFmpeg中解码器的名字相同
+const char* Codec_Name(ECodec codec)
+{
+    return (codec == ECodec_H265) ? "hevc" : "h264";
+}
+
+//  当前文件的输出扩展名
+std::string Codec_OutputExt(void)
+{
+    return (ffmpeg_context.codec == ECodec_H265) ? ".h265" : ".h264";
+}
+
+//  检查AVCC格式的包是否能按长度前缀正好走到包的结尾
+//  参数 length_size 为长度前缀的字节数
+bool H264_CheckAVCC(const unsigned char* pdat, int len, int length_size)
+{
+    int pos = 0;
+    while(pos + length_size <= len)
+    {
+        unsigned int nal_len = 0;
+        int k=0;
+        for(k=0;k<length_size;k++) nal_len = (nal_len << 8) | pdat[pos + k];
+        pos += length_size;
+        if((nal_len == 0) || (nal_len > (unsigned int)(len - pos))) return false;
+        pos += nal_len;
+    }
+    return pos == len;
+}
+
+//  将4字节长度前缀格式的数据拆分为多个NAL,与H264_SplitAnnexB()相同
+//  返回NAL的个数,长度前缀不能正好走到数据结尾时返回-1
+int H264_SplitAVCC(const unsigned char* pdat, int len,
+                   std::vector<int>& nal_offset, std::vector<int>& nal_len)
+{
+    nal_offset.clear();
+    nal_len.clear();
+    int pos = 0;
+    while(pos + 4 <= len)
+    {
+        unsigned int size = ((unsigned int)pdat[pos] << 24) | (pdat[pos + 1] << 16) | (pdat[pos + 2] << 8) | pdat[pos + 3];
+        pos += 4;
+        if((size == 0) || (size > (unsigned int)(len - pos))) return -1;
+        nal_offset.push_back(pos);
+        nal_len.push_back(size);
+        pos += size;
+    }
+    if(pos != len) return -1;
+    return nal_offset.size();
+}
+
+//  写入4字节大端NAL长度
+void H264_PutNalLength(unsigned char* pdst, unsigned int len)
+{
+    pdst[0] = (len >> 24) & 0xFF;
+    pdst[1] = (len >> 16) & 0xFF;
+    pdst[2] = (len >> 8) & 0xFF;
+    pdst[3] = len & 0xFF;
+}
+
+//  检查包是否以开始代码开头
+bool H264_HasStartCode(const unsigned char* pdat, int len)
+{
+    if((len >= 4) && (pdat[0] == 0) && (pdat[1] == 0) && (pdat[2] == 0) && (pdat[3] == 1)) return true;
+    if((len >= 3) && (pdat[0] == 0) && (pdat[1] == 0) && (pdat[2] == 1)) return true;
+    return false;
+}
+
+//  检查是否包含SEI区头部
+//  参数 pdat 为数据首地址
+//  参数 len 为数据有效长度
+//  包含SEI信息头返回true, 否则返回false
+bool H264_CheckSEI_Inside(unsigned char* pdat, int len)
+{
+    //  检查长度
+    if(len < 6) return false;
+
+    //  检查指针
+    if(pdat == 0) return false;
+
+    //  当为SEI
+    if((pdat[4] == 0x06)  &&    //  为SEI数据头
+       (pdat[5] == 0x05)        //  暂时只支持user_data_unregistered()语法
+      )
+    {
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+//  解析SEI负载的代码类型和长度字节,H264和H265相同
+//  参数 ppay 指向代码类型字节,len为从该字节开始的有效长度
+//  返回 代码类型+长度字节 的总长度,同时获取UUID+用户区长度,失败返回小于0
+int SEI_ParsePayloadHead(const unsigned char* ppay, int len, int& uuid_content_len)
+{
+    //  定义长度
+    int total_len = 0;
+    int byte_cnt = 0;
+    while(1)
+    {
+        //  获取当前长度字节
+        if(1 + byte_cnt >= len) return -1;
+        int tmp_len = ppay[1 + byte_cnt] & 0x0FF;
+
+        //  统计
+        byte_cnt++;
+        total_len += tmp_len;
+
+        //  当到达结尾
+        if(tmp_len != 0x0FF)
+        {
+            break;
+        }
+    }
+
+    //  设置UUID+用户区长度
+    uuid_content_len = total_len;
+    return 1 + byte_cnt;
+}
+
+//  获取SEI头部长度,同时获取UUID+用户区长度
+//  参数 pdat 为数据首地址
+//  参数 len 为数据有效长度
+//  返回的长度值 包含SEI头部
+//  即 NAL头部+代码类型+长度字节 的总长度
+//  失败返回小于0
+int H264_SEI_GetHeadLen(unsigned char* pdat, int len, int& uuid_content_len)
+{
+    //  当头部检查通过
+    if(!H264_CheckSEI_Inside(pdat, len)) return -1;
+
+    //  代码类型和长度字节,在NAL头部之后
+    int re = SEI_ParsePayloadHead(pdat + 4 + 1, len - 4 - 1, uuid_content_len);
+    if(re < 0) return -1;
+
+    //  返回头部总长度
+    return 4 + 1 + re;
+}
+
+//  获取SEI用户定义区长度
+//  参数 pdat 为数据首地址
+//  参数 len 为数据有效长度
+//  返回的长度值 包含SEI的用户数据区(通常为ASCII文本)
+//  即 自定义数据区 的总长度
+//  失败返回小于0
+int H264_SEI_GetContentLen(unsigned char* pdat, int len)
+{
+    //  获取头部长度 和 UUID+用户区总长度
+    int uuid_content_len = 0;
+    int re = H264_SEI_GetHeadLen(pdat, len, uuid_content_len);
+
+    //  检查
+    if((re >= (4 + 1 + 1 + 1)) &&
+       (uuid_content_len > 16)
+      )
+    {
+        return uuid_content_len - 16;
+    }
+    //  错误
+    else
+    {
+        return -1;
+    }
+}
+
+//  获取SEI总长度
+//  参数 pdat 为数据首地址
+//  参数 len 为数据有效长度
+//  返回的长度值 包含整个SEI数据段
+//  即 NAL头部+代码类型+长度字节+UUID+自定义数据区+结尾字节 的总长度
+//  失败返回小于0
+int H264_SEI_GetTotalDataLen_SEI(unsigned char* pdat, int len)
+{
+    //  当头部检查通过
+    if(!H264_CheckSEI_Inside(pdat, len)) return -1;
+
+    //  获取SEI头部的长度 和 UUID+用户区总长度
+    int uuid_content_len = 0;
+    int head_len = H264_SEI_GetHeadLen(pdat, len, uuid_content_len);
+
+    //  检查获取结果
+    if((head_len >= (4 + 1 + 1 + 1)) &&
+       (uuid_content_len > 16)
+      )
+    {
+    }
+    //  错误
+    else
+    {
+        return -1;
+    }
+
+    //  计算总长度
+    return head_len + uuid_content_len + 1;
+}
+
+
+//  从SEI区域中提取UUID(固定16个字节)(SEI payload UUID)
+//  参数 pdat 为数据首地址
+//  参数 len 为数据有效长度
+//  操作成功返回有16个字节长度的容器,失败返回空容器
+std::vector<unsigned char> H264_SEI_GetUUID(unsigned char* pdat, int len)
+{
+    //  定义返回变量
+    std::vector<unsigned char> re_vec;
+
+    //  计算偏移
+    int uuid_content_len = 0;
+    int uuid_offset = H264_SEI_GetHeadLen(pdat, len, uuid_content_len);
+
+    //  检查
+    if(uuid_offset <= 0) return re_vec;
+
+    //  复制信息
+    re_vec.assign(pdat + uuid_offset, pdat + uuid_offset + 16);
+
+    //  返回
+    return re_vec;
+}
+
+//  从SEI区域中提取用户自定义数据(SEI payload content)
+//  参数 pdat 为数据首地址
+//  参数 len 为数据有效长度
+//  操作成功返回非0字节长度的容器,失败返回空容器
+std::vector<unsigned char> H264_SEI_GetContent(unsigned char* pdat, int len)
+{
+    //  定义返回变量
+    std::vector<unsigned char> re_vec;
+
+    //  计算偏移
+    int uuid_content_len = 0;
+    int uuid_offset = H264_SEI_GetHeadLen(pdat, len, uuid_content_len);
+
+    //  检查
+    if(uuid_offset <= 0) return re_vec;
+    if(uuid_content_len <= 16) return re_vec;
+
+    //  计算偏移
+    int content_offset = uuid_offset + 16;
+
+    //  计算长度
+    int content_len = uuid_content_len - 16;
+
+    //  复制信息
+    re_vec.assign(pdat + content_offset, pdat + content_offset + content_len);
+
+    //  返回
+    return re_vec;
+}
+
+//  以ASCII形式dump出vector中的信息,遇到0时结束
+void ASCII_DumpVector(const std::vector<unsigned char>& in_vec)
+{
+    //  检查长度
+    int len = in_vec.size();
+    if(len <= 0)
+    {
+        printf("[Error] [Vector is NULL!!]\r\n");
+        return;
+    }
+
+    //  打印,不需要复制到以0结尾的临时缓冲区
+    printf("%.*s\r\n", len, (const char*)&in_vec[0]);
+}
+
+//  以十六进制dump出UUID值
+//  参数 puuid 为16个字节的UUID
+void HexUUID_Dump(const unsigned char* puuid)
+{
+    //  打印UUID的各个部分 8-4-4-4-12
+    int i=0;
+    for(i=0;i<16;i++)
+    {
+        if((i == 4) || (i == 6) || (i == 8) || (i == 10)) printf("-");
+        printf("%02X", puuid[i]);
+    }
+    printf("\r\n");
+}
+
+//  以十六进制dump出vector中的UUID值
+void HexUUID_DumpVector(const std::vector<unsigned char>& in_vec)
+{
+    //  检查长度
+    if(in_vec.size() != 16)
+    {
+        printf("[Error] UUID len Error!!\r\n");
+        return;
+    }
+    HexUUID_Dump(&in_vec[0]);
+}
+
+//  去除防竞争字节(00 00 03中的03),得到RBSP
+//  参数 max_len 为最多处理的输入字节数
+void H264_Unescape(const unsigned char* pdat, int len, int max_len, std::vector<unsigned char>& rbsp)
+{
+    rbsp.clear();
+    if(len > max_len) len = max_len;
+    int zeros = 0;
+    int i=0;
+    for(i=0;i<len;i++)
+    {
+        if((zeros >= 2) && (pdat[i] == 0x03))
+        {
+            zeros = 0;
+            continue;
+        }
+        zeros = (pdat[i] == 0) ? (zeros + 1) : 0;
+        rbsp.push_back(pdat[i]);
+    }
+}
+
+//  RBSP按位读取
+typedef struct
+{
+    const unsigned char* p;
+    int                  size;             //  字节长度
+    int                  pos;              //  当前的位位置
+}SBitReader;
+
+//  读取n位(n <= 32),超出范围时读到0
+unsigned int Bits_Read(SBitReader& br, int n)
+{
+    unsigned int val = 0;
+    int i=0;
+    for(i=0;i<n;i++)
+    {
+        unsigned int bit = 0;
+        if((br.pos >> 3) < br.size) bit = (br.p[br.pos >> 3] >> (7 - (br.pos & 7))) & 1;
+        val = (val << 1) | bit;
+        br.pos++;
+    }
+    return val;
+}
+
+//  读取无符号指数哥伦布编码
+unsigned int Bits_ReadUe(SBitReader& br)
+{
+    int zeros = 0;
+    while((Bits_Read(br, 1) == 0) && (zeros < 32))
+    {
+        zeros++;
+    }
+    if(zeros >= 32) return 0;
+    return (1U << zeros) - 1 + Bits_Read(br, zeros);
+}
+
+//  读取有符号指数哥伦布编码
+int Bits_ReadSe(SBitReader& br)
+{
+    unsigned int k = Bits_ReadUe(br);
+    return (k & 1) ? (int)((k + 1) / 2) : -(int)(k / 2);
+}
+
+//  解析H264 slice头部中的slice类型
+//  参数 pnal 指向NAL头部
+//  返回 0为I(含SI),1为P(含SP),2为B
+int SH264Traits::SliceType(const unsigned char* pnal, int len)
+{
+    //  first_mb_in_slice和slice_type
+    std::vector<unsigned char> rbsp;
+    H264_Unescape(pnal + 1, len - 1, 16, rbsp);
+    SBitReader br;
+    br.p = rbsp.data();
+    br.size = rbsp.size();
+    br.pos = 0;
+    Bits_ReadUe(br);
+    unsigned int slice_type = Bits_ReadUe(br) % 5;
+    if((slice_type == 2) || (slice_type == 4)) return 0;
+    if((slice_type == 0) || (slice_type == 3)) return 1;
+    return 2;
+}
+
+//  解析H265 slice头部中的slice类型,只解析图像的第一个slice
+//  参数 pnal 指向NAL头部
+//  返回 0为I,1为P,2为B,3为无法识别
+int SH265Traits::SliceType(const unsigned char* pnal, int len)
+{
+    if(len < 3) return 3;
+    std::vector<unsigned char> rbsp;
+    H264_Unescape(pnal + 2, len - 2, 16, rbsp);
+    SBitReader br;
+    br.p = rbsp.data();
+    br.size = rbsp.size();
+    br.pos = 0;
+    if(Bits_Read(br, 1) == 0) return 3;                //  first_slice_segment_in_pic_flag
+    int type = NalType(pnal);
+    if((type >= 16) && (type <= 23)) Bits_Read(br, 1); //  IRAP的no_output_of_prior_pics_flag
+    Bits_ReadUe(br);                                   //  slice_pic_parameter_set_id
+    if(ffmpeg_context.slice_extra_bits > 0) Bits_Read(br, ffmpeg_context.slice_extra_bits);
+    unsigned int slice_type = Bits_ReadUe(br);         //  0为B,1为P,2为I
+    if(slice_type == 2) return 0;
+    if(slice_type == 1) return 1;
+    if(slice_type == 0) return 2;
+    return 3;
+}
+
+//  从H265的PPS中取得num_extra_slice_header_bits,解析slice类型时需要
+void H265_ParsePpsExtraBits(void)
+{
+    ffmpeg_context.slice_extra_bits = 0;
+    if((ffmpeg_context.pps_dat == 0) || (ffmpeg_context.pps_len < 3)) return;
+    std::vector<unsigned char> rbsp;
+    H264_Unescape(ffmpeg_context.pps_dat + 2, ffmpeg_context.pps_len - 2, 16, rbsp);
+    SBitReader br;
+    br.p = rbsp.data();
+    br.size = rbsp.size();
+    br.pos = 0;
+    Bits_ReadUe(br);                                   //  pps_pic_parameter_set_id
+    Bits_ReadUe(br);                                   //  pps_seq_parameter_set_id
+    Bits_Read(br, 1);                                  //  dependent_slice_segments_enabled_flag
+    Bits_Read(br, 1);                                  //  output_flag_present_flag
+    ffmpeg_context.slice_extra_bits = Bits_Read(br, 3);
+}
+
+//  取得帧中第一个slice的类型
+//  参数 framing 为帧的封装格式,EFraming_AVCC时为4字节长度前缀
+//  返回 0为I(含SI),1为P(含SP),2为B,3为无法识别
+template<class T>
+int Codec_GetSliceTypeT(const unsigned char* pdat, int len, EFraming framing)
+{
+    int i=0;
+    for(i=0;i+3<len;)
+    {
+        //  NAL头部的位置
+        int nal_pos = 0;
+        if(framing == EFraming_AVCC)
+        {
+            unsigned int nal_len = ((unsigned int)pdat[i] << 24) | (pdat[i + 1] << 16) | (pdat[i + 2] << 8) | pdat[i + 3];
+            nal_pos = i + 4;
+            if((nal_len == 0) || (nal_len > (unsigned int)(len - nal_pos))) break;
+            i = nal_pos + nal_len;
+        }
+        else
+        {
+            if((pdat[i] != 0) || (pdat[i+1] != 0) || (pdat[i+2] != 1))
+            {
+                i++;
+                continue;
+            }
+            nal_pos = i + 3;
+            i++;
+        }
+
+        //  只处理可以解析类型的slice
+        if(!T::IsSlice(T::NalType(pdat + nal_pos))) continue;
+        return T::SliceType(pdat + nal_pos, len - nal_pos);
+    }
+    return 3;
+}
+
+//  按当前文件的编码取得帧中第一个slice的类型
+int Codec_GetSliceType(const unsigned char* pdat, int len, EFraming framing)
+{
+    if(ffmpeg_context.codec == ECodec_H265) return Codec_GetSliceTypeT<SH265Traits>(pdat, len, framing);
+    return Codec_GetSliceTypeT<SH264Traits>(pdat, len, framing);
+}
+
+//  取得帧开头的AUD的长度(含开始代码或长度前缀)
+//  参数 length_size 为长度前缀的字节数,0为Annex-B
+//  第一个NAL不是AUD时返回0
+template<class T>
+int Codec_GetLeadingAudT(const unsigned char* pdat, int len, int length_size)
+{
+    int nal_pos = 0;
+    int nal_end = 0;
+    if(length_size > 0)
+    {
+        if(len <= length_size) return 0;
+        unsigned int nal_len = 0;
+        int i=0;
+        for(i=0;i<length_size;i++) nal_len = (nal_len << 8) | pdat[i];
+        nal_pos = length_size;
+        if((nal_len < (unsigned int)T::nal_head_len) || (nal_len > (unsigned int)(len - nal_pos))) return 0;
+        nal_end = nal_pos + nal_len;
+    }
+    else
+    {
+        //  开始代码为2个以上的0和1
+        while((nal_pos < len) && (pdat[nal_pos] == 0)) nal_pos++;
+        if((nal_pos < 2) || (nal_pos + T::nal_head_len >= len) || (pdat[nal_pos] != 1)) return 0;
+        nal_pos++;
+
+        //  到下一个开始代码为止,开始代码之前的0属于下一个开始代码
+        for(nal_end=nal_pos+T::nal_head_len;nal_end+2<len;nal_end++)
+        {
+            if((pdat[nal_end] == 0) && (pdat[nal_end + 1] == 0) && (pdat[nal_end + 2] <= 1)) break;
+        }
+        if(nal_end + 2 >= len) nal_end = len;
+    }
+    if(!T::IsAud(T::NalType(pdat + nal_pos))) return 0;
+    return nal_end;
+}
+
+//  按当前文件的编码取得帧开头的AUD的长度
+int Codec_GetLeadingAud(const unsigned char* pdat, int len, int length_size)
+{
+    if(ffmpeg_context.codec == ECodec_H265) return Codec_GetLeadingAudT<SH265Traits>(pdat, len, length_size);
+    return Codec_GetLeadingAudT<SH264Traits>(pdat, len, length_size);
+}
+
+//  跳过SPS中的scaling_list
+void H264_SkipScalingList(SBitReader& br, int size)
+{
+    int last_scale = 8;
+    int next_scale = 8;
+    int j=0;
+    for(j=0;j<size;j++)
+    {
+        if(next_scale != 0)
+        {
+            int delta_scale = Bits_ReadSe(br);
+            next_scale = (last_scale + delta_scale + 256) % 256;
+        }
+        last_scale = (next_scale == 0) ? last_scale : next_scale;
+    }
+}
+
+//  解析VUI中的hrd_parameters,只保留第一个CPB
+void H264_ParseHrd(SBitReader& br, SSpsInfo& info)
+{
+    unsigned int cpb_cnt = Bits_ReadUe(br) + 1;
+    unsigned int bit_rate_scale = Bits_Read(br, 4);
+    unsigned int cpb_size_scale = Bits_Read(br, 4);
+    unsigned int i=0;
+    for(i=0;(i<cpb_cnt)&&(i<32);i++)
+    {
+        unsigned long long bit_rate = (unsigned long long)Bits_ReadUe(br) + 1;
+        unsigned long long cpb_size = (unsigned long long)Bits_ReadUe(br) + 1;
+        Bits_Read(br, 1);                  //  cbr_flag
+        if(i == 0)
+        {
+            info.hrd_bitrate = bit_rate << (6 + bit_rate_scale);
+            info.cpb_size = cpb_size << (4 + cpb_size_scale);
+        }
+    }
+    Bits_Read(br, 20);                     //  4个5位的延迟长度字段
+    info.hrd_present = true;
+}
+
+//  按level推算DPB需要的帧数(H.264 表A-1 MaxDpbMbs)
+int H264_GetLevelDpbFrames(int level_idc, int constraint_flags, int width_mbs, int height_mbs)
+{
+    int max_dpb_mbs = 0;
+    switch(level_idc)
+    {
+        case 9:  max_dpb_mbs = 396;    break;
+        case 10: max_dpb_mbs = 396;    break;
+        case 11: max_dpb_mbs = (constraint_flags & 0x10) ? 396 : 900; break;
+        case 12: max_dpb_mbs = 2376;   break;
+        case 13: max_dpb_mbs = 2376;   break;
+        case 20: max_dpb_mbs = 2376;   break;
+        case 21: max_dpb_mbs = 4752;   break;
+        case 22: max_dpb_mbs = 8100;   break;
+        case 30: max_dpb_mbs = 8100;   break;
+        case 31: max_dpb_mbs = 18000;  break;
+        case 32: max_dpb_mbs = 20480;  break;
+        case 40: max_dpb_mbs = 32768;  break;
+        case 41: max_dpb_mbs = 32768;  break;
+        case 42: max_dpb_mbs = 34816;  break;
+        case 50: max_dpb_mbs = 110400; break;
+        case 51: max_dpb_mbs = 184320; break;
+        case 52: max_dpb_mbs = 184320; break;
+        case 60: max_dpb_mbs = 696320; break;
+        case 61: max_dpb_mbs = 696320; break;
+        case 62: max_dpb_mbs = 696320; break;
+        default: return 16;
+    }
+    int frames = max_dpb_mbs / (width_mbs * height_mbs);
+    if(frames > 16) frames = 16;
+    return frames;
+}
+
+//  解析SPS(含VUI)
+//  参数 pdat 为SPS的NAL数据(含1字节NAL头部)
+//  成功返回0,失败返回-1
+int H264_ParseSps(const unsigned char* pdat, int len, SSpsInfo& info)
+{
+    memset(&info, 0, sizeof(info));
+    if((pdat == 0) || (len < 4) || ((pdat[0] & 0x1F) != 7)) return -1;
+
+    std::vector<unsigned char> rbsp;
+    H264_Unescape(pdat + 1, len - 1, len - 1, rbsp);
+    SBitReader br;
+    br.p = rbsp.data();
+    br.size = rbsp.size();
+    br.pos = 0;
+
+    info.profile_idc = Bits_Read(br, 8);
+    info.constraint_flags = Bits_Read(br, 8);
+    info.level_idc = Bits_Read(br, 8);
+    Bits_ReadUe(br);                       //  seq_parameter_set_id
+
+    //  高profile的色度和位深
+    info.chroma_format_idc = 1;
+    info.bit_depth_luma = 8;
+    info.bit_depth_chroma = 8;
+    int separate_colour_plane = 0;
+    int p = info.profile_idc;
+    if((p == 100) || (p == 110) || (p == 122) || (p == 244) || (p == 44) ||
+       (p == 83) || (p == 86) || (p == 118) || (p == 128) || (p == 138) ||
+       (p == 139) || (p == 134) || (p == 135))
+    {
+        info.chroma_format_idc = Bits_ReadUe(br);
+        if(info.chroma_format_idc > 3) return -1;
+        if(info.chroma_format_idc == 3) separate_colour_plane = Bits_Read(br, 1);
+        info.bit_depth_luma = Bits_ReadUe(br) + 8;
+        info.bit_depth_chroma = Bits_ReadUe(br) + 8;
+        Bits_Read(br, 1);                  //  qpprime_y_zero_transform_bypass_flag
+        if(Bits_Read(br, 1))               //  seq_scaling_matrix_present_flag
+        {
+            int cnt = (info.chroma_format_idc != 3) ? 8 : 12;
+            int i=0;
+            for(i=0;i<cnt;i++)
+            {
+                if(Bits_Read(br, 1)) H264_SkipScalingList(br, (i < 6) ? 16 : 64);
+            }
+        }
+    }
+
+    Bits_ReadUe(br);                       //  log2_max_frame_num_minus4
+    unsigned int poc_type = Bits_ReadUe(br);
+    if(poc_type == 0)
+    {
+        Bits_ReadUe(br);                   //  log2_max_pic_order_cnt_lsb_minus4
+    }
+    else if(poc_type == 1)
+    {
+        Bits_Read(br, 1);                  //  delta_pic_order_always_zero_flag
+        Bits_ReadSe(br);                   //  offset_for_non_ref_pic
+        Bits_ReadSe(br);                   //  offset_for_top_to_bottom_field
+        unsigned int cycle = Bits_ReadUe(br);
+        if(cycle > 255) return -1;
+        unsigned int i=0;
+        for(i=0;i<cycle;i++) Bits_ReadSe(br);
+    }
+
+    info.num_ref_frames = Bits_ReadUe(br);
+    Bits_Read(br, 1);                      //  gaps_in_frame_num_value_allowed_flag
+    int width_mbs = Bits_ReadUe(br) + 1;
+    int height_map_units = Bits_ReadUe(br) + 1;
+    info.frame_mbs_only = Bits_Read(br, 1);
+    if(!info.frame_mbs_only) Bits_Read(br, 1);     //  mb_adaptive_frame_field_flag
+    Bits_Read(br, 1);                      //  direct_8x8_inference_flag
+    int height_mbs = (2 - info.frame_mbs_only) * height_map_units;
+    info.coded_width = width_mbs * 16;
+    info.coded_height = height_mbs * 16;
+
+    //  裁剪,单位与色度格式和场编码有关
+    if(Bits_Read(br, 1))
+    {
+        int crop_unit_x = 1;
+        int crop_unit_y = 2 - info.frame_mbs_only;
+        if((info.chroma_format_idc != 0) && !separate_colour_plane)
+        {
+            crop_unit_x = (info.chroma_format_idc == 3) ? 1 : 2;
+            crop_unit_y *= (info.chroma_format_idc == 1) ? 2 : 1;
+        }
+        info.crop_left = Bits_ReadUe(br) * crop_unit_x;
+        info.crop_right = Bits_ReadUe(br) * crop_unit_x;
+        info.crop_top = Bits_ReadUe(br) * crop_unit_y;
+        info.crop_bottom = Bits_ReadUe(br) * crop_unit_y;
+    }
+    info.width = info.coded_width - info.crop_left - info.crop_right;
+    info.height = info.coded_height - info.crop_top - info.crop_bottom;
+    if((width_mbs > 1024) || (height_mbs > 1024) || (info.width <= 0) || (info.height <= 0)) return -1;
+
+    //  VUI
+    info.dpb_frames = -1;
+    info.max_num_reorder = -1;
+    if(Bits_Read(br, 1))
+    {
+        if(Bits_Read(br, 1))               //  aspect_ratio_info_present_flag
+        {
+            if(Bits_Read(br, 8) == 255) Bits_Read(br, 32);     //  Extended_SAR
+        }
+        if(Bits_Read(br, 1)) Bits_Read(br, 1);                 //  overscan
+        if(Bits_Read(br, 1))               //  video_signal_type_present_flag
+        {
+            Bits_Read(br, 4);              //  video_format, video_full_range_flag
+            if(Bits_Read(br, 1)) Bits_Read(br, 24);            //  colour_description
+        }
+        if(Bits_Read(br, 1))               //  chroma_loc_info_present_flag
+        {
+            Bits_ReadUe(br);
+            Bits_ReadUe(br);
+        }
+        info.timing_present = (Bits_Read(br, 1) != 0);
+        if(info.timing_present)
+        {
+            info.num_units_in_tick = Bits_Read(br, 32);
+            info.time_scale = Bits_Read(br, 32);
+            info.fixed_frame_rate = Bits_Read(br, 1);
+        }
+        int nal_hrd = Bits_Read(br, 1);
+        if(nal_hrd) H264_ParseHrd(br, info);
+        int vcl_hrd = Bits_Read(br, 1);
+        if(vcl_hrd)
+        {
+            //  只在没有NAL HRD时使用VCL HRD
+            SSpsInfo vcl;
+            memset(&vcl, 0, sizeof(vcl));
+            H264_ParseHrd(br, nal_hrd ? vcl : info);
+        }
+        if(nal_hrd || vcl_hrd) Bits_Read(br, 1);               //  low_delay_hrd_flag
+        Bits_Read(br, 1);                  //  pic_struct_present_flag
+        if(Bits_Read(br, 1))               //  bitstream_restriction_flag
+        {
+            Bits_Read(br, 1);              //  motion_vectors_over_pic_boundaries_flag
+            Bits_ReadUe(br);               //  max_bytes_per_pic_denom
+            Bits_ReadUe(br);               //  max_bits_per_mb_denom
+            Bits_ReadUe(br);               //  log2_max_mv_length_horizontal
+            Bits_ReadUe(br);               //  log2_max_mv_length_vertical
+            info.max_num_reorder = Bits_ReadUe(br);
+            info.dpb_frames = Bits_ReadUe(br);
+        }
+    }
+    if(br.pos > br.size * 8) return -1;
+
+    //  VUI中没有时按level推算
+    if(info.dpb_frames < 0)
+    {
+        info.dpb_frames = H264_GetLevelDpbFrames(info.level_idc, info.constraint_flags, width_mbs, height_mbs);
+    }
+    if(info.dpb_frames < info.num_ref_frames) info.dpb_frames = info.num_ref_frames;
+    return 0;
+}
+
+//  解析当前文件的SPS,结果保存到ffmpeg_context中
+void H264_ParseCurrentSps(void)
+{
+    ffmpeg_context.sps_valid =
+        (H264_ParseSps(ffmpeg_context.sps_dat, ffmpeg_context.sps_len, ffmpeg_context.sps_info) == 0);
+    if(!ffmpeg_context.sps_valid) return;
+
+    const SSpsInfo& info = ffmpeg_context.sps_info;
+    printf("SPS: profile=%d level=%d coded=%dx%d crop=%dx%d ref=%d dpb=%d\r\n",
+           info.profile_idc, info.level_idc, info.coded_width, info.coded_height,
+           info.width, info.height, info.num_ref_frames, info.dpb_frames);
+}
+
+//  将SPS解析结果写入信息文件的扩展头部
+void H264_WriteSpsInfo(FILE* pfile)
+{
+    if(!ffmpeg_context.sps_valid) return;
+    const SSpsInfo& info = ffmpeg_context.sps_info;
+    fprintf(pfile, "#PROFILE %d %02x %d\r\n", info.profile_idc, info.constraint_flags, info.level_idc);
+    fprintf(pfile, "#CHROMA %d %d %d\r\n", info.chroma_format_idc, info.bit_depth_luma, info.bit_depth_chroma);
+    fprintf(pfile, "#CODED_SIZE %d %d\r\n", info.coded_width, info.coded_height);
+    fprintf(pfile, "#CROP %d %d %d %d\r\n", info.crop_left, info.crop_right, info.crop_top, info.crop_bottom);
+    fprintf(pfile, "#SIZE %d %d\r\n", info.width, info.height);
+    fprintf(pfile, "#REF_FRAMES %d\r\n", info.num_ref_frames);
+    fprintf(pfile, "#DPB_FRAMES %d\r\n", info.dpb_frames);
+    fprintf(pfile, "#REORDER %d\r\n", info.max_num_reorder);
+    if(info.timing_present)
+    {
+        fprintf(pfile, "#TIMING %u %u %d\r\n", info.num_units_in_tick, info.time_scale, info.fixed_frame_rate);
+    }
+    if(info.hrd_present)
+    {
+        fprintf(pfile, "#CPB %llu %llu\r\n", info.cpb_size, info.hrd_bitrate);
+    }
+}
+
+//---------------------------------------------------------------------
+//  转换流程相关函数
+//  单个文件的转换分为三级: 读取视频包 -> 替换开始代码 -> 写入文件
+//  串行模式下三级在同一个线程中依次执行,流水线模式下三级分别运行在独立线程中
+
+//  根据输入文件和扩展名生成输出文件名
+std::string Conv_GetOutputName(std::string input_file, std::string ext)
+{
+    //  提取输入视频文件的路径
+    std::string input_video_path = GetOnlyFilePath(input_file);
+
+    //  提取纯文件名部分(不含扩展名)
+    std::string input_video_only_name = GetOnlyFileNameNoEx(input_file);
+
+    //  当输出目录为空目录
+    if(OutputPath == "")
+    {
+        //  使用输入源文件路径
+        if(input_video_path == "") return input_video_only_name + ext;
+        else                       return input_video_path + "/" + input_video_only_name + ext;
+    }
+    //  输出目录不为空,使用设定路径
+    else
+    {
+        return OutputPath + "/" + input_video_only_name + ext;
+    }
+}
+
+//---------------------------------------------------------------------
+//  缓冲区池相关函数
+//  重新生成包数据和复制不可写的包时从按2的幂分级的AVBufferPool中取得缓冲区,
+//  包释放后缓冲区回到池中,流水线中的包结构体由写入级还给读取级重复使用,
+//  设置了内存预算时,在途字节数超过预算后读取级等待下游写出,内存占用有上限
+
+//  池中实际分配内存,用于统计分配次数
+AVBufferRef* Pool_Alloc(PoolAllocSize size)
+{
+    BufPool.allocs++;
+    return av_buffer_alloc(size);
+}
+
+//  创建各级缓冲区池,只创建池本身,缓冲区在第一次使用时分配
+void Pool_Init(void)
+{
+    int k=0;
+    for(k=0;k<POOL_CLASS_CNT;k++)
+    {
+        BufPool.p_pool[k] = av_buffer_pool_init(1 << (POOL_MIN_SHIFT + k), Pool_Alloc);
+    }
+}
+
+//  释放各级缓冲区池,还在使用的缓冲区在最后一个引用释放时释放
+void Pool_Uninit(void)
+{
+    int k=0;
+    for(k=0;k<POOL_CLASS_CNT;k++)
+    {
+        if(BufPool.p_pool[k] != 0) av_buffer_pool_uninit(&BufPool.p_pool[k]);
+    }
+}
+
+//  清零当前文件的统计
+void Pool_ResetStat(void)
+{
+    BufPool.gets = 0UL;
+    BufPool.allocs = 0UL;
+    BufPool.large = 0UL;
+    BufPool.copies = 0UL;
+    BufPool.pkt_allocs = 0UL;
+    BufPool.pkt_reuse = 0UL;
+    BufPool.inflight = 0LL;
+    BufPool.inflight_peak = 0LL;
+    BufPool.budget_waits = 0UL;
+    BufPool.budget_wait_ms = 0.0;
+}
+
+//  取得至少size字节的缓冲区,超过最大一级或者池没有创建时直接分配
+//  返回的缓冲区可写,失败返回0
+AVBufferRef* Pool_GetBuffer(int size)
+{
+    int k=0;
+    for(k=0;k<POOL_CLASS_CNT;k++)
+    {
+        if((1 << (POOL_MIN_SHIFT + k)) >= size) break;
+    }
+    if((k < POOL_CLASS_CNT) && (BufPool.p_pool[k] != 0))
+    {
+        BufPool.gets++;
+        return av_buffer_pool_get(BufPool.p_pool[k]);
+    }
+    BufPool.large++;
+    return av_buffer_alloc(size);
+}
+
+//  确保包的数据可写,被其他引用共享或者没有引用计数时复制到池中的缓冲区
+//  成功返回0
+int Pool_MakeWritable(AVPacket* pkt)
+{
+    if((pkt->buf != 0) && av_buffer_is_writable(pkt->buf)) return 0;
+    AVBufferRef* pbuf = Pool_GetBuffer(pkt->size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if(pbuf == 0) return -1;
+    if(pkt->size > 0) memcpy(pbuf->data, pkt->data, pkt->size);
+    memset(pbuf->data + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    av_buffer_unref(&pkt->buf);
+    pkt->buf = pbuf;
+    pkt->data = pbuf->data;
+    BufPool.copies++;
+    return 0;
+}
+
+//  在途字节数增加n(可以为负),并记录最大值
+void Pool_AddInflight(long long n)
+{
+    long long now = BufPool.inflight.fetch_add(n) + n;
+    long long peak = BufPool.inflight_peak.load();
+    while((now > peak) && !BufPool.inflight_peak.compare_exchange_weak(peak, now));
+}
+
+//  读取级在读取下一个包之前调用,在途字节数超过预算时等待下游写出
+//  在途为0时总是返回,单个包超过预算时不会死锁
+void Pool_WaitBudget(std::atomic<bool>& abort_flag)
+{
+    if(MemBudgetMB <= 0) return;
+    long long limit = (long long)MemBudgetMB * 1024LL * 1024LL;
+    if(BufPool.inflight.load() <= limit) return;
+
+    double t0 = Pipe_NowMs();
+    BufPool.budget_waits++;
+    int spin = 0;
+    while((BufPool.inflight.load() > limit) && !abort_flag.load(std::memory_order_relaxed))
+    {
+        if(spin < 64) spin++;
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    BufPool.budget_wait_ms += Pipe_NowMs() - t0;
+}
+
+//  打印当前文件的分配统计和进程的峰值内存
+void Pool_PrintStat(void)
+{
+    struct rusage ru;
+    memset(&ru, 0, sizeof(ru));
+    getrusage(RUSAGE_SELF, &ru);
+    printf("[Mem] buffers get=%lu alloc=%lu large=%lu copy=%lu packets alloc=%lu reuse=%lu\r\n",
+           BufPool.gets.load(), BufPool.allocs.load(), BufPool.large.load(), BufPool.copies.load(),
+           BufPool.pkt_allocs.load(), BufPool.pkt_reuse.load());
+    printf("[Mem] inflight_peak=%.1fMB", BufPool.inflight_peak.load() / (1024.0 * 1024.0));
+    if(MemBudgetMB > 0)
+    {
+        printf(" budget=%dMB budget_waits=%lu budget_wait=%.1fms",
+               MemBudgetMB, BufPool.budget_waits, BufPool.budget_wait_ms);
+    }
+    printf(" peak_rss=%.1fMB\r\n", ru.ru_maxrss / 1024.0);
+}
+
+//---------------------------------------------------------------------
+//  损坏文件恢复相关函数
+//  录制中断(如掉电)的MP4没有moov,无法用FFmpeg打开,但mdat中的视频采样仍然完整,
+//  每个采样为若干个 长度前缀 + NAL,参数集取自参考文件,
+//  顺序扫描mdat,按长度前缀和NAL头部找出视频数据,再按NAL类型拆分为访问单元(帧)
+//  音频等其他数据使NAL链断开,断开后用SIMD查找下一个可能的NAL头部重新同步
+
+//  H264的NAL头部是否合理,forbidden_zero_bit为0,nal_ref_idc与类型一致
+bool SH264Traits::IsValidHead(const unsigned char* pnal)
+{
+    if((pnal[0] & 0x80) != 0) return false;
+    int type = pnal[0] & 0x1F;
+    int ref_idc = (pnal[0] >> 5) & 0x03;
+    if(type == 1) return true;
+    if((type == 5) || (type == 7) || (type == 8)) return ref_idc != 0;
+    if((type == 6) || (type == 9) || (type == 12)) return ref_idc == 0;
+    return false;
+}
+
+//  H265的NAL头部是否合理,forbidden_zero_bit为0,nuh_layer_id为0,nuh_temporal_id_plus1不为0
+bool SH265Traits::IsValidHead(const unsigned char* pnal)
+{
+    if(((pnal[0] & 0x81) != 0) || ((pnal[1] & 0xF8) != 0) || ((pnal[1] & 0x07) == 0)) return false;
+    int type = NalType(pnal);
+    return (type <= 9) || ((type >= 16) && (type <= 21)) || ((type >= 32) && (type <= 35)) || (type == 39) || (type == 40);
+}
+
+#if defined(__SSE2__)
+//  16个位置同时检查NAL头部的类型,h0为每个位置的NAL头部第一个字节,h1为第二个字节
+//  合理的位置对应字节为0xFF,只做粗筛,通过后再用IsValidHead()确认
+__m128i SH264Traits::HeadMask(__m128i h0, __m128i h1)
+{
+    (void)h1;
+    __m128i zero = _mm_setzero_si128();
+    __m128i type = _mm_and_si128(h0, _mm_set1_epi8(0x1F));
+    __m128i ok = _mm_or_si128(_mm_cmpeq_epi8(type, _mm_set1_epi8(1)), _mm_cmpeq_epi8(type, _mm_set1_epi8(12)));
+    ok = _mm_or_si128(ok, _mm_and_si128(_mm_cmpgt_epi8(type, _mm_set1_epi8(4)), _mm_cmplt_epi8(type, _mm_set1_epi8(10))));
+    return _mm_and_si128(ok, _mm_cmpeq_epi8(_mm_and_si128(h0, _mm_set1_epi8((char)0x80)), zero));
+}
+
+__m128i SH265Traits::HeadMask(__m128i h0, __m128i h1)
+{
+    __m128i zero = _mm_setzero_si128();
+    //  按16位右移后屏蔽高2位,相邻字节移入的位被清除
+    __m128i type = _mm_and_si128(_mm_srli_epi16(h0, 1), _mm_set1_epi8(0x3F));
+    __m128i ok = _mm_cmplt_epi8(type, _mm_set1_epi8(10));
+    ok = _mm_or_si128(ok, _mm_and_si128(_mm_cmpgt_epi8(type, _mm_set1_epi8(15)), _mm_cmplt_epi8(type, _mm_set1_epi8(22))));
+    ok = _mm_or_si128(ok, _mm_and_si128(_mm_cmpgt_epi8(type, _mm_set1_epi8(31)), _mm_cmplt_epi8(type, _mm_set1_epi8(36))));
+    ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(type, _mm_set1_epi8(39)), _mm_cmpeq_epi8(type, _mm_set1_epi8(40))));
+    ok = _mm_and_si128(ok, _mm_cmpeq_epi8(_mm_and_si128(h0, _mm_set1_epi8((char)0x81)), zero));
+    ok = _mm_and_si128(ok, _mm_cmpeq_epi8(_mm_and_si128(h1, _mm_set1_epi8((char)0xF8)), zero));
+    return _mm_andnot_si128(_mm_cmpeq_epi8(_mm_and_si128(h1, _mm_set1_epi8(0x07)), zero), ok);
+}
+#endif  //  __SSE2__
+
+//  读取大端长度前缀
+unsigned int Recover_GetLength(const unsigned char* p, int length_size)
+{
+    unsigned int len = 0;
+    int i=0;
+    for(i=0;i<length_size;i++) len = (len << 8) | p[i];
+    return len;
+}
+
+//  从p开始查找下一个NAL头部合理的位置(长度前缀的位置),4字节长度前缀时要求最高字节为0(NAL小于16MB)
+//  没有时返回end
+template<class T>
+unsigned long long Recover_FindHead(unsigned long long p, unsigned long long end)
+{
+    const unsigned char* pdat = RecoverCtx.p_map;
+    int ls = RecoverCtx.length_size;
+#if defined(__SSE2__)
+    //  每次检查16个位置,需要读取到p+ls+16
+    __m128i zero = _mm_setzero_si128();
+    while(p + ls + 17 <= end)
+    {
+        __m128i h0 = _mm_loadu_si128((const __m128i*)(pdat + p + ls));
+        __m128i h1 = _mm_loadu_si128((const __m128i*)(pdat + p + ls + 1));
+        __m128i mask = T::HeadMask(h0, h1);
+        if(ls == 4) mask = _mm_and_si128(mask, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(pdat + p)), zero));
+        unsigned int bits = _mm_movemask_epi8(mask);
+        while(bits != 0)
+        {
+            int k = __builtin_ctz(bits);
+            if(T::IsValidHead(pdat + p + k + ls)) return p + k;
+            bits &= bits - 1;
+        }
+        p += 16;
+    }
+#endif  //  __SSE2__
+    for(;p + ls + T::nal_head_len <= end;p++)
+    {
+        if((ls == 4) && (pdat[p] != 0)) continue;
+        if(T::IsValidHead(pdat + p + ls)) return p;
+    }
+    return end;
+}
+
+//  从p开始沿长度前缀走,最多走max_cnt个NAL,返回长度和头部都正确的NAL个数,q为走到的位置
+template<class T>
+int Recover_WalkChain(unsigned long long p, unsigned long long end, int max_cnt, unsigned long long& q)
+{
+    const unsigned char* pdat = RecoverCtx.p_map;
+    int ls = RecoverCtx.length_size;
+    int cnt = 0;
+    while((cnt < max_cnt) && (p + ls + T::nal_head_len <= end))
+    {
+        unsigned int len = Recover_GetLength(pdat + p, ls);
+        if((len < (unsigned int)T::nal_head_len) || (len > end - p - ls)) break;
+        if(!T::IsValidHead(pdat + p + ls)) break;
+        p += ls + len;
+        cnt++;
+    }
+    q = p;
+    return cnt;
+}
+
+//  p处是否为确认的NAL链的开始: 连续RECOVER_MIN_CHAIN个NAL正确,或者正好走到mdat结尾
+template<class T>
+bool Recover_IsChain(unsigned long long p, unsigned long long end, unsigned long long& q)
+{
+    int cnt = Recover_WalkChain<T>(p, end, RECOVER_MIN_CHAIN, q);
+    return (cnt >= RECOVER_MIN_CHAIN) || ((cnt > 0) && (q == end));
+}
+
+//  取得下一个NAL,nal_pos为长度前缀的位置
+//  成功返回0,全部mdat扫描完成返回-1
+template<class T>
+int Recover_NextNal(unsigned long long& nal_pos, unsigned int& nal_len)
+{
+    SRecoverContext& ctx = RecoverCtx;
+    const unsigned char* pdat = ctx.p_map;
+    int ls = ctx.length_size;
+    while(ctx.range_idx < ctx.ranges.size())
+    {
+        unsigned long long end = ctx.ranges.at(ctx.range_idx).second;
+
+        //  确认的链中,直接取出
+        if(ctx.pos < ctx.chain_end)
+        {
+            nal_pos = ctx.pos;
+            nal_len = Recover_GetLength(pdat + ctx.pos, ls);
+            ctx.pos += ls + nal_len;
+            ctx.contiguous = true;
+            return 0;
+        }
+
+        //  空隙中,只接受能完整放入空隙的单个NAL:
+        //  紧接在链之后的(采样的最后一个NAL),或者图像的第一个slice(只有一个NAL的采样)
+        if(ctx.pos < ctx.gap_end)
+        {
+            unsigned long long p = ctx.pos;
+            while(p < ctx.gap_end)
+            {
+                p = Recover_FindHead<T>(p, ctx.gap_end);
+                if(p >= ctx.gap_end) break;
+                unsigned int len = Recover_GetLength(pdat + p, ls);
+                const unsigned char* pnal = pdat + p + ls;
+                if((len >= (unsigned int)T::nal_head_len) && (len <= ctx.gap_end - p - ls) &&
+                   ((ctx.contiguous && (p == ctx.pos)) || T::IsFirstSlice(pnal, len)))
+                {
+                    ctx.skip_bytes += p - ctx.pos;
+                    nal_pos = p;
+                    nal_len = len;
+                    ctx.pos = p + ls + len;
+                    ctx.contiguous = false;
+                    return 0;
+                }
+                p++;
+            }
+            ctx.skip_bytes += ctx.gap_end - ctx.pos;
+            ctx.pos = ctx.gap_end;
+            ctx.contiguous = false;
+            continue;
+        }
+
+        //  当前mdat结束
+        if(ctx.pos + ls + T::nal_head_len > end)
+        {
+            if(ctx.pos < end) ctx.skip_bytes += end - ctx.pos;
+            ctx.range_idx++;
+            if(ctx.range_idx < ctx.ranges.size()) ctx.pos = ctx.ranges.at(ctx.range_idx).first;
+            ctx.chain_end = ctx.pos;
+            ctx.gap_end = ctx.pos;
+            ctx.contiguous = false;
+            continue;
+        }
+
+        //  从当前位置确认下一段链
+        unsigned long long q = 0ULL;
+        if(Recover_IsChain<T>(ctx.pos, end, q))
+        {
+            ctx.chain_end = q;
+            continue;
+        }
+
+        //  链断开,查找下一个确认的链的开始作为空隙的结束
+        ctx.resync_cnt++;
+        unsigned long long p = ctx.pos + 1;
+        while(p < end)
+        {
+            p = Recover_FindHead<T>(p, end);
+            if((p >= end) || Recover_IsChain<T>(p, end, q)) break;
+            p++;
+        }
+        ctx.gap_end = (p < end) ? p : end;
+    }
+    return -1;
+}
+
+//  输出组装好的访问单元
+//  第一个关键帧之前的帧不能解码,丢弃
+//  输出返回0,丢弃返回1
+int Recover_EmitAu(AVPacket* pkt)
+{
+    SRecoverContext& ctx = RecoverCtx;
+    bool emit = ctx.started || ctx.au_key;
+    if(!emit) ctx.lead_drop++;
+
+    //  连续的NAL合并为一段,一次复制到缓冲区池
+    int size = 0;
+    size_t i = 0;
+    for(i=0;i<ctx.au_parts.size();i++) size += (int)(ctx.au_parts.at(i).second - ctx.au_parts.at(i).first);
+    AVBufferRef* pbuf = emit ? Pool_GetBuffer(size + AV_INPUT_BUFFER_PADDING_SIZE) : 0;
+    if(pbuf != 0)
+    {
+        int dst = 0;
+        for(i=0;i<ctx.au_parts.size();i++)
+        {
+            int part = (int)(ctx.au_parts.at(i).second - ctx.au_parts.at(i).first);
+            memcpy(pbuf->data + dst, ctx.p_map + ctx.au_parts.at(i).first, part);
+            dst += part;
+        }
+        memset(pbuf->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        pkt->buf = pbuf;
+        pkt->data = pbuf->data;
+        pkt->size = size;
+        pkt->stream_index = 0;
+        pkt->flags = ctx.au_key ? AV_PKT_FLAG_KEY : 0;
+        pkt->pts = AV_NOPTS_VALUE;          //  没有时间戳,推流时按帧率
+        pkt->dts = AV_NOPTS_VALUE;
+        pkt->pos = ctx.au_parts.at(0).first;
+        ctx.started = true;
+        ctx.frame_cnt++;
+        if(ctx.au_key) ctx.key_cnt++;
+    }
+    ctx.au_parts.clear();
+    ctx.au_vcl = false;
+    ctx.au_key = false;
+    if(emit && (pbuf == 0))
+    {
+        printf("[Error] Pool_GetBuffer()\r\n");
+        return 1;
+    }
+    return emit ? 0 : 1;
+}
+
+//  读取一帧,按H.264/H.265的访问单元规则拆分:
+//  已经有图像数据时,遇到SEI、参数集、AUD或图像的第一个slice开始新的访问单元
+//  成功返回0,结束返回-1
+template<class T>
+int Recover_ReadPacketT(AVPacket* pkt)
+{
+    SRecoverContext& ctx = RecoverCtx;
+    int ls = ctx.length_size;
+    while(1)
+    {
+        unsigned long long nal_pos = 0ULL;
+        unsigned int nal_len = 0;
+        if(ctx.pend)
+        {
+            nal_pos = ctx.pend_pos;
+            nal_len = ctx.pend_len;
+            ctx.pend = false;
+        }
+        else if(Recover_NextNal<T>(nal_pos, nal_len) != 0)
+        {
+            break;
+        }
+        ctx.nal_cnt++;
+
+        const unsigned char* pnal = ctx.p_map + nal_pos + ls;
+        int type = T::NalType(pnal);
+        if(ctx.au_vcl && (T::IsAuPrefix(type) || T::IsFirstSlice(pnal, nal_len)))
+        {
+            ctx.pend = true;
+            ctx.pend_pos = nal_pos;
+            ctx.pend_len = nal_len;
+            ctx.nal_cnt--;
+            if(Recover_EmitAu(pkt) == 0) return 0;
+            continue;
+        }
+
+        //  加入当前访问单元,与上一段连续时合并
+        unsigned long long nal_end = nal_pos + ls + nal_len;
+        if((ctx.au_parts.size() > 0) && (ctx.au_parts.back().second == nal_pos)) ctx.au_parts.back().second = nal_end;
+        else ctx.au_parts.push_back(std::make_pair(nal_pos, nal_end));
+        if(T::IsVcl(type)) ctx.au_vcl = true;
+        if(T::IsKey(type)) ctx.au_key = true;
+    }
+
+    //  最后一帧,没有图像数据时丢弃
+    if(ctx.au_vcl && (Recover_EmitAu(pkt) == 0)) return 0;
+    ctx.au_parts.clear();
+    return -1;
+}
+
+//  按当前文件的编码读取一帧
+int Recover_ReadPacket(AVPacket* pkt)
+{
+    if(RecoverCtx.codec == ECodec_H265) return Recover_ReadPacketT<SH265Traits>(pkt);
+    return Recover_ReadPacketT<SH264Traits>(pkt);
+}
+
+//  box的类型是否为可打印字符
+bool Recover_IsBoxType(const unsigned char* ptype)
+{
+    int i=0;
+    for(i=0;i<4;i++)
+    {
+        if((ptype[i] < 0x20) || (ptype[i] > 0x7E)) return false;
+    }
+    return true;
+}
+
+//  查找顶层的mdat
+//  录制中断时mdat的大小可能为0、还没有更新,或者之后的数据不是合法的box,
+//  这些情况下mdat延伸到文件结尾; 没有mdat时扫描整个文件
+void Recover_FindMdat(void)
+{
+    SRecoverContext& ctx = RecoverCtx;
+    const unsigned char* pdat = ctx.p_map;
+    unsigned long long size = ctx.map_size;
+    unsigned long long pos = 0ULL;
+    bool last_mdat = false;
+    ctx.ranges.clear();
+    while(pos + 8 <= size)
+    {
+        unsigned long long box = Recover_GetLength(pdat + pos, 4);
+        int head = 8;
+        if(box == 1)
+        {
+            if(pos + 16 > size) break;
+            box = ((unsigned long long)Recover_GetLength(pdat + pos + 8, 4) << 32) | Recover_GetLength(pdat + pos + 12, 4);
+            head = 16;
+        }
+        else if(box == 0)
+        {
+            box = size - pos;
+        }
+        if(!Recover_IsBoxType(pdat + pos + 4))
+        {
+            if(last_mdat) ctx.ranges.back().second = size;
+            break;
+        }
+        bool bad = (box < (unsigned long long)head) || (box > size - pos);
+        last_mdat = (memcmp(pdat + pos + 4, "mdat", 4) == 0);
+        if(last_mdat) ctx.ranges.push_back(std::make_pair(pos + head, bad ? size : (pos + box)));
+        if(bad) break;
+        pos += box;
+    }
+    if(ctx.ranges.size() == 0)
+    {
+        printf("[Recover] No mdat box, scan whole file\r\n");
+        ctx.ranges.push_back(std::make_pair(0ULL, size));
+    }
+}
+
+//  读取参考的编码配置
+//  参考文件为同一设备录制的完整视频文件时,取视频流的extradata、宽度、高度和帧率,
+//  无法打开时把整个文件作为avcC/hvcC
+//  成功返回0,失败返回-1
+int Recover_LoadRef(std::string name)
+{
+    SRecoverContext& ctx = RecoverCtx;
+    ctx.config.clear();
+    ctx.codec = ECodec_H264;
+    ctx.Width = 0;
+    ctx.Height = 0;
+    ctx.FrameRate = 0.0f;
+    ctx.fd = -1;
+    ctx.p_map = 0;
+    ctx.map_size = 0ULL;
+
+    //  完整的视频文件
+    AVFormatContext* p_fmt_ctx = 0;
+    if(avformat_open_input(&p_fmt_ctx, name.c_str(), NULL, NULL) == 0)
+    {
+        AVStream* st = 0;
+        unsigned int i = 0;
+        if(avformat_find_stream_info(p_fmt_ctx, NULL) >= 0)
+        {
+            for(i=0;i<p_fmt_ctx->nb_streams;i++)
+            {
+                if(p_fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+                {
+                    st = p_fmt_ctx->streams[i];
+                    break;
+                }
+            }
+        }
+        if(st != 0)
+        {
+            const AVCodecParameters* par = st->codecpar;
+            if(par->extradata_size > 0) ctx.config.assign(par->extradata, par->extradata + par->extradata_size);
+            ctx.codec = (par->codec_id == AV_CODEC_ID_HEVC) ? ECodec_H265 : ECodec_H264;
+            ctx.Width = par->width;
+            ctx.Height = par->height;
+            if(st->avg_frame_rate.den > 0) ctx.FrameRate = st->avg_frame_rate.num * 1.0f / st->avg_frame_rate.den;
+            if((par->codec_id != AV_CODEC_ID_H264) && (par->codec_id != AV_CODEC_ID_HEVC)) ctx.config.clear();
+        }
+        avformat_close_input(&p_fmt_ctx);
+        if(ctx.config.size() == 0)
+        {
+            printf("[Error] Recover Reference has no H264/H265 avcC/hvcC!! %s\r\n", name.c_str());
+            return -1;
+        }
+    }
+    //  avcC/hvcC文件
+    else
+    {
+        FILE* pfile = fopen(name.c_str(), "rb");
+        if(pfile == 0)
+        {
+            printf("[Error] Open Recover Reference Error!! %s\r\n", name.c_str());
+            return -1;
+        }
+        unsigned char buf[65536];
+        size_t len = fread(buf, 1, sizeof(buf), pfile);
+        fclose(pfile);
+        ctx.config.assign(buf, buf + len);
+
+        //  按保留位区分: avcC[4]高6位和[5]高3位为1,hvcC[13]高4位和[15]高6位为1
+        bool avcc = (len >= 7) && (buf[0] == 1) && ((buf[4] & 0xFC) == 0xFC) && ((buf[5] & 0xE0) == 0xE0);
+        bool hvcc = (len >= 23) && (buf[0] == 1) && ((buf[13] & 0xF0) == 0xF0) && ((buf[15] & 0xFC) == 0xFC);
+        if(!avcc && !hvcc)
+        {
+            printf("[Error] Recover Reference is not a video file or avcC/hvcC!! %s\r\n", name.c_str());
+            return -1;
+        }
+        ctx.codec = avcc ? ECodec_H264 : ECodec_H265;
+    }
+    printf("Recover Reference:%s codec=%s config=%lu bytes\r\n",
+           name.c_str(), Codec_Name(ctx.codec), (unsigned long)ctx.config.size());
+    return 0;
+}
+
+//  按恢复模式打开无法用FFmpeg打开的文件: 只读映射,查找mdat,参数集取自参考
+//  成功返回0,失败返回-1
+int Recover_Open(std::string filename)
+{
+    SRecoverContext& ctx = RecoverCtx;
+    ctx.fd = open(filename.c_str(), O_RDONLY);
+    if(ctx.fd < 0)
+    {
+        printf("[Error] Recover Open Error!! %s\r\n", filename.c_str());
+        return -1;
+    }
+    struct stat st;
+    void* p_map = MAP_FAILED;
+    if((fstat(ctx.fd, &st) == 0) && (st.st_size > 0))
+    {
+        p_map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, ctx.fd, 0);
+    }
+    if(p_map == MAP_FAILED)
+    {
+        printf("[Error] Recover Map Error!! %s\r\n", filename.c_str());
+        close(ctx.fd);
+        ctx.fd = -1;
+        return -1;
+    }
+    madvise(p_map, st.st_size, MADV_SEQUENTIAL);
+    ctx.p_map = (const unsigned char*)p_map;
+    ctx.map_size = st.st_size;
+
+    //  参数集和封装格式,mdat中总是长度前缀
+    ffmpeg_context.codec = ctx.codec;
+    ffmpeg_context.transcode = false;
+    ffmpeg_context.slice_extra_bits = 0;
+    if(Codec_GetParamSets(ctx.config.data(), ctx.config.size()) != 0)
+    {
+        printf("ERROR:Bad avcC/hvcC in recover reference\r\n");
+        Recover_Close();
+        return -1;
+    }
+    if(ffmpeg_context.framing != EFraming_AVCC)
+    {
+        ffmpeg_context.framing = EFraming_AVCC;
+        ffmpeg_context.nal_length_size = 4;
+    }
+    ffmpeg_context.framing_checked = true;
+    ctx.length_size = ffmpeg_context.nal_length_size;
+
+    //  宽度、高度和帧率,总帧数未知,读取到结束后修正信息文件
+    ffmpeg_context.Width = ctx.Width;
+    ffmpeg_context.Height = ctx.Height;
+    if(ctx.codec == ECodec_H265) H265_ParsePpsExtraBits();
+    else                         H264_ParseCurrentSps();
+    if(ffmpeg_context.sps_valid)
+    {
+        ffmpeg_context.Width = ffmpeg_context.sps_info.width;
+        ffmpeg_context.Height = ffmpeg_context.sps_info.height;
+    }
+    ffmpeg_context.FrameRate = (RecoverFps > 0.0f) ? RecoverFps : ((ctx.FrameRate > 0.0f) ? ctx.FrameRate : 25.0f);
+    ffmpeg_context.TotalFrame = 0UL;
+    ffmpeg_context.v_idx = 0;
+
+    //  扫描状态
+    Recover_FindMdat();
+    ctx.range_idx = 0;
+    ctx.pos = ctx.ranges.at(0).first;
+    ctx.chain_end = ctx.pos;
+    ctx.gap_end = ctx.pos;
+    ctx.contiguous = false;
+    ctx.au_parts.clear();
+    ctx.au_vcl = false;
+    ctx.au_key = false;
+    ctx.pend = false;
+    ctx.started = false;
+    ctx.nal_cnt = 0UL;
+    ctx.frame_cnt = 0UL;
+    ctx.key_cnt = 0UL;
+    ctx.lead_drop = 0UL;
+    ctx.resync_cnt = 0UL;
+    ctx.skip_bytes = 0ULL;
+
+    unsigned long long mdat_bytes = 0ULL;
+    size_t i = 0;
+    for(i=0;i<ctx.ranges.size();i++) mdat_bytes += ctx.ranges.at(i).second - ctx.ranges.at(i).first;
+    printf("[Recover] %s mdat=%lu bytes=%llu codec=%s nal_length_size=%d\r\n",
+           filename.c_str(), (unsigned long)ctx.ranges.size(), mdat_bytes, Codec_Name(ctx.codec), ctx.length_size);
+    printf("width=%d, height=%d, frame_rate=%f fps\r\n", ffmpeg_context.Width, ffmpeg_context.Height, ffmpeg_context.FrameRate);
+    return 0;
+}
+
+//  关闭恢复的输入,打印统计
+void Recover_Close(void)
+{
+    SRecoverContext& ctx = RecoverCtx;
+    if(ctx.fd < 0) return;
+    if(ctx.ranges.size() > 0)
+    {
+        printf("[Recover] frames=%lu key=%lu nals=%lu lead_drop=%lu resync=%lu skipped=%llu bytes\r\n",
+               ctx.frame_cnt, ctx.key_cnt, ctx.nal_cnt, ctx.lead_drop, ctx.resync_cnt, ctx.skip_bytes);
+    }
+    if(ctx.p_map != 0) munmap((void*)ctx.p_map, ctx.map_size);
+    close(ctx.fd);
+    ctx.fd = -1;
+    ctx.p_map = 0;
+    ctx.map_size = 0ULL;
+    ctx.ranges.clear();
+    ctx.au_parts.clear();
+}
+
+//---------------------------------------------------------------------
+//  CRC32C相关函数
+//  x86上CPU支持SSE4.2时使用crc32指令,否则使用查表法,两者结果一致
+
+//  查表法使用的表
+unsigned int Crc32cTable[256];
+bool Crc32cTableReady = false;
+
+//  生成查表法使用的表(反射多项式0x82F63B78)
+void Crc32c_InitTable(void)
+{
+    unsigned int i=0;
+    for(i=0;i<256;i++)
+    {
+        unsigned int crc = i;
+        int k=0;
+        for(k=0;k<8;k++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0x82F63B78) : (crc >> 1);
+        }
+        Crc32cTable[i] = crc;
+    }
+    Crc32cTableReady = true;
+}
+
+//  查表法,crc为未取反的中间值
+unsigned int Crc32c_Table(unsigned int crc, const unsigned char* p, size_t len)
+{
+    size_t i=0;
+    for(i=0;i<len;i++)
+    {
+        crc = Crc32cTable[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//  SSE4.2 crc32指令,crc为未取反的中间值
+__attribute__((target("sse4.2")))
+unsigned int Crc32c_Hw(unsigned int crc, const unsigned char* p, size_t len)
+{
+    //  对齐到8字节
+    while((len > 0) && (((uintptr_t)p & 7) != 0))
+    {
+        crc = _mm_crc32_u8(crc, *p);
+        p++;
+        len--;
+    }
+#if defined(__x86_64__)
+    unsigned long long crc64 = crc;
+    while(len >= 8)
+    {
+        crc64 = _mm_crc32_u64(crc64, *(const unsigned long long*)p);
+        p += 8;
+        len -= 8;
+    }
+    crc = (unsigned int)crc64;
+#endif  //  __x86_64__
+    while(len >= 4)
+    {
+        crc = _mm_crc32_u32(crc, *(const unsigned int*)p);
+        p += 4;
+        len -= 4;
+    }
+    while(len > 0)
+    {
+        crc = _mm_crc32_u8(crc, *p);
+        p++;
+        len--;
+    }
+    return crc;
+}
+#endif  //  __x86_64__ || __i386__
+
+//  计算CRC32C,可以分段连续计算
+//  参数 crc 为前一段的结果,第一段为0
+unsigned int Crc32c(unsigned int crc, const void* pdat, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)pdat;
+    crc = ~crc;
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+    if(has_sse42) return ~Crc32c_Hw(crc, p, len);
+#endif  //  __x86_64__ || __i386__
+    if(!Crc32cTableReady) Crc32c_InitTable();
+    return ~Crc32c_Table(crc, p, len);
+}
+
+//  按信息文件中的CRC32C逐帧检查H264文件
+//  全部正确返回0,有错误返回-14
+int Crc_CheckFile(std::string h264_name, std::string vinf_name)
+{
+    SVinfInfo info;
+    if(Vinf_Load(vinf_name, info) != 0)
+    {
+        printf("[Check] Load Video Info File Error!! %s\r\n", vinf_name.c_str());
+        return -14;
+    }
+    if(!info.has_crc)
+    {
+        printf("[Check] No CRC32C in Video Info File!! %s\r\n", vinf_name.c_str());
+        return -14;
+    }
+    FILE* pfile = fopen(h264_name.c_str(), "rb");
+    if(pfile == 0)
+    {
+        printf("[Check] Open H264 File Error!! %s\r\n", h264_name.c_str());
+        return -14;
+    }
+
+    //  逐帧读入并计算
+    double t0 = Pipe_NowMs();
+    std::vector<unsigned char> buf;
+    unsigned long long bytes = 0ULL;
+    unsigned long bad_cnt = 0UL;
+    size_t i=0;
+    for(i=0;i<info.frame_size.size();i++)
+    {
+        int size = info.frame_size.at(i);
+        if((int)buf.size() < size) buf.resize(size);
+        if((size < 0) || (fread(buf.data(), 1, size, pfile) != (size_t)size))
+        {
+            printf("[Check] Frame %lu Read Error!! size=%d\r\n", (unsigned long)i, size);
+            bad_cnt += info.frame_size.size() - i;
+            break;
+        }
+        bytes += size;
+        unsigned int crc = Crc32c(0, buf.data(), size);
+        if(crc != info.frame_crc.at(i))
+        {
+            if(bad_cnt < 10)
+            {
+                printf("[Check] Frame %lu CRC Error!! index=%08x data=%08x\r\n",
+                       (unsigned long)i, info.frame_crc.at(i), crc);
+            }
+            bad_cnt++;
+        }
+    }
+    fclose(pfile);
+
+    double ms = Pipe_NowMs() - t0;
+    printf("[Check] %s frames=%lu bad=%lu %.1fMB/s\r\n", h264_name.c_str(),
+           (unsigned long)info.frame_size.size(), bad_cnt,
+           (ms > 0.0) ? (bytes / 1048.576 / ms) : 0.0);
+    return (bad_cnt == 0) ? 0 : -14;
+}
+
+//---------------------------------------------------------------------
+//  实时推流相关函数
+
+//  打开推流目标
+//  成功返回0,失败返回-1
+int Stream_Open(std::string target)
+{
+    //  解析类型前缀
+    std::string path = target;
+    bool is_unix = false;
+    bool is_fifo = false;
+    if(target.compare(0, 5, "unix:") == 0)      { is_unix = true; path = target.substr(5); }
+    else if(target.compare(0, 5, "fifo:") == 0) { is_fifo = true; path = target.substr(5); }
+    else
+    {
+        struct stat st;
+        if(stat(path.c_str(), &st) != 0)
+        {
+            printf("[Error] Stream Target Not Exist!! %s\r\n", path.c_str());
+            return -1;
+        }
+        is_unix = S_ISSOCK(st.st_mode);
+        is_fifo = S_ISFIFO(st.st_mode);
+    }
+
+    //  对端关闭时write返回EPIPE,而不是结束进程
+    signal(SIGPIPE, SIG_IGN);
+
+    //  UNIX域流式套接字
+    if(is_unix)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if(path.size() >= sizeof(addr.sun_path))
+        {
+            printf("[Error] Socket Path Too Long!! %s\r\n", path.c_str());
+            return -1;
+        }
+        strcpy(addr.sun_path, path.c_str());
+        StreamFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if((StreamFd < 0) || (connect(StreamFd, (struct sockaddr*)&addr, sizeof(addr)) != 0))
+        {
+            printf("[Error] Connect Stream Socket Error!! %s errno=%d\r\n", path.c_str(), errno);
+            if(StreamFd >= 0) close(StreamFd);
+            StreamFd = -1;
+            return -1;
+        }
+    }
+    //  命名管道
+    else if(is_fifo)
+    {
+        printf("Waiting for FIFO reader:%s\r\n", path.c_str());
+        StreamFd = open(path.c_str(), O_WRONLY);
+        if(StreamFd < 0)
+        {
+            printf("[Error] Open Stream FIFO Error!! %s errno=%d\r\n", path.c_str(), errno);
+            return -1;
+        }
+    }
+    else
+    {
+        printf("[Error] Stream Target is not a socket or FIFO!! %s\r\n", target.c_str());
+        return -1;
+    }
+    printf("Stream Output:%s\r\n", target.c_str());
+    return 0;
+}
+
+//  关闭推流目标
+void Stream_Close(void)
+{
+    if(StreamFd >= 0)
+    {
+        close(StreamFd);
+        StreamFd = -1;
+    }
+}
+
+//  写入全部数据,处理部分写入和信号中断
+//  返回写入的字节数,出错时小于len
+int Stream_WriteAll(int fd, const void* pdat, int len)
+{
+    const unsigned char* p = (const unsigned char*)pdat;
+    int done = 0;
+    while(done < len)
+    {
+        ssize_t n = write(fd, p + done, len - done);
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+//  时间加上微秒
+struct timespec Stream_AddUs(struct timespec t, double us)
+{
+    long long ns = t.tv_nsec + (long long)(us * 1000.0);
+    t.tv_sec += ns / 1000000000LL;
+    t.tv_nsec = ns % 1000000000LL;
+    if(t.tv_nsec < 0)
+    {
+        t.tv_nsec += 1000000000LL;
+        t.tv_sec--;
+    }
+    return t;
+}
+
+//  两个时间的差,单位微秒
+double Stream_DiffUs(struct timespec a, struct timespec b)
+{
+    return (a.tv_sec - b.tv_sec) * 1000000.0 + (a.tv_nsec - b.tv_nsec) / 1000.0;
+}
+
+//  开始一个文件的推流节拍
+void Stream_ResetPacer(void)
+{
+    memset(&StreamPacer, 0, sizeof(StreamPacer));
+}
+
+//  等待到本帧的发送时刻
+//  以第0帧的发送时刻为基准计算每一帧的绝对时刻,睡眠误差不会累积
+void Stream_Pace(AVPacket* pkt)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    //  本帧的时间戳(解码顺序发送,优先使用dts)
+    int64_t ts = (pkt->dts != AV_NOPTS_VALUE) ? pkt->dts : pkt->pts;
+
+    //  第0帧作为基准
+    if(!StreamPacer.started)
+    {
+        StreamPacer.started = true;
+        StreamPacer.start = now;
+        StreamPacer.first_ts = ts;
+        StreamPacer.frames = 1;
+        return;
+    }
+
+    //  计算本帧的发送时刻
+    double offset_us = 0.0;
+    if((StreamPace == EStreamPace_Pts) && (ts != AV_NOPTS_VALUE) && (StreamPacer.first_ts != AV_NOPTS_VALUE))
+    {
+        AVRational tb = ffmpeg_context.video_stream->time_base;
+        offset_us = (ts - StreamPacer.first_ts) * 1000000.0 * tb.num / tb.den;
+    }
+    else if((StreamPace != EStreamPace_None) && (ffmpeg_context.FrameRate > 0.0f))
+    {
+        offset_us = StreamPacer.frames * 1000000.0 / ffmpeg_context.FrameRate;
+    }
+    StreamPacer.frames++;
+    if(StreamPace == EStreamPace_None) return;
+    struct timespec deadline = Stream_AddUs(StreamPacer.start, offset_us);
+
+    //  睡眠到绝对时刻
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+    {
+    }
+
+    //  统计迟到时间
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double late_us = Stream_DiffUs(now, deadline);
+    if(late_us < 0.0) late_us = 0.0;
+    StreamPacer.late_sum_us += late_us;
+    StreamPacer.late_sq_sum_us += late_us * late_us;
+    if(late_us > StreamPacer.late_max_us) StreamPacer.late_max_us = late_us;
+    if(late_us > 1000.0) StreamPacer.late_cnt++;
+}
+
+//  打印当前文件的推流统计,抖动为迟到时间的标准差
+void Stream_PrintStat(void)
+{
+    unsigned long n = (StreamPacer.frames > 1) ? (StreamPacer.frames - 1) : 0;
+    double avg = 0.0;
+    double jitter = 0.0;
+    if(n > 0)
+    {
+        avg = StreamPacer.late_sum_us / n;
+        double var = StreamPacer.late_sq_sum_us / n - avg * avg;
+        jitter = (var > 0.0) ? sqrt(var) : 0.0;
+    }
+    printf("Stream Stat: frames=%lu lateness avg=%.1fus max=%.1fus jitter=%.1fus late(>1ms)=%lu\r\n",
+           StreamPacer.frames, avg, StreamPacer.late_max_us, jitter, StreamPacer.late_cnt);
+}
+
+//---------------------------------------------------------------------
+//  RTP发送相关函数(RFC 6184)
+
+//  打开RTP目标
+//  成功返回0,失败返回-1
+int Rtp_Open(std::string target)
+{
+    //  拆分地址和端口
+    size_t pos = target.rfind(':');
+    if(pos == std::string::npos)
+    {
+        printf("[Error] RTP Target must be host:port!! %s\r\n", target.c_str());
+        return -1;
+    }
+    std::string host = target.substr(0, pos);
+    std::string port = target.substr(pos + 1);
+    if((host.size() >= 2) && (host.at(0) == '[') && (host.at(host.size() - 1) == ']'))
+    {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    //  解析地址
+    struct addrinfo hints;
+    struct addrinfo* res = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if(getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+    {
+        printf("[Error] Resolve RTP Target Error!! %s\r\n", target.c_str());
+        return -1;
+    }
+
+    //  创建并连接UDP套接字
+    memset(&RtpCtx, 0, sizeof(RtpCtx));
+    RtpCtx.fd = socket(res->ai_family, SOCK_DGRAM, 0);
+    if((RtpCtx.fd < 0) || (connect(RtpCtx.fd, res->ai_addr, res->ai_addrlen) != 0))
+    {
+        printf("[Error] Connect RTP Target Error!! %s errno=%d\r\n", target.c_str(), errno);
+        if(RtpCtx.fd >= 0) close(RtpCtx.fd);
+        RtpCtx.fd = -1;
+        freeaddrinfo(res);
+        return -1;
+    }
+    RtpCtx.family = res->ai_family;
+    if(getnameinfo(res->ai_addr, res->ai_addrlen, RtpCtx.addr, sizeof(RtpCtx.addr), 0, 0, NI_NUMERICHOST) != 0)
+    {
+        snprintf(RtpCtx.addr, sizeof(RtpCtx.addr), "%s", host.c_str());
+    }
+    freeaddrinfo(res);
+
+    //  加大发送缓存,应对高码率的关键帧
+    int sndbuf = 4 * 1024 * 1024;
+    setsockopt(RtpCtx.fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    //  初始化
+    RtpCtx.mtu = RtpMtu;
+    if(RtpCtx.mtu < RTP_HEAD_LEN + 64) RtpCtx.mtu = RTP_HEAD_LEN + 64;
+    if(RtpCtx.mtu > (int)sizeof(RtpCtx.stap)) RtpCtx.mtu = sizeof(RtpCtx.stap);
+    RtpCtx.pt = RtpPt & 0x7F;
+    srand(time(NULL) ^ getpid());
+    RtpCtx.seq = rand() & 0xFFFF;
+    RtpCtx.ts_base = rand();
+    RtpCtx.ssrc = rand();
+    printf("RTP Output:%s mtu=%d pt=%d ssrc=%08X\r\n", target.c_str(), RtpCtx.mtu, RtpCtx.pt, RtpCtx.ssrc);
+    return 0;
+}
+
+//  关闭RTP目标
+void Rtp_Close(void)
+{
+    if(RtpCtx.fd >= 0)
+    {
+        close(RtpCtx.fd);
+        RtpCtx.fd = -1;
+    }
+}
+
+//  开始一个文件,时间戳接着上一个文件继续增长
+void Rtp_BeginFile(void)
+{
+    RtpCtx.first_pts = AV_NOPTS_VALUE;
+    RtpCtx.ts_offset = RtpCtx.last_ts + 3000;
+    RtpCtx.packets = 0;
+    RtpCtx.bytes = 0;
+    RtpCtx.single_cnt = 0;
+    RtpCtx.stap_cnt = 0;
+    RtpCtx.fua_cnt = 0;
+    RtpCtx.send_calls = 0;
+}
+
+//  发送批量缓存中的全部包
+//  成功返回0,失败返回-1
+int Rtp_Flush(void)
+{
+    int sent = 0;
+    while(sent < RtpCtx.batch_cnt)
+    {
+        int n = sendmmsg(RtpCtx.fd, RtpCtx.msgs + sent, RtpCtx.batch_cnt - sent, 0);
+        RtpCtx.send_calls++;
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+
+            //  发送缓存满时等待可写,ENOBUFS(网卡队列满)时poll立即返回,再等待1毫秒,避免空转
+            int err = errno;
+            if((err == ENOBUFS) || (err == EAGAIN))
+            {
+                RtpCtx.backoff_cnt++;
+                struct pollfd pfd;
+                pfd.fd = RtpCtx.fd;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+                poll(&pfd, 1, 100);
+                if(err == ENOBUFS) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            printf("[Error] RTP sendmmsg Error!! errno=%d\r\n", err);
+            RtpCtx.batch_cnt = 0;
+            return -1;
+        }
+        sent += n;
+    }
+    RtpCtx.batch_cnt = 0;
+    return 0;
+}
+
+//  向批量缓存中加入一个RTP包
+//  head_ext为RTP头部之后的附加字节(FU-A为2个字节),payload为负载数据(不复制)
+//  成功返回0,失败返回-1
+int Rtp_Queue(bool marker, unsigned int ts, const unsigned char* head_ext, int head_ext_len,
+              const unsigned char* payload, int payload_len)
+{
+    if((RtpCtx.batch_cnt >= RTP_BATCH_MAX) && (Rtp_Flush() != 0)) return -1;
+
+    //  RTP固定头部
+    int k = RtpCtx.batch_cnt;
+    unsigned char* phead = RtpCtx.heads[k];
+    phead[0] = 0x80;                                        //  V=2
+    phead[1] = (marker ? 0x80 : 0x00) | RtpCtx.pt;
+    phead[2] = RtpCtx.seq >> 8;
+    phead[3] = RtpCtx.seq & 0xFF;
+    phead[4] = ts >> 24;
+    phead[5] = (ts >> 16) & 0xFF;
+    phead[6] = (ts >> 8) & 0xFF;
+    phead[7] = ts & 0xFF;
+    phead[8] = RtpCtx.ssrc >> 24;
+    phead[9] = (RtpCtx.ssrc >> 16) & 0xFF;
+    phead[10] = (RtpCtx.ssrc >> 8) & 0xFF;
+    phead[11] = RtpCtx.ssrc & 0xFF;
+    if(head_ext_len > 0) memcpy(phead + RTP_HEAD_LEN, head_ext, head_ext_len);
+    RtpCtx.seq++;
+
+    //  分散写入,负载不复制
+    RtpCtx.iovs[k][0].iov_base = phead;
+    RtpCtx.iovs[k][0].iov_len = RTP_HEAD_LEN + head_ext_len;
+    RtpCtx.iovs[k][1].iov_base = (void*)payload;
+    RtpCtx.iovs[k][1].iov_len = payload_len;
+    memset(&RtpCtx.msgs[k], 0, sizeof(RtpCtx.msgs[k]));
+    RtpCtx.msgs[k].msg_hdr.msg_iov = RtpCtx.iovs[k];
+    RtpCtx.msgs[k].msg_hdr.msg_iovlen = 2;
+    RtpCtx.batch_cnt++;
+
+    RtpCtx.packets++;
+    RtpCtx.bytes += RTP_HEAD_LEN + head_ext_len + payload_len;
+    return 0;
+}
+
+//  发送一个NAL,不超过MTU时为单NAL包,否则用FU-A分片
+//  成功返回0,失败返回-1
+int Rtp_SendNal(const unsigned char* pnal, int len, bool last_nal, unsigned int ts)
+{
+    if(len <= 0) return 0;
+
+    //  单NAL包
+    int max_payload = RtpCtx.mtu - RTP_HEAD_LEN;
+    if(len <= max_payload)
+    {
+        RtpCtx.single_cnt++;
+        return Rtp_Queue(last_nal, ts, 0, 0, pnal, len);
+    }
+
+    //  FU-A分片,NAL头部不发送,类型放在FU头部中
+    unsigned char fu[2];
+    fu[0] = (pnal[0] & 0xE0) | 28;                          //  FU indicator
+    const unsigned char* p = pnal + 1;
+    int remain = len - 1;
+    bool first = true;
+    max_payload -= 2;
+    while(remain > 0)
+    {
+        int n = (remain > max_payload) ? max_payload : remain;
+        bool end = (n == remain);
+        fu[1] = (first ? 0x80 : 0x00) | (end ? 0x40 : 0x00) | (pnal[0] & 0x1F);    //  FU header
+        if(Rtp_Queue(last_nal && end, ts, fu, 2, p, n) != 0) return -1;
+        RtpCtx.fua_cnt++;
+        p += n;
+        remain -= n;
+        first = false;
+    }
+    return 0;
+}
+
+//  将SPS和PPS聚合为一个STAP-A包发送
+//  成功返回0,失败返回-1
+int Rtp_SendParamSets(unsigned int ts)
+{
+    if((ffmpeg_context.sps_len <= 0) || (ffmpeg_context.pps_len <= 0)) return 0;
+
+    //  超过MTU时分别发送
+    int len = 1 + 2 + ffmpeg_context.sps_len + 2 + ffmpeg_context.pps_len;
+    if(len > RtpCtx.mtu - RTP_HEAD_LEN)
+    {
+        if(Rtp_SendNal(ffmpeg_context.sps_dat, ffmpeg_context.sps_len, false, ts) != 0) return -1;
+        return Rtp_SendNal(ffmpeg_context.pps_dat, ffmpeg_context.pps_len, false, ts);
+    }
+
+    //  STAP-A头部的NRI取两者中的最大值
+    unsigned char* p = RtpCtx.stap;
+    int nri = (ffmpeg_context.sps_dat[0] & 0x60) | (ffmpeg_context.pps_dat[0] & 0x60);
+    p[0] = (nri & 0x60) | 24;
+    p[1] = ffmpeg_context.sps_len >> 8;
+    p[2] = ffmpeg_context.sps_len & 0xFF;
+    memcpy(p + 3, ffmpeg_context.sps_dat, ffmpeg_context.sps_len);
+    p += 3 + ffmpeg_context.sps_len;
+    p[0] = ffmpeg_context.pps_len >> 8;
+    p[1] = ffmpeg_context.pps_len & 0xFF;
+    memcpy(p + 2, ffmpeg_context.pps_dat, ffmpeg_context.pps_len);
+    RtpCtx.stap_cnt++;
+    return Rtp_Queue(false, ts, 0, 0, RtpCtx.stap, len);
+}
+
+//  发送一帧(Annex-B格式),发送完成后才返回,帧数据在返回后可以释放
+//  成功返回pkt->size,失败返回-1
+int Rtp_SendFrame(AVPacket* pkt, unsigned long frame_cnt)
+{
+    //  时间戳,由pts换算为90kHz
+    unsigned int ts = 0;
+    if((pkt->pts != AV_NOPTS_VALUE) && (RtpCtx.first_pts == AV_NOPTS_VALUE)) RtpCtx.first_pts = pkt->pts;
+    if((pkt->pts != AV_NOPTS_VALUE) && (RtpCtx.first_pts != AV_NOPTS_VALUE))
+    {
+        AVRational tb90k = {1, 90000};
+        ts = (unsigned int)av_rescale_q(pkt->pts - RtpCtx.first_pts, ffmpeg_context.video_stream->time_base, tb90k);
+    }
+    else if(ffmpeg_context.FrameRate > 0.0f)
+    {
+        ts = (unsigned int)(frame_cnt * 90000.0 / ffmpeg_context.FrameRate);
+    }
+    ts += RtpCtx.ts_base + RtpCtx.ts_offset;
+    RtpCtx.last_ts = ts - RtpCtx.ts_base;
+
+    //  关键帧或者第一帧前发送参数集
+    int re = 0;
+    if(((pkt->flags & AV_PKT_FLAG_KEY) != 0) || (frame_cnt == 0))
+    {
+        re = Rtp_SendParamSets(ts);
+    }
+
+    //  逐个NAL发送,AUD不发送
+    std::vector<int> nal_offset;
+    std::vector<int> nal_len;
+    int nal_cnt = H264_SplitAnnexB(pkt->data, pkt->size, nal_offset, nal_len);
+    int last = nal_cnt - 1;
+    while((last >= 0) && ((pkt->data[nal_offset.at(last)] & 0x1F) == 9)) last--;
+    int i=0;
+    for(i=0;(i<=last) && (re == 0);i++)
+    {
+        const unsigned char* pnal = pkt->data + nal_offset.at(i);
+        if((pnal[0] & 0x1F) == 9) continue;
+        re = Rtp_SendNal(pnal, nal_len.at(i), i == last, ts);
+    }
+
+    //  本帧的包全部发出
+    if(re == 0) re = Rtp_Flush();
+    return (re == 0) ? pkt->size : -1;
+}
+
+//  打印当前文件的RTP统计
+void Rtp_PrintStat(void)
+{
+    printf("RTP Stat: packets=%lu bytes=%llu single=%lu stap_a=%lu fu_a=%lu sendmmsg_calls=%lu backoff=%lu\r\n",
+           RtpCtx.packets, RtpCtx.bytes, RtpCtx.single_cnt, RtpCtx.stap_cnt, RtpCtx.fua_cnt, RtpCtx.send_calls,
+           RtpCtx.backoff_cnt);
+}
+
+//  生成接收端使用的SDP文件
+void Rtp_WriteSdp(std::string sdp_name)
+{
+    FILE* pfile = fopen(sdp_name.c_str(), "wb");
+    if(pfile == 0) return;
+    size_t pos = RtpTarget.rfind(':');
+    std::string port = RtpTarget.substr(pos + 1);
+    const char* addr_type = (RtpCtx.family == AF_INET6) ? "IP6" : "IP4";
+    fprintf(pfile, "v=0\r\n");
+    fprintf(pfile, "o=- 0 0 IN %s %s\r\n", addr_type, RtpCtx.addr);
+    fprintf(pfile, "s=VideoConv\r\n");
+    fprintf(pfile, "c=IN %s %s\r\n", addr_type, RtpCtx.addr);
+    fprintf(pfile, "t=0 0\r\n");
+    fprintf(pfile, "m=video %s RTP/AVP %d\r\n", port.c_str(), RtpCtx.pt);
+    fprintf(pfile, "a=rtpmap:%d H264/90000\r\n", RtpCtx.pt);
+    fprintf(pfile, "a=fmtp:%d packetization-mode=1", RtpCtx.pt);
+    if((ffmpeg_context.sps_len >= 4) && (ffmpeg_context.pps_len > 0))
+    {
+        char sps_b64[AV_BASE64_SIZE(1024)];
+        char pps_b64[AV_BASE64_SIZE(1024)];
+        if((ffmpeg_context.sps_len <= 1024) && (ffmpeg_context.pps_len <= 1024) &&
+           (av_base64_encode(sps_b64, sizeof(sps_b64), ffmpeg_context.sps_dat, ffmpeg_context.sps_len) != 0) &&
+           (av_base64_encode(pps_b64, sizeof(pps_b64), ffmpeg_context.pps_dat, ffmpeg_context.pps_len) != 0))
+        {
+            fprintf(pfile, ";profile-level-id=%02X%02X%02X;sprop-parameter-sets=%s,%s",
+                    ffmpeg_context.sps_dat[1], ffmpeg_context.sps_dat[2], ffmpeg_context.sps_dat[3],
+                    sps_b64, pps_b64);
+        }
+    }
+    fprintf(pfile, "\r\n");
+    fclose(pfile);
+}
+
+//---------------------------------------------------------------------
+//  内存映射输出相关函数
+
+//  当前编码格式下文件头部和每帧AUD在输出文件中的长度(含开始代码或长度前缀)
+//  header_len为VPS(仅H265)、SPS和PPS的总长度,没有参数集时为0
+//  aud_len为每帧插入的AUD长度,H264为6字节,H265为7字节,没有开启--aud时为0
+//  预估文件大小、演练和写入AUD时使用,保证三者一致
+void Conv_GetHeaderLen(int& header_len, int& aud_len)
+{
+    header_len = 0;
+    if((ffmpeg_context.sps_len > 0) && (ffmpeg_context.pps_len > 0))
+    {
+        header_len = 2 * sizeof(startcode) + ffmpeg_context.sps_len + ffmpeg_context.pps_len;
+        if(ffmpeg_context.vps_len > 0) header_len += sizeof(startcode) + ffmpeg_context.vps_len;
+    }
+    aud_len = 0;
+    if(AudMode) aud_len = (ffmpeg_context.codec == ECodec_H265) ? sizeof(audnal_h265) : sizeof(audnal);
+}
+
+//  根据视频流的采样表预估H264文件的大小
+//  4字节长度前缀和Annex-B格式的输入,每个NAL长度不变,结果是精确的
+//  其他长度前缀时偏小,写入时会自动扩大
+//  无法预估时返回0
+unsigned long long Mmap_EstimateSize(void)
+{
+    if(ffmpeg_context.transcode) return 0ULL;
+    AVStream* st = ffmpeg_context.p_fmt_ctx->streams[ffmpeg_context.v_idx];
+
+    //  VPS、SPS和PPS,每个前面有开始代码
+    int header_len = 0;
+    int aud_len = 0;
+    Conv_GetHeaderLen(header_len, aud_len);
+    unsigned long long size = header_len;
+
+    //  每个采样的大小,开启--aud时每帧加上AUD
+    int cnt = FFMpeg_GetIndexCount(st);
+    int i=0;
+    for(i=0;i<cnt;i++)
+    {
+        const AVIndexEntry* pentry = FFMpeg_GetIndexEntry(st, i);
+        if(pentry != 0) size += pentry->size + aud_len;
+    }
+    if(cnt <= 0) return 0ULL;
+    return size;
+}
+
+//  预分配空间,失败时(如磁盘已满、超出配额、文件系统不支持)返回错误,
+//  不能用ftruncate代替: 稀疏文件写入映射时没有空间会产生SIGBUS
+//  成功返回0,失败返回-1并设置errno
+int Mmap_Reserve(int fd, unsigned long long size)
+{
+    int re = posix_fallocate(fd, 0, (off_t)size);
+    if(re == 0) return 0;
+    errno = re;
+    return -1;
+}
+
+//  创建预分配的内存映射输出文件
+//  成功返回0,失败返回-1,此时调用者改用普通文件写入
+int Mmap_Open(SConvOutput& out, std::string name, unsigned long long size)
+{
+    out.map_fd = open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(out.map_fd < 0) return -1;
+    if(Mmap_Reserve(out.map_fd, size) != 0)
+    {
+        close(out.map_fd);
+        out.map_fd = -1;
+        return -1;
+    }
+    void* p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, out.map_fd, 0);
+    if(p == MAP_FAILED)
+    {
+        close(out.map_fd);
+        out.map_fd = -1;
+        return -1;
+    }
+    madvise(p, size, MADV_SEQUENTIAL);
+    out.p_map = (unsigned char*)p;
+    out.map_size = size;
+    out.map_pos = 0ULL;
+    return 0;
+}
+
+//  确保内存映射至少有size字节,不足时扩大文件和映射
+//  成功返回0
+int Mmap_Ensure(SConvOutput& out, unsigned long long size)
+{
+    if(size <= out.map_size) return 0;
+    unsigned long long new_size = out.map_size + out.map_size / 4;
+    if(new_size < size) new_size = size;
+    if(Mmap_Reserve(out.map_fd, new_size) != 0) return -1;
+    void* p = mremap(out.p_map, out.map_size, new_size, MREMAP_MAYMOVE);
+    if(p == MAP_FAILED) return -1;
+    out.p_map = (unsigned char*)p;
+    out.map_size = new_size;
+    return 0;
+}
+
+//  写入内存映射,空间不足时扩大文件和映射
+//  返回写入的字节数
+int Mmap_Write(SConvOutput& out, const void* pdat, int len)
+{
+    if(Mmap_Ensure(out, out.map_pos + len) != 0) return -1;
+    memcpy(out.p_map + out.map_pos, pdat, len);
+    out.map_pos += len;
+    return len;
+}
+
+//  关闭内存映射输出,文件截断到实际写入的大小
+void Mmap_Close(SConvOutput& out)
+{
+    printf("[Mmap] Reserved=%llu Written=%llu\r\n", out.map_size, out.map_pos);
+    munmap(out.p_map, out.map_size);
+    if(ftruncate(out.map_fd, (off_t)out.map_pos) != 0)
+    {
+        printf("[Error] Mmap Truncate Error!! %s\r\n", strerror(errno));
+    }
+    close(out.map_fd);
+    out.p_map = 0;
+    out.map_fd = -1;
+}
+
+//  写入输出,推流时写入推流目标,否则写入H264文件
+//  RTP输出时参数集随关键帧用STAP-A发送,这里直接丢弃
+//  返回写入的字节数
+int Conv_OutWrite(SConvOutput& out, const void* pdat, int len)
+{
+    if(CrcMode) out.frame_crc = Crc32c(out.frame_crc, pdat, len);
+    if(RtpCtx.fd >= 0) return len;
+    if(StreamFd >= 0) return Stream_WriteAll(StreamFd, pdat, len);
+    if(out.p_map != 0) return Mmap_Write(out, pdat, len);
+    double t0 = Pipe_NowMs();
+    int re = 0;
+#if USE_IO_URING
+    if(out.p_uring != 0) re = Uring_Write(out.p_uring, pdat, len);
+    else
+#endif  //  USE_IO_URING
+    re = fwrite(pdat, 1, len, out.pfile_outh264);
+    out.write_ms += Pipe_NowMs() - t0;
+    return re;
+}
+
+//---------------------------------------------------------------------
+//  NAL子索引相关函数
+
+//  写入无符号变长整数
+void Nal_PutVarint(std::vector<unsigned char>& buf, unsigned int val)
+{
+    while(val >= 0x80)
+    {
+        buf.push_back((val & 0x7F) | 0x80);
+        val >>= 7;
+    }
+    buf.push_back(val);
+}
+
+//  打开NAL子索引文件并写入头部
+//  成功返回文件指针,失败返回0
+FILE* Nal_Open(std::string name)
+{
+    FILE* pfile = fopen(name.c_str(), "wb");
+    if(pfile == 0)
+    {
+        printf("[Error] Open NAL Index File Error!! %s\r\n", name.c_str());
+        return 0;
+    }
+    unsigned char head[8] = {'V', 'N', 'A', 'L', 1, (unsigned char)((OutFraming == EFraming_AVCC) ? 1 : 0),
+                             (unsigned char)((ffmpeg_context.codec == ECodec_H265) ? 1 : 0), 0};
+    fwrite(head, 1, sizeof(head), pfile);
+    NalFrameBuf.clear();
+    NalFrameCnt = 0;
+    NalFrameEnd = 0;
+    NalTotalCnt = 0ULL;
+    return pfile;
+}
+
+//  关闭NAL子索引文件并打印大小
+void Nal_Close(SConvOutput& out)
+{
+    if(out.pfile_outvnal == 0) return;
+    long size = ftell(out.pfile_outvnal);
+    fclose(out.pfile_outvnal);
+    out.pfile_outvnal = 0;
+    printf("[NalIndex] frames=%lu nals=%llu bytes=%ld (%.2f bytes/nal)\r\n",
+           out.frame_cnt, NalTotalCnt, size, (NalTotalCnt > 0ULL) ? ((double)size / NalTotalCnt) : 0.0);
+}
+
+//  记录当前帧中的一个NAL
+//  参数 offset 为NAL头部在帧中的偏移(不含前缀), len 为NAL长度(含头部), hdr 为NAL头部字节
+void Nal_Add(const SConvOutput& out, int offset, int len, unsigned char hdr)
+{
+    if(out.pfile_outvnal == 0) return;
+    Nal_PutVarint(NalFrameBuf, offset - NalFrameEnd);
+    Nal_PutVarint(NalFrameBuf, len);
+    NalFrameBuf.push_back(hdr);
+    NalFrameEnd = offset + len;
+    NalFrameCnt++;
+}
+
+//  替换时记录一个NAL,参数 pdat 为替换后的包数据, offset 为NAL头部的偏移
+void Nal_Record(std::vector<SNalEntry>& nals, const unsigned char* pdat, int offset, int len)
+{
+    if(len <= 0) return;
+    SNalEntry entry;
+    entry.offset = offset;
+    entry.len = len;
+    entry.hdr = pdat[offset];
+    nals.push_back(entry);
+}
+
+//  按替换时记录的NAL表记录包中的全部NAL,将写在当前帧已有数据之后
+//  参数 skip 为写入时去掉的包开头的字节数(如已有的AUD)
+void Nal_AddPacket(const SConvOutput& out, const std::vector<SNalEntry>& nals, int skip)
+{
+    if(out.pfile_outvnal == 0) return;
+    size_t i=0;
+    for(i=0;i<nals.size();i++)
+    {
+        if(nals.at(i).offset < skip) continue;
+        Nal_Add(out, out.frame_byte_cnt + nals.at(i).offset - skip, nals.at(i).len, nals.at(i).hdr);
+    }
+}
+
+//  一帧结束,写入该帧的NAL表
+void Nal_EndFrame(const SConvOutput& out)
+{
+    if(out.pfile_outvnal == 0) return;
+    std::vector<unsigned char> head;
+    Nal_PutVarint(head, NalFrameCnt);
+    fwrite(head.data(), 1, head.size(), out.pfile_outvnal);
+    if(NalFrameBuf.size() > 0) fwrite(NalFrameBuf.data(), 1, NalFrameBuf.size(), out.pfile_outvnal);
+    NalTotalCnt += NalFrameCnt;
+    NalFrameBuf.clear();
+    NalFrameCnt = 0;
+    NalFrameEnd = 0;
+}
+
+//  对齐后的帧长度
+int Conv_AlignSize(int size)
+{
+    if(AlignSize < 2) return size;
+    return (size + AlignSize - 1) / AlignSize * AlignSize;
+}
+
+//  信息文件头部中输出布局相关的扩展行
+void Conv_WriteLayoutInfo(FILE* pfile)
+{
+    if(AlignSize > 1) fprintf(pfile, "#ALIGN %d %s\r\n", AlignSize, PadFiller ? "filler" : "zero");
+    if(ffmpeg_context.codec == ECodec_H265) fprintf(pfile, "#CODEC h265\r\n");
+    if(AudMode)       fprintf(pfile, "#AUD\r\n");
+    if(OutFraming == EFraming_AVCC) fprintf(pfile, "#FRAMING avcc 4\r\n");
+}
+
+//  取得一个NAL的前缀,Annex-B时为开始代码,长度前缀格式时为4字节大端长度
+//  参数 nal_len 为NAL的长度(不含前缀)
+void Conv_GetNalPrefix(unsigned char* prefix, int nal_len)
+{
+    if(OutFraming == EFraming_AVCC) H264_PutNalLength(prefix, nal_len);
+    else                            memcpy(prefix, startcode, sizeof(startcode));
+}
+
+//  写入信息文件中的一帧
+//  参数 size 为该帧在H264文件中的长度(含填充)
+//  参数 payload 为有效数据长度,offset为该帧在H264文件中的偏移,对齐时使用
+void Conv_WriteIndexLine(FILE* pfile, int size, int payload, unsigned long long offset, unsigned int crc)
+{
+    if(AlignSize > 1) fprintf(pfile, "%d %d %llu", size, payload, offset);
+    else              fprintf(pfile, "%d", size);
+    if(CrcMode) fprintf(pfile, " %08x", crc);
+    fprintf(pfile, "\r\n");
+}
+
+//  每帧开始时插入AUD
+//  成功返回0,失败返回-3
+int Conv_WriteAud(SConvOutput& out)
+{
+    if(!AudMode || (out.frame_byte_cnt != 0)) return 0;
+    int header_len = 0;
+    int aud_len = 0;
+    Conv_GetHeaderLen(header_len, aud_len);
+    unsigned char aud[sizeof(audnal_h265)];
+    memcpy(aud, (aud_len == sizeof(audnal)) ? audnal : audnal_h265, aud_len);
+    Conv_GetNalPrefix(aud, aud_len - sizeof(startcode));
+    Nal_Add(out, out.frame_byte_cnt + sizeof(startcode), aud_len - sizeof(startcode), aud[sizeof(startcode)]);
+    if(Conv_OutWrite(out, aud, aud_len) != aud_len)
+    {
+        printf("[Error] AUD Write Error!!\r\n");
+        return -3;
+    }
+    out.frame_byte_cnt += aud_len;
+    return 0;
+}
+
+//  将当前帧填充到对齐字节数的整数倍
+//  填充长度不足一个填充数据NAL(前缀+头部+结束位)时填充零
+//  填充数据NAL的类型H264为12(头部0C),H265为38(头部4C 01)
+//  成功返回0,失败返回-3
+int Conv_WritePad(SConvOutput& out)
+{
+    static std::vector<unsigned char> pad_buf;
+    int pad = Conv_AlignSize(out.frame_byte_cnt) - out.frame_byte_cnt;
+    if(pad <= 0) return 0;
+    if((int)pad_buf.size() < pad) pad_buf.resize(pad);
+    int head_len = (ffmpeg_context.codec == ECodec_H265) ? 2 : 1;
+    if(PadFiller && (pad >= (int)sizeof(startcode) + head_len + 1))
+    {
+        Conv_GetNalPrefix(pad_buf.data(), pad - sizeof(startcode));
+        pad_buf[sizeof(startcode)] = (head_len == 2) ? 0x4C : 0x0C;
+        if(head_len == 2) pad_buf[sizeof(startcode) + 1] = 0x01;
+        memset(pad_buf.data() + sizeof(startcode) + head_len, 0xFF, pad - sizeof(startcode) - head_len - 1);
+        pad_buf[pad - 1] = 0x80;
+        Nal_Add(out, out.frame_byte_cnt + sizeof(startcode), pad - sizeof(startcode), pad_buf[sizeof(startcode)]);
+    }
+    else
+    {
+        memset(pad_buf.data(), 0, pad);
+    }
+    if(Conv_OutWrite(out, pad_buf.data(), pad) != pad)
+    {
+        printf("[Error] Pad Write Error!!\r\n");
+        return -3;
+    }
+    out.frame_byte_cnt += pad;
+    out.pad_cnt += pad;
+    return 0;
+}
+
+//  打印对齐填充的开销
+void Conv_PrintPadStat(const SConvOutput& out)
+{
+    printf("[Align] align=%d payload=%llu padded=%llu overhead=%.2f%%\r\n",
+           AlignSize, out.byte_cnt - out.pad_cnt, out.byte_cnt,
+           (out.byte_cnt > out.pad_cnt) ? (out.pad_cnt * 100.0 / (out.byte_cnt - out.pad_cnt)) : 0.0);
+}
+
+//  写入一个参数集,先写入开始代码(或长度前缀)再写入数据
+//  成功返回0,前缀写入失败返回1,数据写入失败返回2
+int Conv_WriteParamSet(SConvOutput& out, const unsigned char* pdat, int len, const char* name)
+{
+    unsigned char prefix[sizeof(startcode)];
+    Conv_GetNalPrefix(prefix, len);
+    Nal_Add(out, out.frame_byte_cnt + sizeof(prefix), len, pdat[0]);
+    int re = Conv_OutWrite(out, prefix, sizeof(prefix));
+    if(re != sizeof(prefix))
+    {
+        printf("[Error] %s StartCode Write Error!! in_byte=%ld, re=%d\r\n", name, sizeof(startcode), re);
+        return 1;
+    }
+    out.frame_byte_cnt += sizeof(startcode);
+
+    //  写入数据区
+    re = Conv_OutWrite(out, pdat, len);
+    if(re != len)
+    {
+        printf("[Error] %s Data Write Error!! in_byte=%d, re=%d\r\n", name, len, re);
+        return 2;
+    }
+    out.frame_byte_cnt += len;
+    return 0;
+}
+
+//  写入SPS和PPS,H265时在SPS之前写入VPS
+//  成功返回0,失败返回-4 ~ -7
+int Conv_WriteHeader(SConvOutput& out)
+{
+    int re = 0;
+
+    //  Annex-B格式的输入可能没有extradata,此时参数集在码流中
+    if((ffmpeg_context.sps_len <= 0) || (ffmpeg_context.pps_len <= 0))
+    {
+        printf("No SPS/PPS in extradata, use in-band parameter sets\r\n");
+        return 0;
+    }
+
+    //  AUD需要在参数集之前
+    if(Conv_WriteAud(out) != 0) return -4;
+
+    //  写入VPS,错误码与SPS相同
+#if DEBUG_LOG
+    printf("Begin Write VPS/SPS/PPS...\r\n");
+#endif  //  DEBUG_LOG
+    if(ffmpeg_context.vps_len > 0)
+    {
+        re = Conv_WriteParamSet(out, ffmpeg_context.vps_dat, ffmpeg_context.vps_len, "VPS");
+        if(re != 0) return -3 - re;
+    }
+
+    //  写入SPS
+    re = Conv_WriteParamSet(out, ffmpeg_context.sps_dat, ffmpeg_context.sps_len, "SPS");
+    if(re != 0) return -3 - re;
+
+    //  写入PPS
+    re = Conv_WriteParamSet(out, ffmpeg_context.pps_dat, ffmpeg_context.pps_len, "PPS");
+    if(re != 0) return -5 - re;
+
+    //  操作成功
+    return 0;
+}
+
+//  第一级: 读取一个需要输出的视频包
+//  成功返回0,文件结束或者出错返回小于0
+//  当读取失败时,pkt为空包
+int Conv_ReadVideoPacket(AVPacket* pkt)
+{
+    //  从断点继续时,第一个包是定位时已经读取的关键帧
+    if(ResumePkt != 0)
+    {
+        av_packet_move_ref(pkt, ResumePkt);
+        av_packet_free(&ResumePkt);
+        return 0;
+    }
+
+    //  恢复模式,从mdat中扫描
+    if(RecoverCtx.fd >= 0)
+    {
+        double recover_t0 = Trace_Begin();
+        int re = Recover_ReadPacket(pkt);
+        Trace_Add("read", recover_t0, pkt->size);
+        return re;
+    }
+
+    //  检索视频包
+    //  从视频文件中获取一个包
+#if DEBUG_LOG
+    printf("av_read_frame...\r\n");
+#endif  //  DEBUG_LOG
+    double trace_t0 = Trace_Begin();
+    while(av_read_frame(ffmpeg_context.p_fmt_ctx, pkt) >= 0)
+    {
+        Trace_Add("read", trace_t0, pkt->size);
+        trace_t0 = Trace_Begin();
+
+        //  当读取到一帧视频的时候，则跳出
+        if(pkt->stream_index == ffmpeg_context.v_idx)
+        {
+            //  找到了
+        #if 1
+            //  当为数据被破坏的包
+            if((pkt->flags & AV_PKT_FLAG_CORRUPT) != 0)
+            {
+                av_packet_unref(pkt);   //  丢弃
+            }
+            //  不安全的结构的包
+            else if((pkt->flags & AV_PKT_FLAG_DISCARD) != 0)
+            {
+                av_packet_unref(pkt);   //  丢弃
+            }
+            //  可能被解码器丢弃的包
+            else if((pkt->flags & AV_PKT_FLAG_DISPOSABLE) != 0)
+            {
+                //av_packet_unref(pkt);   //  丢弃
+                return 0;
+            }
+            //  正常的数据包
+            else
+            {
+                return 0;
+            }
+        #else
+            //  当为关键帧
+            if((pkt->flags & AV_PKT_FLAG_KEY) != 0)
+            {
+                return 0;
+            }
+            //  不为关键帧
+            else
+            {
+                av_packet_unref(pkt);   //  丢弃
+            }
+        #endif
+        }
+        else
+        {
+            av_packet_unref(pkt);
+        }
+    }
+
+    //  文件结束
+    av_packet_unref(pkt);
+    return -1;
+}
+
+//  打印SEI中的UUID
+//  参数 pdat 为以4字节开始代码(或长度前缀)开头的一个NAL
+template<class T>
+void Conv_PrintSEI(const unsigned char* pdat, int len)
+{
+    //  检查该帧中是否含有SEI信息,暂时只支持user_data_unregistered()语法
+#if DEBUG_LOG
+    printf("check sei...\r\n");
+#endif  //  DEBUG_LOG
+    int pay = sizeof(startcode) + T::nal_head_len;
+    if(len < pay + 2) return;
+    if(!T::IsSei(T::NalType(pdat + sizeof(startcode))) || (pdat[pay] != 0x05)) return;
+    int uuid_content_len = 0;
+    int head_len = SEI_ParsePayloadHead(pdat + pay, len - pay, uuid_content_len);
+    if(head_len < 0) return;
+    int uuid_offset = pay + head_len;
+
+    //  打印SEI的UUID,直接从包中打印,不复制到容器
+    printf("Video SEI Payload UUID:");
+    if(uuid_offset + 16 <= len) HexUUID_Dump(pdat + uuid_offset);
+    else printf("[Error] UUID len Error!!\r\n");
+
+    //  打印SEI的用户信息
+#if DEBUG_LOG
+    if((uuid_content_len > 16) && (uuid_offset + uuid_content_len <= len))
+    {
+        printf("Video SEI Payload Content:");
+        printf("%.*s\r\n", uuid_content_len - 16, (const char*)pdat + uuid_offset + 16);
+    }
+#endif  //  DEBUG_LOG
+}
+
+//  将Annex-B格式的包重新生成为4字节长度前缀格式
+template<class T>
+void Conv_RewriteToAVCC(AVPacket* pkt, std::vector<SNalEntry>* pnals)
+{
+    std::vector<int> nal_offset;
+    std::vector<int> nal_len;
+    int nal_cnt = H264_SplitAnnexB(pkt->data, pkt->size, nal_offset, nal_len);
+    int new_size = 0;
+    int i=0;
+    for(i=0;i<nal_cnt;i++) new_size += sizeof(startcode) + nal_len.at(i);
+    AVBufferRef* pbuf = Pool_GetBuffer(new_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if(pbuf == 0)
+    {
+        printf("[Error] Pool_GetBuffer()\r\n");
+        return;
+    }
+    memset(pbuf->data + new_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    int dst = 0;
+    for(i=0;i<nal_cnt;i++)
+    {
+        H264_PutNalLength(pbuf->data + dst, nal_len.at(i));
+        memcpy(pbuf->data + dst + sizeof(startcode), pkt->data + nal_offset.at(i), nal_len.at(i));
+        Conv_PrintSEI<T>(pbuf->data + dst, sizeof(startcode) + nal_len.at(i));
+        if(pnals != 0) Nal_Record(*pnals, pbuf->data, dst + sizeof(startcode), nal_len.at(i));
+        dst += sizeof(startcode) + nal_len.at(i);
+    }
+
+    //  用新生成的数据替换包的数据
+    av_buffer_unref(&pkt->buf);
+    pkt->buf = pbuf;
+    pkt->data = pbuf->data;
+    pkt->size = new_size;
+}
+
+//  第二级: 将包中的NAL前缀转换为输出封装格式
+//  输出为Annex-B时: Annex-B格式的包直接透传; AVCC格式逐个NAL替换,
+//  4字节长度前缀原地替换,1、2字节长度前缀需要重新生成包
+//  输出为长度前缀时: 4字节长度前缀的包不修改数据直接写出;
+//  1、2字节长度前缀扩展为4字节, Annex-B格式需要查找开始代码后重新生成包
+template<class T>
+void Conv_RewritePacketT(AVPacket* pkt, std::vector<SNalEntry>* pnals)
+{
+#if DEBUG_LOG
+    printf("memcpy startcode...\r\n");
+    printf("pkt->size = %d\r\n", pkt->size);
+#endif  //  DEBUG_LOG
+
+    //  用第一个包确认封装格式
+    if(!ffmpeg_context.framing_checked)
+    {
+        ffmpeg_context.framing_checked = true;
+        if((ffmpeg_context.framing == EFraming_AVCC) &&
+           !H264_CheckAVCC(pkt->data, pkt->size, ffmpeg_context.nal_length_size) &&
+           H264_HasStartCode(pkt->data, pkt->size))
+        {
+            printf("[Warning] Extradata is avcC but packets are Annex-B, use passthrough\r\n");
+            ffmpeg_context.framing = EFraming_AnnexB;
+        }
+        else if((ffmpeg_context.framing == EFraming_AnnexB) &&
+                !H264_HasStartCode(pkt->data, pkt->size) &&
+                H264_CheckAVCC(pkt->data, pkt->size, 4))
+        {
+            printf("[Warning] Packets are AVCC without avcC extradata, rewrite as 4 bytes length\r\n");
+            ffmpeg_context.framing = EFraming_AVCC;
+            ffmpeg_context.nal_length_size = 4;
+        }
+    }
+
+    //  Annex-B格式直接透传,生成NAL子索引时在这里拆分
+    if(ffmpeg_context.framing == EFraming_AnnexB)
+    {
+        if(OutFraming == EFraming_AVCC)
+        {
+            Conv_RewriteToAVCC<T>(pkt, pnals);
+        }
+        else if(pnals != 0)
+        {
+            std::vector<int> nal_offset;
+            std::vector<int> nal_len;
+            int nal_cnt = H264_SplitAnnexB(pkt->data, pkt->size, nal_offset, nal_len);
+            int i=0;
+            for(i=0;i<nal_cnt;i++) Nal_Record(*pnals, pkt->data, nal_offset.at(i), nal_len.at(i));
+        }
+        return;
+    }
+
+    int length_size = ffmpeg_context.nal_length_size;
+    int pos = 0;
+
+    //------------------------------------------------------------------
+    //  输出为长度前缀且输入为4字节长度前缀,只检查长度,不复制和修改数据
+    if((OutFraming == EFraming_AVCC) && (length_size == sizeof(startcode)))
+    {
+        while(pos + length_size <= pkt->size)
+        {
+            unsigned int nal_len = ((unsigned int)pkt->data[pos] << 24) | (pkt->data[pos + 1] << 16) |
+                                   (pkt->data[pos + 2] << 8) | pkt->data[pos + 3];
+            if(nal_len > (unsigned int)(pkt->size - pos - length_size))
+            {
+                printf("[Warning] Bad NAL length %u at %d in packet size %d\r\n", nal_len, pos, pkt->size);
+                break;
+            }
+            Conv_PrintSEI<T>(pkt->data + pos, length_size + nal_len);
+            if(pnals != 0) Nal_Record(*pnals, pkt->data, pos + length_size, nal_len);
+            pos += length_size + nal_len;
+        }
+        return;
+    }
+
+    //------------------------------------------------------------------
+    //  4字节长度前缀,原地替换为开始代码
+    //  包的数据可能被其他引用共享,修改前确保可写,1、2字节长度前缀会生成新的包,不需要
+    if(length_size == sizeof(startcode))
+    {
+        if(Pool_MakeWritable(pkt) < 0)
+        {
+            printf("[Error] Pool_MakeWritable()\r\n");
+            return;
+        }
+        while(pos + length_size <= pkt->size)
+        {
+            unsigned int nal_len = ((unsigned int)pkt->data[pos] << 24) | (pkt->data[pos + 1] << 16) |
+                                   (pkt->data[pos + 2] << 8) | pkt->data[pos + 3];
+            if(nal_len > (unsigned int)(pkt->size - pos - length_size))
+            {
+                printf("[Warning] Bad NAL length %u at %d in packet size %d\r\n", nal_len, pos, pkt->size);
+                break;
+            }
+
+            //  替换本数据流的开始代码
+            memcpy(pkt->data + pos, startcode, sizeof(startcode));
+            Conv_PrintSEI<T>(pkt->data + pos, length_size + nal_len);
+            if(pnals != 0) Nal_Record(*pnals, pkt->data, pos + length_size, nal_len);
+            pos += length_size + nal_len;
+        }
+        return;
+    }
+
+    //------------------------------------------------------------------
+    //  1、2字节长度前缀,统计NAL个数后重新生成包
+    int nal_cnt = 0;
+    while(pos + length_size <= pkt->size)
+    {
+        unsigned int nal_len = pkt->data[pos];
+        if(length_size == 2) nal_len = (nal_len << 8) | pkt->data[pos + 1];
+        if(nal_len > (unsigned int)(pkt->size - pos - length_size)) break;
+        pos += length_size + nal_len;
+        nal_cnt++;
+    }
+    int new_size = pos + nal_cnt * ((int)sizeof(startcode) - length_size);
+    AVBufferRef* pbuf = Pool_GetBuffer(new_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if(pbuf == 0)
+    {
+        printf("[Error] Pool_GetBuffer()\r\n");
+        return;
+    }
+    memset(pbuf->data + new_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    int src = 0;
+    int dst = 0;
+    int i=0;
+    for(i=0;i<nal_cnt;i++)
+    {
+        unsigned int nal_len = pkt->data[src];
+        if(length_size == 2) nal_len = (nal_len << 8) | pkt->data[src + 1];
+        src += length_size;
+        Conv_GetNalPrefix(pbuf->data + dst, nal_len);
+        memcpy(pbuf->data + dst + sizeof(startcode), pkt->data + src, nal_len);
+        Conv_PrintSEI<T>(pbuf->data + dst, sizeof(startcode) + nal_len);
+        if(pnals != 0) Nal_Record(*pnals, pbuf->data, dst + sizeof(startcode), nal_len);
+        src += nal_len;
+        dst += sizeof(startcode) + nal_len;
+    }
+
+    //  用新生成的数据替换包的数据
+    av_buffer_unref(&pkt->buf);
+    pkt->buf = pbuf;
+    pkt->data = pbuf->data;
+    pkt->size = new_size;
+}
+
+//  按当前文件的编码选择替换函数,每个包选择一次
+//  参数 pnals 不为0时记录替换后包中的每个NAL,由写入级生成NAL子索引,不需要NAL表时为0
+void Conv_RewritePacket(AVPacket* pkt, std::vector<SNalEntry>* pnals)
+{
+    if(pnals != 0) pnals->clear();
+    if(ffmpeg_context.codec == ECodec_H265) Conv_RewritePacketT<SH265Traits>(pkt, pnals);
+    else                                    Conv_RewritePacketT<SH264Traits>(pkt, pnals);
+}
+
+//  把输出同步到磁盘,在帧的边界调用
+//  先同步H264文件和NAL子索引再同步信息文件,信息文件中的帧总是已经在H264文件中
+//  成功返回0
+int Conv_SyncOutput(SConvOutput& out)
+{
+    double trace_t0 = Trace_Begin();
+    int re = 0;
+#if USE_IO_URING
+    if((out.p_uring != 0) && (Uring_Finish(out.p_uring) != 0)) re = -1;
+#endif  //  USE_IO_URING
+    if(out.pfile_outh264 != 0)
+    {
+        if((fflush(out.pfile_outh264) != 0) || (fdatasync(fileno(out.pfile_outh264)) != 0)) re = -1;
+    }
+    if((out.p_map != 0) && (msync(out.p_map, out.map_pos, MS_SYNC) != 0)) re = -1;
+    if(out.pfile_outvnal != 0)
+    {
+        if((fflush(out.pfile_outvnal) != 0) || (fdatasync(fileno(out.pfile_outvnal)) != 0)) re = -1;
+    }
+    if((fflush(out.pfile_outvinf) != 0) || (fdatasync(fileno(out.pfile_outvinf)) != 0)) re = -1;
+    Trace_Add("sync", trace_t0, out.byte_cnt);
+    return re;
+}
+
+//  跟随模式时定期把输出同步到磁盘
+//  成功返回0,同步失败返回-3
+int Follow_Sync(SConvOutput& out)
+{
+    double now = Pipe_NowMs();
+    if(now - FollowLastSyncMs < FollowSyncMs) return 0;
+    FollowLastSyncMs = now;
+    if(Conv_SyncOutput(out) != 0)
+    {
+        printf("[Error] Follow Sync Output Error!! %s\r\n", strerror(errno));
+        return -3;
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+//  断点相关函数
+
+//  取得输入文件的字节数和修改时间
+//  成功返回0
+int Ckpt_StatInput(std::string input_file, SCheckpoint& ckpt)
+{
+    struct stat st;
+    if(stat(input_file.c_str(), &st) != 0) return -1;
+    ckpt.input_size = st.st_size;
+    ckpt.input_mtime = st.st_mtime;
+    return 0;
+}
+
+//  决定已写入部分格式的选项: 封装格式、对齐、填充方式、AUD和CRC
+//  继续转换时需要一致,否则前后两部分的格式不同
+std::string Ckpt_GetLayout(void)
+{
+    char layout[64];
+    snprintf(layout, sizeof(layout), "%s %d %s %d %d", (OutFraming == EFraming_AVCC) ? "avcc" : "annexb",
+             (AlignSize > 1) ? AlignSize : 0, PadFiller ? "filler" : "zero", AudMode ? 1 : 0, CrcMode ? 1 : 0);
+    return layout;
+}
+
+//  在关键帧之前保存断点,此时上一帧已经完整写入
+//  先把输出同步到磁盘,再用临时文件改名的方式写入断点文件
+//  参数 pkt 为将要写入的关键帧
+void Ckpt_Save(SConvOutput& out, const AVPacket* pkt)
+{
+    double now = Pipe_NowMs();
+    if(now - CkptLastMs < CkptSec * 1000.0) return;
+    CkptLastMs = now;
+    if(Conv_SyncOutput(out) != 0)
+    {
+        printf("[Ckpt] Sync Output Error!! %s\r\n", strerror(errno));
+        return;
+    }
+
+    std::string tmp_name = CkptName + ".tmp";
+    FILE* pfile = fopen(tmp_name.c_str(), "wb");
+    if(pfile == 0)
+    {
+        printf("[Ckpt] Open Checkpoint File Error!! %s\r\n", tmp_name.c_str());
+        return;
+    }
+    fprintf(pfile, "#CKPT 2\r\n");
+    fprintf(pfile, "input %lld %lld\r\n", CkptInput.input_size, CkptInput.input_mtime);
+    fprintf(pfile, "layout %s\r\n", Ckpt_GetLayout().c_str());
+    fprintf(pfile, "frame %lu\r\n", out.frame_cnt);
+    fprintf(pfile, "h264 %llu\r\n", out.byte_cnt);
+    fprintf(pfile, "vinf %lld\r\n", (long long)ftello(out.pfile_outvinf));
+    fprintf(pfile, "vnal %lld\r\n", (out.pfile_outvnal != 0) ? (long long)ftello(out.pfile_outvnal) : -1LL);
+    fprintf(pfile, "pad %llu\r\n", out.pad_cnt);
+    fprintf(pfile, "nal %llu\r\n", NalTotalCnt);
+    fprintf(pfile, "dts %lld\r\n", (long long)pkt->dts);
+    fprintf(pfile, "pos %lld\r\n", (long long)pkt->pos);
+    bool ok = (fflush(pfile) == 0) && (fsync(fileno(pfile)) == 0);
+    if(fclose(pfile) != 0) ok = false;
+    if(!ok || (rename(tmp_name.c_str(), CkptName.c_str()) != 0))
+    {
+        printf("[Ckpt] Write Checkpoint File Error!! %s\r\n", CkptName.c_str());
+        remove(tmp_name.c_str());
+        return;
+    }
+    CkptSaveCnt++;
+}
+
+//  读取断点文件,并检查输入文件和输出格式是否变化
+//  成功返回0
+int Ckpt_Load(std::string name, SCheckpoint& ckpt)
+{
+    FILE* pfile = fopen(name.c_str(), "rb");
+    if(pfile == 0) return -1;
+    char line[256];
+    int field_cnt = 0;
+    if((fgets(line, sizeof(line), pfile) == 0) || (strncmp(line, "#CKPT 2", 7) != 0))
+    {
+        fclose(pfile);
+        return -1;
+    }
+    while(fgets(line, sizeof(line), pfile) != 0)
+    {
+        if(sscanf(line, "input %lld %lld", &ckpt.input_size, &ckpt.input_mtime) == 2) field_cnt++;
+        else if(sscanf(line, "layout %63[^\r\n]", ckpt.layout) == 1) field_cnt++;
+        else if(sscanf(line, "frame %lu", &ckpt.frame_cnt) == 1)      field_cnt++;
+        else if(sscanf(line, "h264 %llu", &ckpt.h264_bytes) == 1)     field_cnt++;
+        else if(sscanf(line, "vinf %lld", &ckpt.vinf_bytes) == 1)     field_cnt++;
+        else if(sscanf(line, "vnal %lld", &ckpt.vnal_bytes) == 1)     field_cnt++;
+        else if(sscanf(line, "pad %llu", &ckpt.pad_cnt) == 1)         field_cnt++;
+        else if(sscanf(line, "nal %llu", &ckpt.nal_cnt) == 1)         field_cnt++;
+        else if(sscanf(line, "dts %lld", &ckpt.dts) == 1)             field_cnt++;
+        else if(sscanf(line, "pos %lld", &ckpt.pos) == 1)             field_cnt++;
+    }
+    fclose(pfile);
+    if(field_cnt != 10) return -1;
+    if((ckpt.input_size != CkptInput.input_size) || (ckpt.input_mtime != CkptInput.input_mtime))
+    {
+        printf("[Resume] Input file changed since checkpoint\r\n");
+        return -1;
+    }
+    if(Ckpt_GetLayout() != ckpt.layout)
+    {
+        printf("[Resume] Output layout differs from checkpoint (%s, now %s)\r\n", ckpt.layout, Ckpt_GetLayout().c_str());
+        return -1;
+    }
+    if(NalIndexMode != (ckpt.vnal_bytes >= 0))
+    {
+        printf("[Resume] --nal-index differs from checkpoint\r\n");
+        return -1;
+    }
+    return 0;
+}
+
+//  定位到断点的关键帧,读取的该帧作为第一个输出的包
+//  成功返回0
+int Ckpt_Seek(const SCheckpoint& ckpt)
+{
+    if(av_seek_frame(ffmpeg_context.p_fmt_ctx, ffmpeg_context.v_idx, ckpt.dts, AVSEEK_FLAG_BACKWARD) < 0) return -1;
+    AVPacket* pkt = av_packet_alloc();
+    while(Conv_ReadVideoPacket(pkt) == 0)
+    {
+        if((pkt->dts == AV_NOPTS_VALUE) || (pkt->dts < ckpt.dts))
+        {
+            av_packet_unref(pkt);
+            continue;
+        }
+        if((pkt->dts == ckpt.dts) && ((pkt->flags & AV_PKT_FLAG_KEY) != 0) &&
+           ((ckpt.pos < 0) || (pkt->pos < 0) || (pkt->pos == ckpt.pos)))
+        {
+            ResumePkt = pkt;
+            return 0;
+        }
+        break;
+    }
+    av_packet_free(&pkt);
+    return -1;
+}
+
+//  打开已有的输出文件并截断到断点
+//  成功返回文件指针,文件比断点短时返回0
+FILE* Ckpt_OpenTruncate(std::string name, long long size)
+{
+    FILE* pfile = fopen(name.c_str(), "r+b");
+    if(pfile == 0) return 0;
+    struct stat st;
+    if((fstat(fileno(pfile), &st) != 0) || (st.st_size < size) ||
+       (ftruncate(fileno(pfile), (off_t)size) != 0) || (fseeko(pfile, 0, SEEK_END) != 0))
+    {
+        fclose(pfile);
+        return 0;
+    }
+    return pfile;
+}
+
+//  第三级: 将一帧写入H264码流文件,并将本帧长度记录到信息文件
+//  参数 nals 为替换时记录的NAL表,生成NAL子索引时使用
+//  成功返回0,写入失败返回-3
+int Conv_WritePacket(SConvOutput& out, AVPacket* pkt, const std::vector<SNalEntry>& nals)
+{
+    //  保存h264码流
+#if DEBUG_LOG
+    printf("fwrite...\r\n");
+#endif  //  DEBUG_LOG
+    int re = 0;
+    if((StreamFd >= 0) || (RtpCtx.fd >= 0)) Stream_Pace(pkt);
+    if((CkptName != "") && (out.frame_byte_cnt == 0) && ((pkt->flags & AV_PKT_FLAG_KEY) != 0) &&
+       (pkt->dts != AV_NOPTS_VALUE))
+    {
+        Ckpt_Save(out, pkt);
+    }
+
+    //  码流中已经有AUD时不再插入
+    //  第一帧的AUD已经写在参数集之前,去掉包中的AUD,避免参数集之后再出现AUD
+    int inband_aud = 0;
+    int skip = 0;
+    if(AudMode) inband_aud = Codec_GetLeadingAud(pkt->data, pkt->size, (OutFraming == EFraming_AVCC) ? sizeof(startcode) : 0);
+    if((inband_aud > 0) && (out.frame_byte_cnt != 0))
+    {
+        skip = inband_aud;
+        pkt->data += skip;
+        pkt->size -= skip;
+    }
+    else if((inband_aud == 0) && (Conv_WriteAud(out) != 0))
+    {
+        return -3;
+    }
+    if(RtpCtx.fd >= 0)
+    {
+        if(CrcMode) out.frame_crc = Crc32c(out.frame_crc, pkt->data, pkt->size);
+        re = Rtp_SendFrame(pkt, out.frame_cnt);
+    }
+    else
+    {
+        re = Conv_OutWrite(out, pkt->data, pkt->size);
+    }
+
+    //  检查文件是否写入成功
+    //  当写入失败
+    if(re != pkt->size)
+    {
+        printf("[Error] H264 Output Video File Write Error!! in_byte=%d, re=%d\r\n", pkt->size, re);
+        return -3;
+    }
+    Nal_AddPacket(out, nals, skip);
+    out.frame_byte_cnt += pkt->size;
+
+    //  对齐填充
+    int payload = out.frame_byte_cnt;
+    if(Conv_WritePad(out) != 0) return -3;
+    unsigned long long offset = out.byte_cnt;
+    out.byte_cnt += out.frame_byte_cnt;
+    if(AnalyzeName != "") Analyze_AddFrame(FileAnalyze, out.frame_byte_cnt, pkt);
+
+    //  将本次写入的尺寸统计到信息文件中
+    Conv_WriteIndexLine(out.pfile_outvinf, out.frame_byte_cnt, payload, offset, out.frame_crc);
+    Nal_EndFrame(out);
+    out.frame_byte_cnt = 0;
+    out.frame_crc = 0;
+
+    //  统计一帧
+#if DEBUG_LOG
+    printf("frame = %ld...\r\n", out.frame_cnt);
+#endif  //  DEBUG_LOG
+    out.frame_cnt++;
+    if(FollowMode && (Follow_Sync(out) != 0)) return -3;
+
+    //  操作成功
+    return 0;
+}
+
+//  串行模式,三级在当前线程依次执行
+//  成功返回0,写入失败返回-3
+int Conv_RunSerial(SConvOutput& out)
+{
+    //  分配原始文件流packet的缓存
+    AVPacket *pkt = av_packet_alloc();
+    std::vector<SNalEntry> nals;
+
+    //------------------------------------------------------------------
+    //  循环写入每一帧的码流
+    //  开始循环抓取每一帧
+#if DEBUG_LOG
+    printf("Begin while(1)...\r\n");
+#endif  //  DEBUG_LOG
+    int re = 0;
+    while(1)
+    {
+        //  读取视频包,当文件结束或者包长度不足的时候跳出
+        Conv_ReadVideoPacket(pkt);
+        if(pkt->size < (int)sizeof(startcode))
+        {
+            //ffmpeg_context.TotalFrame--;      //  少一帧
+            av_packet_unref(pkt);    //  跳出
+            break;
+        }
+
+        //  替换开始代码并写入
+        double trace_t0 = Trace_Begin();
+        Conv_RewritePacket(pkt, NalIndexMode ? &nals : 0);
+        Trace_Add("rewrite", trace_t0, pkt->size);
+        trace_t0 = Trace_Begin();
+        re = Conv_WritePacket(out, pkt, nals);
+        Trace_Add("write", trace_t0, pkt->size);
+        av_packet_unref(pkt);
+        if(re != 0) break;
+
+        //  当达到视频末尾(总帧数未知时读取到文件结束)
+        if((ffmpeg_context.TotalFrame > 0) && (out.frame_cnt - out.clip_start >= ffmpeg_context.TotalFrame)) break;
+    }
+
+    //  释放包
+    av_packet_free(&pkt);
+    return re;
+}
+
+//---------------------------------------------------------------------
+//  流水线模式相关函数
+//  读取线程 -> [环形队列] -> 替换线程 -> [环形队列] -> 写入(当前线程)
+//  队列满时上游等待,实现反压; 队列中的空指针表示数据流结束
+//  队列中传递SConvPacket,替换时记录的NAL表与包一起传给写入级
+//  写入后的包结构体通过另一个环形队列还给读取线程重复使用
+
+//  当前时刻,单位毫秒
+double Pipe_NowMs(void)
+{
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//  分配在各级之间传递的包
+SConvPacket* ConvPkt_Alloc(void)
+{
+    SConvPacket* pcpkt = new SConvPacket;
+    pcpkt->pkt = av_packet_alloc();
+    return pcpkt;
+}
+
+//  释放在各级之间传递的包
+void ConvPkt_Free(SConvPacket*& pcpkt)
+{
+    if(pcpkt == 0) return;
+    av_packet_free(&pcpkt->pkt);
+    delete pcpkt;
+    pcpkt = 0;
+}
+
+//  阻塞压入,等待的时间统计到wait_out_ms,被中止时返回false
+bool Pipe_Push(CSpscRing<SConvPacket*>& ring, SConvPacket* pkt,
+                      SPipeStageStat& stat, std::atomic<bool>& abort_flag)
+{
+    stat.occ_sum += ring.Size();
+    stat.occ_samples++;
+    if(ring.TryPush(pkt)) return true;
+
+    //  队列已满,先自旋再让出CPU
+    double t0 = Pipe_NowMs();
+    int spin = 0;
+    while(!ring.TryPush(pkt))
+    {
+        if(abort_flag.load(std::memory_order_relaxed))
+        {
+            stat.wait_out_ms += Pipe_NowMs() - t0;
+            return false;
+        }
+        if(spin < 64) spin++;
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    stat.wait_out_ms += Pipe_NowMs() - t0;
+    return true;
+}
+
+//  阻塞弹出,等待的时间统计到wait_in_ms,被中止时返回false
+bool Pipe_Pop(CSpscRing<SConvPacket*>& ring, SConvPacket*& pkt,
+                     SPipeStageStat& stat, std::atomic<bool>& abort_flag)
+{
+    if(ring.TryPop(pkt)) return true;
+
+    //  队列为空,先自旋再让出CPU
+    double t0 = Pipe_NowMs();
+    int spin = 0;
+    while(!ring.TryPop(pkt))
+    {
+        if(abort_flag.load(std::memory_order_relaxed))
+        {
+            stat.wait_in_ms += Pipe_NowMs() - t0;
+            return false;
+        }
+        if(spin < 64) spin++;
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    stat.wait_in_ms += Pipe_NowMs() - t0;
+    return true;
+}
+
+//  释放队列中剩余的包
+void Pipe_Drain(CSpscRing<SConvPacket*>& ring)
+{
+    SConvPacket* pcpkt = 0;
+    while(ring.TryPop(pcpkt))
+    {
+        ConvPkt_Free(pcpkt);
+    }
+}
+
+//  打印流水线各级统计信息
+void Pipe_PrintStat(const char* name, const SPipeStageStat& stat, int capacity)
+{
+    double occ = 0.0;
+    if((stat.occ_samples > 0) && (capacity > 0))
+    {
+        occ = (stat.occ_sum * 100.0) / (stat.occ_samples * (double)capacity);
+    }
+    printf("    %-8s busy=%.1fms wait_in=%.1fms wait_out=%.1fms",
+           name, stat.busy_ms, stat.wait_in_ms, stat.wait_out_ms);
+    if(capacity > 0) printf(" out_queue_occupancy=%.1f%%", occ);
+    printf("\r\n");
+}
+
+//  流水线模式
+//  成功返回0,写入失败返回-3
+int Conv_RunPipeline(SConvOutput& out)
+{
+    CSpscRing<SConvPacket*> read_ring(PipelineDepth);      //  读取 -> 替换
+    CSpscRing<SConvPacket*> write_ring(PipelineDepth);     //  替换 -> 写入
+    CSpscRing<SConvPacket*> free_ring(PipelineDepth * 2 + 4);  //  写入 -> 读取,用过的包
+    std::atomic<bool> abort_flag(false);
+    SPipeStageStat read_stat, rewrite_stat, write_stat;
+    memset(&read_stat, 0, sizeof(read_stat));
+    memset(&rewrite_stat, 0, sizeof(rewrite_stat));
+    memset(&write_stat, 0, sizeof(write_stat));
+
+    //  读取线程
+    std::thread read_thread([&]()
+    {
+        Trace_ThreadName("read");
+        unsigned long read_cnt = 0UL;
+        while(!abort_flag.load(std::memory_order_relaxed))
+        {
+            //  超过内存预算时等待下游写出
+            Pool_WaitBudget(abort_flag);
+
+            double t0 = Pipe_NowMs();
+            SConvPacket* pcpkt = 0;
+            if(free_ring.TryPop(pcpkt))
+            {
+                BufPool.pkt_reuse++;
+            }
+            else
+            {
+                pcpkt = ConvPkt_Alloc();
+                BufPool.pkt_allocs++;
+            }
+            Conv_ReadVideoPacket(pcpkt->pkt);
+            read_stat.busy_ms += Pipe_NowMs() - t0;
+
+            //  文件结束或者包长度不足
+            if(pcpkt->pkt->size < (int)sizeof(startcode))
+            {
+                ConvPkt_Free(pcpkt);
+                break;
+            }
+            Pool_AddInflight(pcpkt->pkt->size);
+            if(!Pipe_Push(read_ring, pcpkt, read_stat, abort_flag))
+            {
+                ConvPkt_Free(pcpkt);
+                break;
+            }
+
+            //  当达到视频末尾(总帧数未知时读取到文件结束)
+            read_cnt++;
+            if((ffmpeg_context.TotalFrame > 0) && (read_cnt >= ffmpeg_context.TotalFrame)) break;
+        }
+        Pipe_Push(read_ring, 0, read_stat, abort_flag);
+    });
+
+    //  替换线程
+    std::thread rewrite_thread([&]()
+    {
+        Trace_ThreadName("rewrite");
+        SConvPacket* pcpkt = 0;
+        while(Pipe_Pop(read_ring, pcpkt, rewrite_stat, abort_flag))
+        {
+            if(pcpkt != 0)
+            {
+                double t0 = Pipe_NowMs();
+                int old_size = pcpkt->pkt->size;
+                Conv_RewritePacket(pcpkt->pkt, NalIndexMode ? &pcpkt->nals : 0);
+                rewrite_stat.busy_ms += Pipe_NowMs() - t0;
+                Pool_AddInflight(pcpkt->pkt->size - old_size);
+                Trace_Add("rewrite", t0, pcpkt->pkt->size);
+            }
+            if(!Pipe_Push(write_ring, pcpkt, rewrite_stat, abort_flag))
+            {
+                ConvPkt_Free(pcpkt);
+                break;
+            }
+            if(pcpkt == 0) break;
+        }
+    });
+
+    //  写入在当前线程执行
+    int re = 0;
+    SConvPacket* pcpkt = 0;
+    while(Pipe_Pop(write_ring, pcpkt, write_stat, abort_flag))
+    {
+        if(pcpkt == 0) break;
+        double t0 = Pipe_NowMs();
+        re = Conv_WritePacket(out, pcpkt->pkt, pcpkt->nals);
+        write_stat.busy_ms += Pipe_NowMs() - t0;
+        Trace_Add("write", t0, pcpkt->pkt->size);
+        Pool_AddInflight(-pcpkt->pkt->size);
+        av_packet_unref(pcpkt->pkt);
+        if(!free_ring.TryPush(pcpkt)) ConvPkt_Free(pcpkt);
+        if(re != 0)
+        {
+            abort_flag.store(true);
+            break;
+        }
+    }
+
+    //  等待线程结束并释放剩余的包
+    read_thread.join();
+    rewrite_thread.join();
+    Pipe_Drain(read_ring);
+    Pipe_Drain(write_ring);
+    Pipe_Drain(free_ring);
+    BufPool.inflight = 0LL;
+
+    //  打印各级统计,输出队列占用率高说明下游是瓶颈,输入等待时间长说明上游是瓶颈
+    printf("Pipeline Stat (queue depth %d):\r\n", read_ring.Capacity());
+    Pipe_PrintStat("read", read_stat, read_ring.Capacity());
+    Pipe_PrintStat("rewrite", rewrite_stat, write_ring.Capacity());
+    Pipe_PrintStat("write", write_stat, 0);
+    const char* bottleneck = "read";
+    double max_busy = read_stat.busy_ms;
+    if(rewrite_stat.busy_ms > max_busy) { max_busy = rewrite_stat.busy_ms; bottleneck = "rewrite"; }
+    if(write_stat.busy_ms > max_busy)   { max_busy = write_stat.busy_ms;   bottleneck = "write"; }
+    printf("    bottleneck stage: %s\r\n", bottleneck);
+
+    return re;
+}
+
+//---------------------------------------------------------------------
+//  单文件分段并行相关函数
+//  按采样表在关键帧处分段,每段一个线程、一个解封装上下文,
+//  输出长度与采样大小相同,所以每帧在H264文件中的偏移可以预先算出
+
+//  用第一个采样确认封装格式,与Conv_RewritePacket()中的检查相同
+//  成功返回0
+int Split_CheckFraming(std::string input_file, const SSplitFrame& frame)
+{
+    if(ffmpeg_context.framing_checked) return 0;
+    int fd = open(input_file.c_str(), O_RDONLY);
+    if(fd < 0) return -1;
+    AVPacket* pkt = av_packet_alloc();
+    int re = -1;
+    if((pkt != 0) && (av_new_packet(pkt, frame.size) == 0) &&
+       (pread(fd, pkt->data, frame.size, frame.pos) == frame.size))
+    {
+        Conv_RewritePacket(pkt, 0);
+        re = 0;
+    }
+    av_packet_free(&pkt);
+    close(fd);
+    return re;
+}
+
+//  读取视频流的采样表,并按采样大小计算每帧在输出数据区中的偏移
+//  采样表完整时返回0,没有或不完整(如只有关键帧的索引)时返回-1
+int Conv_LoadSampleTable(std::vector<SSplitFrame>& frames)
+{
+    frames.clear();
+    AVStream* st = ffmpeg_context.p_fmt_ctx->streams[ffmpeg_context.v_idx];
+    int cnt = FFMpeg_GetIndexCount(st);
+    int i=0;
+    for(i=0;i<cnt;i++)
+    {
+        const AVIndexEntry* pentry = FFMpeg_GetIndexEntry(st, i);
+        if(pentry == 0) return -1;
+        if((pentry->flags & AVINDEX_DISCARD_FRAME) != 0) continue;
+        SSplitFrame frame;
+        frame.pos = pentry->pos;
+        frame.ts = pentry->timestamp;
+        frame.offset = 0LL;
+        frame.size = pentry->size;
+        frame.key = ((pentry->flags & AVINDEX_KEYFRAME) != 0);
+        frame.crc = 0;
+        frame.type = 3;
+        frames.push_back(frame);
+    }
+    if((ffmpeg_context.TotalFrame > 0) && (frames.size() > ffmpeg_context.TotalFrame))
+    {
+        frames.resize(ffmpeg_context.TotalFrame);
+    }
+
+    int n = frames.size();
+    if((n == 0) || ((st->nb_frames > 0) && (n < st->nb_frames))) return -1;
+
+    //  输出偏移
+    long long offset = 0LL;
+    for(i=0;i<n;i++)
+    {
+        frames.at(i).offset = offset;
+        offset += frames.at(i).size;
+    }
+    return 0;
+}
+
+//  根据采样表生成分段
+//  可以分段返回0,否则返回-1
+int Split_Plan(std::string input_file, std::vector<SSplitFrame>& frames, std::vector<SSplitRange>& ranges)
+{
+    //  采样表不完整时不能分段,对齐和插入AUD时输出长度与采样大小不同
+    //  各段在工作线程中写入,没有NAL子索引
+    if((AlignSize > 1) || AudMode || NalIndexMode) return -1;
+    if(Conv_LoadSampleTable(frames) != 0) return -1;
+    int n = frames.size();
+    if(n < SplitCount * 2) return -1;
+
+    //  输出长度必须与输入相同
+    if(Split_CheckFraming(input_file, frames.at(0)) != 0) return -1;
+    if((ffmpeg_context.framing == EFraming_AVCC) && (ffmpeg_context.nal_length_size != (int)sizeof(startcode))) return -1;
+    if((ffmpeg_context.framing == EFraming_AnnexB) && (OutFraming == EFraming_AVCC)) return -1;
+
+    //  均分后向后对齐到关键帧
+    int start = 0;
+    int k=0;
+    for(k=1;k<=SplitCount;k++)
+    {
+        int target = (k == SplitCount) ? n : (int)((long long)n * k / SplitCount);
+        while((target < n) && !frames.at(target).key) target++;
+        if(target <= start) continue;
+        SSplitRange range;
+        range.first = start;
+        range.last = target;
+        range.code = 0;
+        range.ms = 0.0;
+        ranges.push_back(range);
+        start = target;
+    }
+    return (ranges.size() >= 2) ? 0 : -1;
+}
+
+//  用pwrite写入全部数据
+//  成功返回0
+int Split_PWriteAll(int fd, const unsigned char* pdat, int len, long long offset)
+{
+    int done = 0;
+    while(done < len)
+    {
+        ssize_t n = pwrite(fd, pdat + done, len - done, (off_t)(offset + done));
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+//  转换一段,在工作线程中执行
+//  参数 pmap 不为0时写入内存映射,否则用pwrite写入fd
+//  参数 base 为数据区在H264文件中的起始位置
+//  参数 header_crc 为SPS、PPS的CRC32C,第一帧的CRC32C包含这部分
+void Split_RunRange(std::string input_file, SSplitRange& range, std::vector<SSplitFrame>& frames,
+                    unsigned char* pmap, int fd, long long base, unsigned int header_crc,
+                    std::atomic<bool>& abort_flag)
+{
+    double t0 = Pipe_NowMs();
+    range.code = -1;
+    Trace_ThreadName("split");
+
+    //  独立的解封装上下文
+    AVFormatContext* p_fmt_ctx = 0;
+    int open_re = avformat_open_input(&p_fmt_ctx, input_file.c_str(), NULL, NULL);
+    Trace_Add("open", t0, 0);
+    if(open_re != 0)
+    {
+        printf("[Split] avformat_open_input() Error!!\r\n");
+        abort_flag = true;
+        return;
+    }
+
+    //  定位到起始关键帧
+    int v_idx = ffmpeg_context.v_idx;
+    if((range.first > 0) &&
+       (av_seek_frame(p_fmt_ctx, v_idx, frames.at(range.first).ts, AVSEEK_FLAG_BACKWARD) < 0))
+    {
+        printf("[Split] av_seek_frame() Error!!\r\n");
+        avformat_close_input(&p_fmt_ctx);
+        abort_flag = true;
+        return;
+    }
+
+    AVPacket* pkt = av_packet_alloc();
+    range.code = 0;
+    int i = range.first;
+    while((i < range.last) && !abort_flag)
+    {
+        double trace_t0 = Trace_Begin();
+        if(av_read_frame(p_fmt_ctx, pkt) < 0)
+        {
+            range.code = -1;
+            break;
+        }
+        Trace_Add("read", trace_t0, pkt->size);
+        if(pkt->stream_index != v_idx)
+        {
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        //  读到的包必须与采样表一致,否则偏移不正确
+        SSplitFrame& frame = frames.at(i);
+        if(((pkt->pos >= 0) && (pkt->pos != frame.pos)) || (pkt->size != frame.size) ||
+           ((pkt->flags & (AV_PKT_FLAG_CORRUPT | AV_PKT_FLAG_DISCARD)) != 0))
+        {
+            range.code = -1;
+            av_packet_unref(pkt);
+            break;
+        }
+
+        //  替换开始代码并写入预先计算的位置
+        trace_t0 = Trace_Begin();
+        Conv_RewritePacket(pkt, 0);
+        Trace_Add("rewrite", trace_t0, pkt->size);
+        if(pkt->size != frame.size)
+        {
+            range.code = -1;
+            av_packet_unref(pkt);
+            break;
+        }
+        trace_t0 = Trace_Begin();
+        if(pmap != 0)
+        {
+            memcpy(pmap + base + frame.offset, pkt->data, pkt->size);
+        }
+        else if(Split_PWriteAll(fd, pkt->data, pkt->size, base + frame.offset) != 0)
+        {
+            printf("[Split] pwrite() Error!! %s\r\n", strerror(errno));
+            range.code = -3;
+            av_packet_unref(pkt);
+            break;
+        }
+        Trace_Add("write", trace_t0, pkt->size);
+        if(CrcMode) frame.crc = Crc32c((i == 0) ? header_crc : 0, pkt->data, pkt->size);
+        if(AnalyzeName != "") frame.type = Codec_GetSliceType(pkt->data, pkt->size, OutFraming);
+        av_packet_unref(pkt);
+        i++;
+    }
+    if(range.code != 0) abort_flag = true;
+
+    av_packet_free(&pkt);
+    avformat_close_input(&p_fmt_ctx);
+    range.ms = Pipe_NowMs() - t0;
+}
+
+//  分段并行模式
+//  成功返回0,写入失败返回-3,不能分段时返回1(此时输出没有变化,调用者改用其他方式)
+int Conv_RunSplit(SConvOutput& out, std::string input_file)
+{
+    std::vector<SSplitFrame> frames;
+    std::vector<SSplitRange> ranges;
+    if(Split_Plan(input_file, frames, ranges) != 0)
+    {
+        printf("[Split] Can not split this file by sample table, use normal mode\r\n");
+        return 1;
+    }
+
+    //  输出位置,SPS和PPS已经写入
+    SSplitFrame& last = frames.at(frames.size() - 1);
+    long long total = last.offset + last.size;
+    long long base = 0LL;
+    int fd = -1;
+    if(out.p_map != 0)
+    {
+        base = out.map_pos;
+        if(Mmap_Ensure(out, base + total) != 0)
+        {
+            printf("[Split] Mmap Resize Error!!\r\n");
+            return -3;
+        }
+    }
+    else
+    {
+        fflush(out.pfile_outh264);
+        fd = fileno(out.pfile_outh264);
+        base = ftello(out.pfile_outh264);
+    }
+
+    //  每段一个线程
+    double t0 = Pipe_NowMs();
+    std::atomic<bool> abort_flag(false);
+    std::vector<std::thread> workers;
+    size_t k=0;
+    for(k=0;k<ranges.size();k++)
+    {
+        workers.push_back(std::thread([&, k]()
+        {
+            Split_RunRange(input_file, ranges.at(k), frames, out.p_map, fd, base, out.frame_crc, abort_flag);
+        }));
+    }
+    for(k=0;k<workers.size();k++)
+    {
+        workers.at(k).join();
+    }
+
+    //  检查结果
+    int re = 0;
+    for(k=0;k<ranges.size();k++)
+    {
+        const SSplitRange& range = ranges.at(k);
+        printf("[Split] Range %d: frames %d~%d %.1fms code=%d\r\n",
+               (int)k, range.first, range.last - 1, range.ms, range.code);
+        if(range.code == -3) re = -3;
+        else if((range.code != 0) && (re == 0)) re = 1;
+    }
+    if(re == -3) return -3;
+
+    //  与采样表不一致,丢弃已写入的数据
+    if(re != 0)
+    {
+        printf("[Split] Packets do not match sample table, use normal mode\r\n");
+        if(out.p_map == 0)
+        {
+            if(ftruncate(fd, (off_t)base) != 0) return -3;
+            fseeko(out.pfile_outh264, base, SEEK_SET);
+        }
+        return 1;
+    }
+    if(out.p_map != 0) out.map_pos = base + total;
+    else               fseeko(out.pfile_outh264, base + total, SEEK_SET);
+
+    //  合并信息文件
+    size_t i=0;
+    for(i=0;i<frames.size();i++)
+    {
+        const SSplitFrame& frame = frames.at(i);
+        out.frame_byte_cnt += frame.size;
+        unsigned long long offset = out.byte_cnt;
+        out.byte_cnt += out.frame_byte_cnt;
+        if(AnalyzeName != "") Analyze_AddFrameInfo(FileAnalyze, out.frame_byte_cnt, frame.key, frame.type);
+        Conv_WriteIndexLine(out.pfile_outvinf, out.frame_byte_cnt, out.frame_byte_cnt, offset, frame.crc);
+        out.frame_byte_cnt = 0;
+        out.frame_crc = 0;
+        out.frame_cnt++;
+    }
+    printf("[Split] ranges=%d frames=%lu %.1fms\r\n", (int)ranges.size(), out.frame_cnt, Pipe_NowMs() - t0);
+    return 0;
+}
+
+//---------------------------------------------------------------------
+//  预演模式相关函数
+
+//  只根据采样表生成信息文件和预演文件,不读取视频数据,不生成H264文件
+//  成功返回0,写入失败返回-3,没有完整的采样表返回-15
+int Conv_DryRun(std::string input_file, SConvResult& result)
+{
+    //  转码时输出的帧大小与源文件无关,无法预演
+    if(ffmpeg_context.transcode)
+    {
+        printf("[DryRun] Transcoded output can not be planned!!\r\n");
+        return -15;
+    }
+
+    //  没有读取视频数据,无法给出每帧的CRC32C
+    if(CrcMode)
+    {
+        printf("[DryRun] CRC32C can not be computed without reading frames!!\r\n");
+        return -15;
+    }
+    std::vector<SSplitFrame> frames;
+    if(Conv_LoadSampleTable(frames) != 0)
+    {
+        printf("[DryRun] No complete sample table!!\r\n");
+        return -15;
+    }
+    int n = frames.size();
+    AVStream* st = ffmpeg_context.p_fmt_ctx->streams[ffmpeg_context.v_idx];
+
+    //  没有搜索流信息时容器可能没有给出平均帧率,用时间戳计算
+    if(!(ffmpeg_context.FrameRate > 0.0f) && (n > 1) && (frames.at(n - 1).ts > frames.at(0).ts))
+    {
+        ffmpeg_context.FrameRate = (float)((n - 1) / ((frames.at(n - 1).ts - frames.at(0).ts) * av_q2d(st->time_base)));
+    }
+
+    //  1、2字节长度前缀时每个NAL会变长,Annex-B转换为长度前缀时3字节开始代码会变长,无法精确计算
+    bool exact = !((ffmpeg_context.framing == EFraming_AVCC) &&
+                   (ffmpeg_context.nal_length_size != (int)sizeof(startcode))) &&
+                 !((ffmpeg_context.framing == EFraming_AnnexB) && (OutFraming == EFraming_AVCC));
+    int header_len = 0;
+    int aud_len = 0;
+    Conv_GetHeaderLen(header_len, aud_len);
+
+    //  开启--aud时只读取第一个视频包,码流中已经有AUD时不再插入,
+    //  第一帧的AUD移到参数集之前,长度按插入的AUD计算
+    if(aud_len > 0)
+    {
+        AVPacket* pkt = av_packet_alloc();
+        if(Conv_ReadVideoPacket(pkt) == 0)
+        {
+            int length_size = (ffmpeg_context.framing == EFraming_AVCC) ? ffmpeg_context.nal_length_size : 0;
+            int inband_aud = Codec_GetLeadingAud(pkt->data, pkt->size, length_size);
+            if(inband_aud > 0)
+            {
+                if(header_len > 0) header_len += aud_len - inband_aud;
+                aud_len = 0;
+            }
+        }
+        av_packet_free(&pkt);
+    }
+
+    //  每帧在H264文件中的长度,第一帧包含参数集,插入AUD和对齐时相应增加
+    std::vector<int> payload(n);
+    long long h264_size = 0LL;
+    int i=0;
+    for(i=0;i<n;i++)
+    {
+        payload.at(i) = frames.at(i).size + ((i == 0) ? header_len : 0) + aud_len;
+        h264_size += Conv_AlignSize(payload.at(i));
+    }
+
+    //  信息文件,与实际转换生成的相同,已经存在时不覆盖,只生成计划文件
+    std::string vinf_name = Conv_GetOutputName(input_file, ".vinf");
+    std::string plan_name = Conv_GetOutputName(input_file, ".plan");
+    FILE* pfile_vinf = 0;
+    if(access(vinf_name.c_str(), F_OK) == 0)
+    {
+        printf("[DryRun] %s exists, write .plan only\r\n", vinf_name.c_str());
+    }
+    else
+    {
+        pfile_vinf = fopen(vinf_name.c_str(), "wb");
+        if(pfile_vinf == 0)
+        {
+            printf("[Error] Open Dry Run Output Error!! %s\r\n", vinf_name.c_str());
+            return -3;
+        }
+    }
+    FILE* pfile_plan = fopen(plan_name.c_str(), "wb");
+    if(pfile_plan == 0)
+    {
+        printf("[Error] Open Dry Run Output Error!! %s\r\n", plan_name.c_str());
+        if(pfile_vinf != 0) fclose(pfile_vinf);
+        return -3;
+    }
+    if(pfile_vinf != 0)
+    {
+        fprintf(pfile_vinf, "%d %d %0.1f %d\r\n",
+                ffmpeg_context.Width,
+                ffmpeg_context.Height,
+                ffmpeg_context.FrameRate,
+                n
+               );
+        H264_WriteSpsInfo(pfile_vinf);
+        Conv_WriteLayoutInfo(pfile_vinf);
+    }
+    fprintf(pfile_plan, "#DRYRUN %lld %d %d\r\n", h264_size, n, exact ? 1 : 0);
+
+    //  每一帧
+    long long offset = 0LL;
+    for(i=0;i<n;i++)
+    {
+        const SSplitFrame& frame = frames.at(i);
+        int size = Conv_AlignSize(payload.at(i));
+        if(pfile_vinf != 0) Conv_WriteIndexLine(pfile_vinf, size, payload.at(i), offset, 0);
+        fprintf(pfile_plan, "%lld %d %d %.3f\r\n", offset, size, frame.key ? 1 : 0,
+                frame.ts * av_q2d(st->time_base) * 1000.0);
+        offset += size;
+    }
+    if(pfile_vinf != 0) fclose(pfile_vinf);
+    fclose(pfile_plan);
+
+    printf("[DryRun] frames=%d h264=%lld bytes%s\r\n", n, h264_size, exact ? "" : " (lower bound)");
+    result.frames = n;
+    result.bytes = h264_size;
+    return 0;
+}
+
+//---------------------------------------------------------------------
+//  转码相关函数
+//  源视频 -> 多线程解码 -> 像素格式转换 -> H264编码 -> 第三级写入
+//  编码器使用全局头部,输出的包本身就是Annex-B格式,不需要替换开始代码
+
+//  将profile名字转换为编码器的profile值
+int Transcode_GetProfile(std::string name)
+{
+    if(name == "baseline")             return FF_PROFILE_H264_CONSTRAINED_BASELINE;
+    if(name == "main")                 return FF_PROFILE_H264_MAIN;
+    if(name == "high")                 return FF_PROFILE_H264_HIGH;
+    return FF_PROFILE_H264_CONSTRAINED_BASELINE;
+}
+
+//  设置编码器私有选项,编码器不支持时只打印警告
+void Transcode_SetOption(AVCodecContext* p_ctx, const char* key, std::string value)
+{
+    if(av_opt_set(p_ctx->priv_data, key, value.c_str(), 0) < 0)
+    {
+        printf("[Warning] Encoder %s not support option %s=%s\r\n",
+               p_ctx->codec->name, key, value.c_str());
+    }
+}
+
+//  打开源视频的解码器和H264编码器,并从编码器的全局头部中获取SPS和PPS
+//  成功返回0,失败返回-9 ~ -12
+int FFMpeg_OpenTranscode(void)
+{
+    int re = 0;
+    AVStream* p_stream = ffmpeg_context.video_stream;
+
+    //------------------------------------------------------------------
+    //  打开源视频的解码器,开启帧级和片级多线程
+    ffmpeg_context.p_codec = avcodec_find_decoder(ffmpeg_context.p_codec_par->codec_id);
+    if(ffmpeg_context.p_codec == NULL)
+    {
+        printf("ERROR:avcodec_find_decoder()\r\n");
+        FFMpeg_CloseVideo();
+        return -9;
+    }
+    ffmpeg_context.p_codec_ctx = avcodec_alloc_context3(ffmpeg_context.p_codec);
+    if((ffmpeg_context.p_codec_ctx == NULL) ||
+       (avcodec_parameters_to_context(ffmpeg_context.p_codec_ctx, ffmpeg_context.p_codec_par) < 0))
+    {
+        printf("ERROR:Transcode Decoder Context\r\n");
+        FFMpeg_CloseVideo();
+        return -9;
+    }
+    ffmpeg_context.p_codec_ctx->thread_count = TranscodeThreads;
+    ffmpeg_context.p_codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    ffmpeg_context.p_codec_ctx->pkt_timebase = p_stream->time_base;
+    re = avcodec_open2(ffmpeg_context.p_codec_ctx, ffmpeg_context.p_codec, NULL);
+    if(re < 0)
+    {
+        printf("ERROR:Transcode avcodec_open2() Decoder\r\n");
+        FFMpeg_CloseVideo();
+        return -9;
+    }
     ffmpeg_context.avcodec_open_already = true;
+    printf("Transcode Decoder:%s threads=%d\r\n",
+           ffmpeg_context.p_codec->name, ffmpeg_context.p_codec_ctx->thread_count);
+
+    //------------------------------------------------------------------
+    //  查找H264编码器
+    AVCodec* p_encoder = 0;
+    if(TranscodeEncoder != "") p_encoder = avcodec_find_encoder_by_name(TranscodeEncoder.c_str());
+    else                       p_encoder = avcodec_find_encoder(AV_CODEC_ID_H264);
+    if((p_encoder == NULL) || (p_encoder->id != AV_CODEC_ID_H264))
+    {
+        printf("ERROR:Cann't find a h264 encoder\r\n");
+        FFMpeg_CloseVideo();
+        return -10;
+    }
+
+    //  配置编码器
+    ffmpeg_context.p_enc_ctx = avcodec_alloc_context3(p_encoder);
+    if(ffmpeg_context.p_enc_ctx == NULL)
+    {
+        printf("ERROR:avcodec_alloc_context3() Encoder\r\n");
+        FFMpeg_CloseVideo();
+        return -10;
+    }
+    AVCodecContext* p_enc = ffmpeg_context.p_enc_ctx;
+    p_enc->width = ffmpeg_context.p_codec_ctx->width;
+    p_enc->height = ffmpeg_context.p_codec_ctx->height;
+    p_enc->sample_aspect_ratio = ffmpeg_context.p_codec_ctx->sample_aspect_ratio;
+    p_enc->pix_fmt = AV_PIX_FMT_YUV420P;
+    p_enc->time_base = p_stream->time_base;
+    p_enc->framerate = p_stream->avg_frame_rate;
+    p_enc->thread_count = TranscodeThreads;
+    p_enc->profile = Transcode_GetProfile(TranscodeProfile);
+    p_enc->level = TranscodeLevel;
+    p_enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if(TranscodeProfile == "baseline") p_enc->max_b_frames = 0;
+    if(TranscodeGop > 0)
+    {
+        p_enc->gop_size = TranscodeGop;
+    }
+    else if(ffmpeg_context.FrameRate > 0.0f)
+    {
+        p_enc->gop_size = (int)(ffmpeg_context.FrameRate * 2.0f + 0.5f);
+    }
+    if(TranscodeBitrate > 0)
+    {
+        p_enc->bit_rate = TranscodeBitrate * 1000LL;
+    }
+    else
+    {
+        char crf[16];
+        snprintf(crf, sizeof(crf), "%d", TranscodeCrf);
+        Transcode_SetOption(p_enc, "crf", crf);
+    }
+    Transcode_SetOption(p_enc, "preset", TranscodePreset);
+    Transcode_SetOption(p_enc, "profile", TranscodeProfile);
+
+    //  打开编码器
+    re = avcodec_open2(p_enc, p_encoder, NULL);
+    if(re < 0)
+    {
+        printf("ERROR:avcodec_open2() Encoder %s\r\n", p_encoder->name);
+        FFMpeg_CloseVideo();
+        return -11;
+    }
+    printf("Transcode Encoder:%s profile=%s level=%d.%d preset=%s threads=%d\r\n",
+           p_encoder->name, TranscodeProfile.c_str(),
+           TranscodeLevel / 10, TranscodeLevel % 10,
+           TranscodePreset.c_str(), p_enc->thread_count);
+
+    //  送入编码器的帧
+    ffmpeg_context.p_tc_frame = av_frame_alloc();
+    ffmpeg_context.p_tc_frame->format = p_enc->pix_fmt;
+    ffmpeg_context.p_tc_frame->width = p_enc->width;
+    ffmpeg_context.p_tc_frame->height = p_enc->height;
+    if(av_frame_get_buffer(ffmpeg_context.p_tc_frame, 0) < 0)
+    {
+        printf("ERROR:av_frame_get_buffer()\r\n");
+        FFMpeg_CloseVideo();
+        return -11;
+    }
+
+    //------------------------------------------------------------------
+    //  从编码器全局头部中获取SPS和PPS,编码器输出的包为Annex-B格式
+    ffmpeg_context.codec = ECodec_H264;
+    Codec_GetParamSetsT<SH264Traits>(p_enc->extradata, p_enc->extradata_size);
+    ffmpeg_context.framing = EFraming_AnnexB;
+    ffmpeg_context.framing_checked = true;
+    if((ffmpeg_context.sps_dat == 0) || (ffmpeg_context.pps_dat == 0))
+    {
+        printf("ERROR:Encoder global header has no SPS/PPS\r\n");
+        FFMpeg_CloseVideo();
+        return -12;
+    }
+    H264_ParseCurrentSps();
+
+    //  配置宽度、高度
+    ffmpeg_context.Width = p_enc->width;
+    ffmpeg_context.Height = p_enc->height;
+    printf("width=%d, height=%d\r\n", ffmpeg_context.Width, ffmpeg_context.Height);
+
+    //  操作成功
+    ffmpeg_context.transcode = true;
+    return 0;
+}
+
+//  从编码器取出全部已编码的包并写入
+//  成功返回0,写入失败返回-3
+int Transcode_DrainEncoder(SConvOutput& out, AVPacket* enc_pkt)
+{
+    static std::vector<SNalEntry> nals;
+    while(avcodec_receive_packet(ffmpeg_context.p_enc_ctx, enc_pkt) == 0)
+    {
+        //  编码器输出为Annex-B,输出为长度前缀格式时需要转换
+        double trace_t0 = Trace_Begin();
+        Conv_RewritePacket(enc_pkt, NalIndexMode ? &nals : 0);
+        Trace_Add("rewrite", trace_t0, enc_pkt->size);
+        trace_t0 = Trace_Begin();
+        int re = Conv_WritePacket(out, enc_pkt, nals);
+        Trace_Add("write", trace_t0, enc_pkt->size);
+        av_packet_unref(enc_pkt);
+        if(re != 0) return re;
+    }
+    return 0;
+}
+
+//  将一个解码后的帧转换像素格式后送入编码器,frame为空时冲刷编码器
+//  成功返回0,写入失败返回-3,像素转换或编码失败返回-17
+int Transcode_EncodeFrame(SConvOutput& out, AVFrame* frame, AVPacket* enc_pkt)
+{
+    AVFrame* p_tc_frame = ffmpeg_context.p_tc_frame;
+    if(frame != 0)
+    {
+        //  源帧与编码器格式不一致时需要转换
+        //  流中途可能改变分辨率或像素格式,每帧按当前帧的参数取得转换上下文,参数不变时重用
+        if((frame->format != p_tc_frame->format) ||
+           (frame->width != p_tc_frame->width) ||
+           (frame->height != p_tc_frame->height))
+        {
+            ffmpeg_context.p_sws_ctx = sws_getCachedContext(ffmpeg_context.p_sws_ctx,
+                                                            frame->width, frame->height,
+                                                            (enum AVPixelFormat)frame->format,
+                                                            p_tc_frame->width, p_tc_frame->height,
+                                                            (enum AVPixelFormat)p_tc_frame->format,
+                                                            SWS_BILINEAR, NULL, NULL, NULL);
+            if(ffmpeg_context.p_sws_ctx == 0)
+            {
+                printf("[Error] Transcode Scale Context Error!! %dx%d format=%d\r\n",
+                       frame->width, frame->height, frame->format);
+                return -17;
+            }
+            if(av_frame_make_writable(p_tc_frame) < 0)
+            {
+                printf("[Error] Transcode Frame Buffer Error!!\r\n");
+                return -17;
+            }
+            sws_scale(ffmpeg_context.p_sws_ctx, frame->data, frame->linesize, 0, frame->height,
+                      p_tc_frame->data, p_tc_frame->linesize);
+            p_tc_frame->pts = frame->best_effort_timestamp;
+            frame = p_tc_frame;
+        }
+        else
+        {
+            frame->pts = frame->best_effort_timestamp;
+        }
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+    }
+
+    //  送入编码器并取出编码后的包
+    //  编码器的输出已经全部取出,EAGAIN不会出现,冲刷后再次冲刷为EOF,其他错误按编码失败处理
+    int re = avcodec_send_frame(ffmpeg_context.p_enc_ctx, frame);
+    if((re < 0) && (re != AVERROR(EAGAIN)) && (re != AVERROR_EOF))
+    {
+        char err[AV_ERROR_MAX_STRING_SIZE];
+        av_strerror(re, err, sizeof(err));
+        printf("[Error] Transcode Encode Error!! %s\r\n", err);
+        return -17;
+    }
+    return Transcode_DrainEncoder(out, enc_pkt);
+}
+
+//  从解码器取出全部已解码的帧并编码
+//  成功返回0,写入失败返回-3,像素转换或编码失败返回-17
+int Transcode_DrainDecoder(SConvOutput& out, AVFrame* frame, AVPacket* enc_pkt)
+{
+    while(avcodec_receive_frame(ffmpeg_context.p_codec_ctx, frame) == 0)
+    {
+        int re = Transcode_EncodeFrame(out, frame, enc_pkt);
+        av_frame_unref(frame);
+        if(re != 0) return re;
+    }
+    return 0;
+}
+
+//  将一个包送入解码器并编码解码出的帧,pkt为空时冲刷解码器
+//  解码器的输出没有取完(EAGAIN)时先取出再重新送入,
+//  其他错误(如源文件损坏)计数后跳过该包,与FFmpeg的处理相同
+//  成功返回0,写入失败返回-3,像素转换或编码失败返回-17
+int Transcode_DecodePacket(SConvOutput& out, AVPacket* pkt, AVFrame* frame, AVPacket* enc_pkt)
+{
+    int re = 0;
+    int send_re = 0;
+    while((send_re = avcodec_send_packet(ffmpeg_context.p_codec_ctx, pkt)) == AVERROR(EAGAIN))
+    {
+        re = Transcode_DrainDecoder(out, frame, enc_pkt);
+        if(re != 0) return re;
+    }
+    if((send_re < 0) && (send_re != AVERROR_EOF))
+    {
+        if(ffmpeg_context.decode_error_cnt < 10)
+        {
+            char err[AV_ERROR_MAX_STRING_SIZE];
+            av_strerror(send_re, err, sizeof(err));
+            printf("[Warning] Transcode Decode Error!! pts=%lld %s\r\n", (long long)((pkt != 0) ? pkt->pts : -1), err);
+        }
+        ffmpeg_context.decode_error_cnt++;
+    }
+    return Transcode_DrainDecoder(out, frame, enc_pkt);
+}
+
+//  转码模式,读取 -> 解码 -> 编码 -> 写入
+//  编解码器内部已经是多线程,这里不再使用流水线
+//  成功返回0,写入失败返回-3,像素转换或编码失败返回-17
+int Conv_RunTranscode(SConvOutput& out)
+{
+    AVPacket* pkt = av_packet_alloc();
+    AVPacket* enc_pkt = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+
+    //  读取并解码全部视频包
+    int re = 0;
+    ffmpeg_context.decode_error_cnt = 0;
+    while(Conv_ReadVideoPacket(pkt) == 0)
+    {
+        re = Transcode_DecodePacket(out, pkt, frame, enc_pkt);
+        av_packet_unref(pkt);
+        if(re != 0) break;
+    }
+
+    //  冲刷解码器和编码器
+    if(re == 0)
+    {
+        re = Transcode_DecodePacket(out, NULL, frame, enc_pkt);
+    }
+    if(re == 0)
+    {
+        re = Transcode_EncodeFrame(out, NULL, enc_pkt);
+    }
+    if(ffmpeg_context.decode_error_cnt > 0)
+    {
+        printf("[Transcode] Decode Error Packets=%lu\r\n", ffmpeg_context.decode_error_cnt);
+    }
+
+    //  释放
+    av_frame_free(&frame);
+    av_packet_free(&enc_pkt);
+    av_packet_free(&pkt);
+    return re;
+}
+
+//  实际帧数与信息文件头部中的总帧数不一致时,重写信息文件头部
+//  成功返回0,失败返回-1
+int Conv_FixVinfHeader(std::string vinf_name, unsigned long frame_cnt)
+{
+    //  读取整个信息文件
+    FILE* pfile = fopen(vinf_name.c_str(), "rb");
+    if(pfile == 0) return -1;
+    std::string content;
+    char buf[65536];
+    size_t n = 0;
+    while((n = fread(buf, 1, sizeof(buf), pfile)) > 0)
+    {
+        content.append(buf, n);
+    }
+    fclose(pfile);
+
+    //  替换头部中最后一项总帧数
+    size_t pos = content.find("\r\n");
+    if(pos == std::string::npos) return -1;
+    size_t cnt_pos = content.rfind(' ', pos);
+    if(cnt_pos == std::string::npos) return -1;
+    char cnt[32];
+    snprintf(cnt, sizeof(cnt), "%ld", frame_cnt);
+    content.replace(cnt_pos + 1, pos - cnt_pos - 1, cnt);
+
+    //  写回
+    pfile = fopen(vinf_name.c_str(), "wb");
+    if(pfile == 0) return -1;
+    fwrite(content.data(), 1, content.size(), pfile);
+    fclose(pfile);
+    return 0;
+}
+
+//---------------------------------------------------------------------
+//  码流分析相关函数
+
+//  清空统计
+void Analyze_Reset(SAnalyze& ana)
+{
+    ana.frame_rate = 0.0;
+    ana.frame_cnt = 0;
+    ana.total_bytes = 0LL;
+    ana.max_size = 0;
+    ana.max_idx = 0;
+    memset(ana.size_hist, 0, sizeof(ana.size_hist));
+    ana.ring.clear();
+    ana.window_sum = 0LL;
+    ana.peak_sum = 0LL;
+    ana.peak_start = 0;
+    ana.gop_hist.clear();
+    ana.gop_len = 0;
+    memset(ana.slice_cnt, 0, sizeof(ana.slice_cnt));
+    ana.b_run = 0;
+    ana.b_run_max = 0;
+    ana.peak_bps = 0.0;
+    ana.files = 0;
+}
+
+//  帧大小在直方图中的桶
+//  小于2^ANALYZE_SUB_BITS时每个值一个桶,之后每个2的幂等分为2^ANALYZE_SUB_BITS个桶
+int Analyze_HistIndex(int size)
+{
+    const int sub_cnt = 1 << ANALYZE_SUB_BITS;
+    if(size < sub_cnt) return (size > 0) ? size : 0;
+    int k = 31 - __builtin_clz((unsigned int)size);
+    int index = sub_cnt + ((k - ANALYZE_SUB_BITS) << ANALYZE_SUB_BITS) + ((size >> (k - ANALYZE_SUB_BITS)) - sub_cnt);
+    return (index < ANALYZE_HIST_CNT) ? index : (ANALYZE_HIST_CNT - 1);
+}
+
+//  桶中最大的帧大小,百分位按桶的上界给出,不会低估
+int Analyze_HistUpper(int index)
+{
+    const int sub_cnt = 1 << ANALYZE_SUB_BITS;
+    if(index < sub_cnt) return index;
+    int k = (index >> ANALYZE_SUB_BITS) - 1 + ANALYZE_SUB_BITS;
+    int sub = index & (sub_cnt - 1);
+    return (int)((((long long)(sub_cnt + sub + 1)) << (k - ANALYZE_SUB_BITS)) - 1);
+}
+
+//  统计一帧
+//  参数 size 为该帧在H264文件中的字节长度(第一帧含SPS和PPS)
+void Analyze_AddFrame(SAnalyze& ana, int size, AVPacket* pkt)
+{
+    Analyze_AddFrameInfo(ana, size, (pkt->flags & AV_PKT_FLAG_KEY) != 0,
+                         Codec_GetSliceType(pkt->data, pkt->size, OutFraming));
+}
+
+//  统计一帧,帧类型已经取得
+//  参数 type 为Codec_GetSliceType()的返回值
+void Analyze_AddFrameInfo(SAnalyze& ana, int size, bool key, int type)
+{
+    if(ana.frame_rate <= 0.0) ana.frame_rate = ffmpeg_context.FrameRate;
+
+    //  帧大小分布
+    if(size > ana.max_size)
+    {
+        ana.max_size = size;
+        ana.max_idx = ana.frame_cnt;
+    }
+    ana.total_bytes += size;
+    ana.size_hist[Analyze_HistIndex(size)]++;
+
+    //  滑动窗口内的字节数,窗口长度在第一帧时按帧率确定
+    if(ana.ring.empty())
+    {
+        double rate = (ana.frame_rate > 0.0) ? ana.frame_rate : 25.0;
+        int window = (int)(rate * AnalyzeWindow + 0.5);
+        ana.ring.assign((window > 1) ? window : 1, 0);
+    }
+    int window = ana.ring.size();
+    int& slot = ana.ring.at(ana.frame_cnt % window);
+    ana.window_sum += size - slot;
+    slot = size;
+    if(ana.window_sum > ana.peak_sum)
+    {
+        ana.peak_sum = ana.window_sum;
+        ana.peak_start = ((long)ana.frame_cnt >= window) ? ((long)ana.frame_cnt - window + 1) : 0;
+    }
+    ana.frame_cnt++;
+
+    //  GOP长度,以关键帧分隔
+    if(key && (ana.gop_len > 0))
+    {
+        ana.gop_hist[ana.gop_len]++;
+        ana.gop_len = 0;
+    }
+    ana.gop_len++;
+
+    //  帧类型
+    ana.slice_cnt[type]++;
+    if(type == 2)
+    {
+        ana.b_run++;
+        if(ana.b_run > ana.b_run_max) ana.b_run_max = ana.b_run;
+    }
+    else
+    {
+        ana.b_run = 0;
+    }
+}
+
+//  结束一个文件的统计,计算峰值码率
+//  参数 peak_start 返回峰值窗口的起始帧
+void Analyze_Finish(SAnalyze& ana, long& peak_start)
+{
+    //  最后一个GOP
+    if(ana.gop_len > 0) ana.gop_hist[ana.gop_len]++;
+    ana.gop_len = 0;
+
+    //  滑动窗口内的最大字节数,已经在每帧统计时更新
+    double rate = (ana.frame_rate > 0.0) ? ana.frame_rate : 25.0;
+    int window = ana.ring.empty() ? 1 : (int)ana.ring.size();
+    peak_start = ana.peak_start;
+    ana.peak_bps = ana.peak_sum * 8.0 * rate / window;
+    ana.files = 1;
+}
+
+//  合并到批次统计
+void Analyze_Merge(SAnalyze& batch, const SAnalyze& ana)
+{
+    if(ana.max_size > batch.max_size) batch.max_size = ana.max_size;
+    batch.frame_cnt += ana.frame_cnt;
+    batch.total_bytes += ana.total_bytes;
+    int k=0;
+    for(k=0;k<ANALYZE_HIST_CNT;k++) batch.size_hist[k] += ana.size_hist[k];
+    std::map<int, int>::const_iterator it;
+    for(it=ana.gop_hist.begin();it!=ana.gop_hist.end();it++)
+    {
+        batch.gop_hist[it->first] += it->second;
+    }
+    int i=0;
+    for(i=0;i<4;i++) batch.slice_cnt[i] += ana.slice_cnt[i];
+    if(ana.b_run_max > batch.b_run_max) batch.b_run_max = ana.b_run_max;
+    if(ana.peak_bps > batch.peak_bps) batch.peak_bps = ana.peak_bps;
+    batch.files += ana.files;
+}
+
+//  写入JSON字符串,处理转义
+void Analyze_JsonString(FILE* pfile, std::string str)
+{
+    fputc('"', pfile);
+    size_t i=0;
+    for(i=0;i<str.size();i++)
+    {
+        unsigned char ch = str.at(i);
+        if((ch == '"') || (ch == '\\')) fprintf(pfile, "\\%c", ch);
+        else if(ch < 0x20)              fprintf(pfile, "\\u%04x", ch);
+        else                            fputc(ch, pfile);
+    }
+    fputc('"', pfile);
+}
+
+//  写入统计结果
+//  参数 name 为文件名,为空时表示批次汇总
+//  参数 peak_start 为峰值窗口的起始帧,汇总时不使用
+void Analyze_WriteJson(FILE* pfile, const SAnalyze& ana, std::string name, long peak_start)
+{
+    //  帧大小分布
+    long cnt = ana.frame_cnt;
+    long long total = ana.total_bytes;
+    long i=0;
+    const double pct[5] = {50.0, 90.0, 95.0, 99.0, 99.9};
+    const char* pct_name[5] = {"p50", "p90", "p95", "p99", "p999"};
+
+    //  GOP长度
+    long gop_cnt = 0;
+    long long gop_sum = 0LL;
+    int gop_max = 0;
+    std::map<int, int>::const_iterator it;
+    for(it=ana.gop_hist.begin();it!=ana.gop_hist.end();it++)
+    {
+        gop_cnt += it->second;
+        gop_sum += (long long)it->first * it->second;
+        if(it->first > gop_max) gop_max = it->first;
+    }
+
+    fprintf(pfile, "{\n");
+    if(name != "")
+    {
+        fprintf(pfile, "  \"file\": ");
+        Analyze_JsonString(pfile, name);
+        fprintf(pfile, ",\n");
+        fprintf(pfile, "  \"frame_rate\": %.3f,\n", ana.frame_rate);
+    }
+    else
+    {
+        fprintf(pfile, "  \"files\": %d,\n", ana.files);
+    }
+    fprintf(pfile, "  \"frames\": %ld,\n", cnt);
+    fprintf(pfile, "  \"bytes\": %lld,\n", total);
+    fprintf(pfile, "  \"frame_size\": {\"mean\": %.1f", (cnt > 0) ? ((double)total / cnt) : 0.0);
+    int bucket = 0;
+    unsigned long below = 0;
+    for(i=0;i<5;i++)
+    {
+        //  最近秩法,在直方图中找到该秩所在的桶,不超过最大帧
+        long rank = (long)ceil(pct[i] / 100.0 * cnt);
+        if(rank < 1) rank = 1;
+        while((bucket < ANALYZE_HIST_CNT - 1) && (below + ana.size_hist[bucket] < (unsigned long)rank))
+        {
+            below += ana.size_hist[bucket];
+            bucket++;
+        }
+        int value = Analyze_HistUpper(bucket);
+        if(value > ana.max_size) value = ana.max_size;
+        fprintf(pfile, ", \"%s\": %d", pct_name[i], (cnt > 0) ? value : 0);
+    }
+    fprintf(pfile, ", \"max\": %d", ana.max_size);
+    if(name != "") fprintf(pfile, ", \"max_frame\": %ld", ana.max_idx);
+    fprintf(pfile, "},\n");
+    fprintf(pfile, "  \"peak_bitrate\": {\"window_sec\": %.3f, \"bps\": %.0f", AnalyzeWindow, ana.peak_bps);
+    if(name != "") fprintf(pfile, ", \"start_frame\": %ld", peak_start);
+    fprintf(pfile, "},\n");
+    fprintf(pfile, "  \"gop\": {\"count\": %ld, \"mean\": %.1f, \"max\": %d, \"hist\": {",
+            gop_cnt, (gop_cnt > 0) ? ((double)gop_sum / gop_cnt) : 0.0, gop_max);
+    for(it=ana.gop_hist.begin();it!=ana.gop_hist.end();it++)
+    {
+        fprintf(pfile, "%s\"%d\": %d", (it == ana.gop_hist.begin()) ? "" : ", ", it->first, it->second);
+    }
+    fprintf(pfile, "}},\n");
+    fprintf(pfile, "  \"slice\": {\"I\": %lu, \"P\": %lu, \"B\": %lu, \"unknown\": %lu, \"b_ratio\": %.4f, \"max_consecutive_b\": %d}",
+            ana.slice_cnt[0], ana.slice_cnt[1], ana.slice_cnt[2], ana.slice_cnt[3],
+            (cnt > 0) ? ((double)ana.slice_cnt[2] / cnt) : 0.0, ana.b_run_max);
 
-    //  提示找到解码器的名字
-    printf("Find Codec Name:%s\r\n", ffmpeg_context.p_codec->name);
+    //  汇总时列出每个文件的摘要
+    if(name == "")
+    {
+        fprintf(pfile, ",\n  \"per_file\": [");
+        size_t k=0;
+        for(k=0;k<AnalyzeFileSummary.size();k++)
+        {
+            fprintf(pfile, "%s\n    %s", (k == 0) ? "" : ",", AnalyzeFileSummary.at(k).c_str());
+        }
+        fprintf(pfile, "\n  ]");
+    }
+    fprintf(pfile, "\n}\n");
+}
 
-    //  当解码器名字不匹配
-    std::string decodec_name = ffmpeg_context.p_codec->name;
-    if(decodec_name != "h264")
+//  结束当前文件的分析,写入单个文件的JSON,并合并到批次统计
+void Analyze_EndFile(std::string name, std::string json_name)
+{
+    long peak_start = 0;
+    Analyze_Finish(FileAnalyze, peak_start);
+
+    FILE* pfile = fopen(json_name.c_str(), "wb");
+    if(pfile == 0)
     {
-        //  依次释放资源
-        if(ffmpeg_context.avcodec_open_already)
+        printf("[Error] Open Analyze File Error!! %s\r\n", json_name.c_str());
+    }
+    else
+    {
+        Analyze_WriteJson(pfile, FileAnalyze, name, peak_start);
+        fclose(pfile);
+    }
+
+    //  摘要
+    int max_frame = FileAnalyze.max_size;
+    size_t i=0;
+    int max_gop = FileAnalyze.gop_hist.empty() ? 0 : FileAnalyze.gop_hist.rbegin()->first;
+    std::string esc;
+    for(i=0;i<name.size();i++)
+    {
+        unsigned char ch = name.at(i);
+        if((ch == '"') || (ch == '\\')) esc += '\\';
+        if(ch >= 0x20) esc += ch;
+    }
+    char buf[128];
+    snprintf(buf, sizeof(buf), "\", \"frames\": %lu, \"max_frame\": %d, \"peak_bps\": %.0f, \"max_gop\": %d}",
+             FileAnalyze.frame_cnt, max_frame, FileAnalyze.peak_bps, max_gop);
+    AnalyzeFileSummary.push_back(std::string("{\"file\": \"") + esc + buf);
+
+    printf("[Analyze] max_frame=%d peak=%.0fbps max_gop=%d B=%lu\r\n",
+           max_frame, FileAnalyze.peak_bps, max_gop, FileAnalyze.slice_cnt[2]);
+    Analyze_Merge(BatchAnalyze, FileAnalyze);
+    Analyze_Reset(FileAnalyze);
+}
+
+//  写入批次汇总
+void Analyze_WriteBatch(void)
+{
+    FILE* pfile = fopen(AnalyzeName.c_str(), "wb");
+    if(pfile == 0)
+    {
+        printf("[Error] Open Analyze File Error!! %s\r\n", AnalyzeName.c_str());
+        return;
+    }
+    Analyze_WriteJson(pfile, BatchAnalyze, "", 0);
+    fclose(pfile);
+}
+
+//---------------------------------------------------------------------
+//  时间线跟踪相关函数
+//  各线程把事件写入预分配的有界多生产者环形缓冲区,不加锁也不分配内存,
+//  后台线程定期取出并写入JSON,热路径上不做文件操作
+
+//  事件开始,返回当前时刻,不跟踪时返回0,不读取时钟
+double Trace_Begin(void)
+{
+    if(TraceCtx.p_ring == 0) return 0.0;
+    return Pipe_NowMs();
+}
+
+//  当前线程的编号,第一次调用时分配
+int Trace_GetTid(void)
+{
+    if(TraceTid == 0) TraceTid = TraceTidCnt.fetch_add(1) + 1;
+    return TraceTid;
+}
+
+//  记录一个从t0到现在的事件,缓冲区满时丢弃
+void Trace_Add(const char* name, double t0, long long arg)
+{
+    STraceContext& ctx = TraceCtx;
+    if(ctx.p_ring == 0) return;
+    double now = Pipe_NowMs();
+
+    //  申请位置,该位置的事件还没有被取走时说明缓冲区已满
+    unsigned long long pos = ctx.head.load(std::memory_order_relaxed);
+    STraceEvent* pev = 0;
+    while(1)
+    {
+        pev = &ctx.p_ring[pos & (TRACE_RING_SIZE - 1)];
+        long long diff = (long long)(pev->seq.load(std::memory_order_acquire) - pos);
+        if(diff < 0)
         {
-            avcodec_close(ffmpeg_context.p_codec_ctx);
-            ffmpeg_context.avcodec_open_already = false;
+            ctx.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
         }
-        if(ffmpeg_context.p_codec_ctx != 0)
+        if((diff == 0) &&
+           ctx.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        if(diff > 0) pos = ctx.head.load(std::memory_order_relaxed);
+    }
+
+    //  填写并发布
+    pev->name = name;
+    pev->ts = t0 - ctx.t0;
+    pev->dur = now - t0;
+    pev->pid = TracePid.load(std::memory_order_relaxed);
+    pev->tid = Trace_GetTid();
+    pev->arg = arg;
+    pev->seq.store(pos + 1, std::memory_order_release);
+}
+
+//  设置当前线程的名字,在Perfetto中显示
+void Trace_ThreadName(const char* name)
+{
+    if(TraceCtx.p_ring == 0) return;
+    int tid = Trace_GetTid();
+    std::lock_guard<std::mutex> guard(TraceCtx.lock);
+    TraceCtx.thread_names[tid] = name;
+}
+
+//  开始一个文件,之后的事件都属于该文件
+void Trace_BeginFile(int index, std::string input_file)
+{
+    if(TraceCtx.p_ring == 0) return;
+    {
+        std::lock_guard<std::mutex> guard(TraceCtx.lock);
+        if((int)TraceCtx.file_names.size() <= index) TraceCtx.file_names.resize(index + 1);
+        TraceCtx.file_names.at(index) = input_file;
+    }
+    TracePid.store(index + 1);
+}
+
+//  取出已经发布的事件写入文件,只在后台线程或者后台线程结束后调用
+void Trace_Drain(void)
+{
+    STraceContext& ctx = TraceCtx;
+    while(1)
+    {
+        STraceEvent& ev = ctx.p_ring[ctx.tail & (TRACE_RING_SIZE - 1)];
+        if(ev.seq.load(std::memory_order_acquire) != ctx.tail + 1) break;
+        const char* key = (strcmp(ev.name, "file") == 0) ? "code" : "bytes";
+        fprintf(ctx.pfile, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"%s\":%lld}}",
+                ctx.first ? "" : ",", ev.name, ev.ts * 1000.0, ev.dur * 1000.0, ev.pid, ev.tid, key, ev.arg);
+        ctx.first = false;
+        ctx.written++;
+        ctx.seen.insert(std::make_pair(ev.pid, ev.tid));
+        ev.seq.store(ctx.tail + TRACE_RING_SIZE, std::memory_order_release);
+        ctx.tail++;
+    }
+}
+
+//  后台写入线程
+void Trace_FlushThread(void)
+{
+    while(!TraceCtx.stop.load())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(TRACE_FLUSH_MS));
+        Trace_Drain();
+    }
+}
+
+//  打开跟踪文件并启动后台线程
+//  成功返回0
+int Trace_Open(std::string name)
+{
+    STraceContext& ctx = TraceCtx;
+    ctx.pfile = fopen(name.c_str(), "wb");
+    if(ctx.pfile == 0)
+    {
+        printf("[Error] Open Trace File Error!! %s\r\n", name.c_str());
+        return -1;
+    }
+    ctx.p_ring = new STraceEvent[TRACE_RING_SIZE];
+    unsigned long long i=0;
+    for(i=0;i<TRACE_RING_SIZE;i++)
+    {
+        ctx.p_ring[i].seq.store(i);
+    }
+    ctx.head.store(0);
+    ctx.tail = 0;
+    ctx.dropped.store(0);
+    ctx.written = 0;
+    ctx.first = true;
+    ctx.t0 = Pipe_NowMs();
+    ctx.stop.store(false);
+    fprintf(ctx.pfile, "{\"traceEvents\":[");
+    ctx.p_thread = new std::thread(Trace_FlushThread);
+    Trace_ThreadName("main");
+    return 0;
+}
+
+//  写入名字的元数据事件
+void Trace_WriteMeta(const char* meta, int pid, int tid, std::string value)
+{
+    STraceContext& ctx = TraceCtx;
+    fprintf(ctx.pfile, "%s\n{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+            ctx.first ? "" : ",", meta, pid, tid);
+    Analyze_JsonString(ctx.pfile, value);
+    fprintf(ctx.pfile, "}}");
+    ctx.first = false;
+}
+
+//  停止后台线程,写入剩余的事件和名字,关闭跟踪文件
+//  所有的工作线程都已经结束后调用
+void Trace_Close(void)
+{
+    STraceContext& ctx = TraceCtx;
+    if(ctx.p_ring == 0) return;
+    ctx.stop.store(true);
+    ctx.p_thread->join();
+    delete ctx.p_thread;
+    ctx.p_thread = 0;
+    Trace_Drain();
+
+    //  进程名为文件名,同一个线程(如主线程)可能出现在多个文件中,线程名在每个出现过的pid下都写一次
+    size_t i=0;
+    Trace_WriteMeta("process_name", 0, 0, "VideoConv");
+    for(i=0;i<ctx.file_names.size();i++)
+    {
+        if(ctx.file_names.at(i) != "") Trace_WriteMeta("process_name", (int)i + 1, 0, ctx.file_names.at(i));
+    }
+    std::set<std::pair<int, int> >::const_iterator it;
+    for(it=ctx.seen.begin();it!=ctx.seen.end();++it)
+    {
+        std::map<int, std::string>::const_iterator name = ctx.thread_names.find(it->second);
+        if(name != ctx.thread_names.end()) Trace_WriteMeta("thread_name", it->first, it->second, name->second);
+    }
+    ctx.seen.clear();
+    ctx.thread_names.clear();
+    ctx.file_names.clear();
+    fprintf(ctx.pfile, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(ctx.pfile);
+    ctx.pfile = 0;
+    delete[] ctx.p_ring;
+    ctx.p_ring = 0;
+    printf("[Trace] %s events=%llu dropped=%llu\r\n", TraceName.c_str(),
+           ctx.written, ctx.dropped.load());
+}
+
+//---------------------------------------------------------------------
+//  校验相关函数
+
+//  读取视频信息文件
+//  成功返回0,失败返回-1
+int Vinf_Load(std::string vinf_name, SVinfInfo& info)
+{
+    FILE* pfile = fopen(vinf_name.c_str(), "rb");
+    if(pfile == 0) return -1;
+
+    //  头部
+    info.frame_size.clear();
+    char line[1024];
+    if((fgets(line, sizeof(line), pfile) == 0) ||
+       (sscanf(line, "%d %d %f %lu", &info.Width, &info.Height, &info.FrameRate, &info.TotalFrame) != 4))
+    {
+        fclose(pfile);
+        return -1;
+    }
+
+    //  每一帧的长度和CRC32C
+    info.has_crc = false;
+    info.align = 0;
+    info.avcc = false;
+    info.codec = ECodec_H264;
+    info.frame_crc.clear();
+    info.payload_size.clear();
+    while(fgets(line, sizeof(line), pfile) != 0)
+    {
+        if(strncmp(line, "#ALIGN ", 7) == 0)
         {
-            avcodec_free_context(&ffmpeg_context.p_codec_ctx);
-            ffmpeg_context.p_codec_ctx = 0;
+            sscanf(line + 7, "%d", &info.align);
+            continue;
         }
-        if(ffmpeg_context.p_fmt_ctx != 0)
+        if(strncmp(line, "#FRAMING ", 9) == 0)
         {
-            avformat_close_input(&ffmpeg_context.p_fmt_ctx);
-            ffmpeg_context.p_fmt_ctx = 0;
+            info.avcc = (strncmp(line + 9, "avcc", 4) == 0);
+            continue;
         }
-        return -8;
+        if(strncmp(line, "#CODEC ", 7) == 0)
+        {
+            info.codec = (strncmp(line + 7, "h265", 4) == 0) ? ECodec_H265 : ECodec_H264;
+            continue;
+        }
+        int size = 0;
+        int payload = 0;
+        unsigned long long offset = 0ULL;
+        unsigned int crc = 0;
+        int n = 0;
+        bool has_crc = false;
+        if(info.align > 1)
+        {
+            n = sscanf(line, "%d %d %llu %x", &size, &payload, &offset, &crc);
+            has_crc = (n >= 4);
+        }
+        else
+        {
+            n = sscanf(line, "%d %x", &size, &crc);
+            payload = size;
+            has_crc = (n >= 2);
+        }
+        if(n < 1) continue;
+        if(info.frame_size.size() == 0) info.has_crc = has_crc;
+        info.frame_size.push_back(size);
+        info.payload_size.push_back(payload);
+        info.frame_crc.push_back(crc);
     }
+    fclose(pfile);
+    return 0;
+}
 
-    //  配置宽度、高度
-    ffmpeg_context.Width = ffmpeg_context.p_codec_ctx->width;
-    ffmpeg_context.Height = ffmpeg_context.p_codec_ctx->height;
-    printf("width=%d, height=%d\r\n", ffmpeg_context.Width, ffmpeg_context.Height);
+//  计算一帧解码图像的哈希值
+unsigned int Verify_HashFrame(const AVFrame* frame)
+{
+    unsigned int hash = 1;
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+    if(desc == 0) return 0;
+    int plane = 0;
+    for(plane=0;(plane<4) && (frame->data[plane] != 0);plane++)
+    {
+        int row_bytes = av_image_get_linesize((enum AVPixelFormat)frame->format, frame->width, plane);
+        int rows = frame->height;
+        if((plane == 1) || (plane == 2))
+        {
+            rows = -((-frame->height) >> desc->log2_chroma_h);
+        }
+        int y = 0;
+        for(y=0;y<rows;y++)
+        {
+            hash = av_adler32_update(hash, frame->data[plane] + y * frame->linesize[plane], row_bytes);
+        }
+    }
+    return hash;
+}
 
-    //  获取SPS相关
-    //  计算SPS的长度
-    ffmpeg_context.sps_len = ffmpeg_context.video_stream->codecpar->extradata[6] * 0xFF +
-                             ffmpeg_context.video_stream->codecpar->extradata[7];
-#if DEBUG_LOG
-    printf("SPS len = %d(bytes)\r\n", ffmpeg_context.sps_len);
-#endif  //  DEBUG_LOG
+//  取出解码器中全部已解码的帧并记录哈希值
+void Verify_DrainDecoder(AVCodecContext* p_ctx, AVFrame* frame, std::vector<unsigned int>& hash_vec)
+{
+    while(avcodec_receive_frame(p_ctx, frame) == 0)
+    {
+        hash_vec.push_back(Verify_HashFrame(frame));
+        av_frame_unref(frame);
+    }
+}
 
-    //  复制SPS数据
-    ffmpeg_context.sps_dat = new unsigned char[ffmpeg_context.sps_len];
-    memcpy(ffmpeg_context.sps_dat,
-           ffmpeg_context.video_stream->codecpar->extradata + 8,
-           ffmpeg_context.sps_len
-          );
-
-    //  获取PPS相关
-    //  计算PPS长度
-    ffmpeg_context.pps_len = ffmpeg_context.video_stream->codecpar->extradata[8 + ffmpeg_context.sps_len + 1] * 0xFF +
-                             ffmpeg_context.video_stream->codecpar->extradata[8 + ffmpeg_context.sps_len + 2];
-#if DEBUG_LOG
-    printf("PPS len = %d(bytes)\r\n", ffmpeg_context.pps_len);
-#endif  //  DEBUG_LOG
+//  创建一个帧级多线程的解码器
+AVCodecContext* Verify_OpenDecoder(ECodec codec)
+{
+    AVCodec* p_codec = avcodec_find_decoder_by_name(Codec_Name(codec));
+    if(p_codec == NULL) return 0;
+    AVCodecContext* p_ctx = avcodec_alloc_context3(p_codec);
+    if(p_ctx == NULL) return 0;
+    p_ctx->thread_count = VerifyThreads;
+    p_ctx->thread_type = FF_THREAD_FRAME;
+    if(avcodec_open2(p_ctx, p_codec, NULL) < 0)
+    {
+        avcodec_free_context(&p_ctx);
+        return 0;
+    }
+    return p_ctx;
+}
 
-    //  获取PPS数据
-    ffmpeg_context.pps_dat = new unsigned char[ffmpeg_context.pps_len];
-    memcpy(ffmpeg_context.pps_dat,
-           ffmpeg_context.video_stream->codecpar->extradata + 8 + 2 + 1 + ffmpeg_context.sps_len,
-           ffmpeg_context.pps_len
-          );
+//  解码源文件,记录每一帧的哈希值,读取的包与转换时一致
+//  成功返回0,失败返回-1
+int Verify_DecodeSource(std::string input_file, std::vector<unsigned int>& hash_vec, double& fps)
+{
+    if(FFMpeg_OpenVideo(input_file) != 0)
+    {
+        FFMpeg_CloseVideo();
+        return -1;
+    }
 
-    //  操作成功
+    AVPacket* pkt = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    double t0 = Pipe_NowMs();
+    unsigned long pkt_cnt = 0UL;
+    while(Conv_ReadVideoPacket(pkt) == 0)
+    {
+        if(pkt->size < (int)sizeof(startcode))
+        {
+            av_packet_unref(pkt);
+            break;
+        }
+        avcodec_send_packet(ffmpeg_context.p_codec_ctx, pkt);
+        av_packet_unref(pkt);
+        Verify_DrainDecoder(ffmpeg_context.p_codec_ctx, frame, hash_vec);
+        pkt_cnt++;
+        if((ffmpeg_context.TotalFrame > 0) && (pkt_cnt >= ffmpeg_context.TotalFrame)) break;
+    }
+    avcodec_send_packet(ffmpeg_context.p_codec_ctx, NULL);
+    Verify_DrainDecoder(ffmpeg_context.p_codec_ctx, frame, hash_vec);
+    double ms = Pipe_NowMs() - t0;
+    fps = (ms > 0.0) ? (hash_vec.size() * 1000.0 / ms) : 0.0;
+
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    FFMpeg_CloseVideo();
     return 0;
 }
 
-//  关闭当前已经打开的视频文件
-void FFMpeg_CloseVideo(void)
+//  统计一帧中的参数集和图像数据NAL
+//  没有VPS的编码格式has_vps总为true
+template<class T>
+void Verify_CheckNals(const unsigned char* pdat, const std::vector<int>& nal_offset, int nal_cnt,
+                      bool& has_vps, bool& has_sps, bool& has_pps, bool& has_slice)
 {
-    //  依次释放资源
-    if(ffmpeg_context.sps_dat != 0)
+    has_vps = !T::has_vps;
+    has_sps = false;
+    has_pps = false;
+    has_slice = false;
+    int j = 0;
+    for(j=0;j<nal_cnt;j++)
     {
-        delete [] ffmpeg_context.sps_dat;
-        ffmpeg_context.sps_dat = 0;
-        ffmpeg_context.sps_len = 0;
+        int type = T::NalType(pdat + nal_offset.at(j));
+        int index = T::ParamSetIndex(type);
+        if(index == 0) has_vps = true;
+        if(index == 1) has_sps = true;
+        if(index == 2) has_pps = true;
+        if(T::IsVcl(type)) has_slice = true;
     }
-    if(ffmpeg_context.pps_dat != 0)
+}
+
+//  校验一个输出文件
+//  input_file为源文件,compare_source为true时与源文件的解码结果对比
+//  校验通过返回0,失败返回-13
+int Verify_File(std::string input_file, std::string h264_name, std::string vinf_name, bool compare_source)
+{
+    printf("-----Verify:%s\r\n", h264_name.c_str());
+    int error_cnt = 0;
+
+    //------------------------------------------------------------------
+    //  检查信息文件
+    SVinfInfo info;
+    if(Vinf_Load(vinf_name, info) != 0)
     {
-        delete [] ffmpeg_context.pps_dat;
-        ffmpeg_context.pps_dat = 0;
-        ffmpeg_context.pps_len = 0;
+        printf("[Verify] Load Video Info File Error!! %s\r\n", vinf_name.c_str());
+        return -13;
     }
-    if(ffmpeg_context.avcodec_open_already)
+    unsigned long frame_total = info.frame_size.size();
+    if(frame_total != info.TotalFrame)
     {
-        avcodec_close(ffmpeg_context.p_codec_ctx);
-        ffmpeg_context.avcodec_open_already = false;
+        printf("[Verify] Frame Count Mismatch!! header=%lu index=%lu\r\n", info.TotalFrame, frame_total);
+        error_cnt++;
     }
-    if(ffmpeg_context.p_codec_ctx != 0)
+
+    //  检查H264文件长度
+    FILE* pfile = fopen(h264_name.c_str(), "rb");
+    if(pfile == 0)
     {
-        avcodec_free_context(&ffmpeg_context.p_codec_ctx);
-        ffmpeg_context.p_codec_ctx = 0;
+        printf("[Verify] Open H264 File Error!! %s\r\n", h264_name.c_str());
+        return -13;
     }
-    if(ffmpeg_context.p_fmt_ctx != 0)
+    unsigned long long index_bytes = 0ULL;
+    unsigned long i = 0;
+    int max_size = 0;
+    for(i=0;i<frame_total;i++)
     {
-        avformat_close_input(&ffmpeg_context.p_fmt_ctx);
-        ffmpeg_context.p_fmt_ctx = 0;
+        index_bytes += info.frame_size.at(i);
+        if(info.frame_size.at(i) > max_size) max_size = info.frame_size.at(i);
+    }
+    fseeko(pfile, 0, SEEK_END);
+    unsigned long long file_bytes = ftello(pfile);
+    fseeko(pfile, 0, SEEK_SET);
+    if(file_bytes != index_bytes)
+    {
+        printf("[Verify] File Size Mismatch!! file=%llu index=%llu\r\n", file_bytes, index_bytes);
+        error_cnt++;
+    }
+
+    //------------------------------------------------------------------
+    //  按信息文件中的长度逐帧检查结构并解码
+    AVCodecContext* p_ctx = Verify_OpenDecoder(info.codec);
+    if(p_ctx == 0)
+    {
+        printf("[Verify] Open %s Decoder Error!!\r\n", Codec_Name(info.codec));
+        fclose(pfile);
+        return -13;
+    }
+    AVPacket* pkt = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    std::vector<unsigned char> buf(max_size + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+    std::vector<unsigned int> hash_vec;
+    std::vector<int> nal_offset;
+    std::vector<int> nal_len;
+    int bad_frame_cnt = 0;
+    int send_error_cnt = 0;
+    int crc_error_cnt = 0;
+    double t0 = Pipe_NowMs();
+    for(i=0;i<frame_total;i++)
+    {
+        int size = info.frame_size.at(i);
+        if((size <= 0) || (fread(buf.data(), 1, size, pfile) != (size_t)size))
+        {
+            printf("[Verify] Frame %lu Read Error!! size=%d\r\n", i, size);
+            error_cnt++;
+            break;
+        }
+
+        //  检查CRC32C
+        if(info.has_crc && (Crc32c(0, buf.data(), size) != info.frame_crc.at(i)))
+        {
+            if(crc_error_cnt < 10) printf("[Verify] Frame %lu CRC32C Error!!\r\n", i);
+            crc_error_cnt++;
+        }
+
+        //  检查开始代码和NAL组成
+        bool has_vps = false;
+        bool has_sps = false;
+        bool has_pps = false;
+        bool has_slice = false;
+        //  长度前缀格式只拆分有效数据,之后为填充
+        int payload = (info.align > 1) ? info.payload_size.at(i) : size;
+        int nal_cnt = 0;
+        if(info.avcc) nal_cnt = H264_SplitAVCC(buf.data(), payload, nal_offset, nal_len);
+        else          nal_cnt = H264_SplitAnnexB(buf.data(), size, nal_offset, nal_len);
+        int j = 0;
+        if(info.codec == ECodec_H265) Verify_CheckNals<SH265Traits>(buf.data(), nal_offset, nal_cnt, has_vps, has_sps, has_pps, has_slice);
+        else                          Verify_CheckNals<SH264Traits>(buf.data(), nal_offset, nal_cnt, has_vps, has_sps, has_pps, has_slice);
+        bool start_ok = (size >= 4) &&
+                        (((buf[0] == 0) && (buf[1] == 0) && (buf[2] == 0) && (buf[3] == 1)) ||
+                         ((buf[0] == 0) && (buf[1] == 0) && (buf[2] == 1)));
+        if(info.avcc)
+        {
+            //  解码器按Annex-B输入,原地把长度替换为开始代码
+            start_ok = (nal_cnt > 0);
+            for(j=0;j<nal_cnt;j++) memcpy(buf.data() + nal_offset.at(j) - sizeof(startcode), startcode, sizeof(startcode));
+            size = payload;
+        }
+        if(!start_ok || !has_slice || ((i == 0) && (!has_vps || !has_sps || !has_pps)))
+        {
+            if(bad_frame_cnt < 10)
+            {
+                printf("[Verify] Frame %lu Bad Structure!! start_code=%d slice=%d vps=%d sps=%d pps=%d\r\n",
+                       i, start_ok, has_slice, has_vps, has_sps, has_pps);
+            }
+            bad_frame_cnt++;
+        }
+
+        //  送入解码器
+        pkt->data = buf.data();
+        pkt->size = size;
+        if(avcodec_send_packet(p_ctx, pkt) < 0) send_error_cnt++;
+        Verify_DrainDecoder(p_ctx, frame, hash_vec);
+    }
+    pkt->data = 0;
+    pkt->size = 0;
+    avcodec_send_packet(p_ctx, NULL);
+    Verify_DrainDecoder(p_ctx, frame, hash_vec);
+    double ms = Pipe_NowMs() - t0;
+    double fps = (ms > 0.0) ? (hash_vec.size() * 1000.0 / ms) : 0.0;
+    int threads = p_ctx->thread_count;
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&p_ctx);
+    fclose(pfile);
+
+    if(bad_frame_cnt > 0) error_cnt++;
+    if(crc_error_cnt > 0)
+    {
+        printf("[Verify] CRC32C Error Frames=%d\r\n", crc_error_cnt);
+        error_cnt++;
+    }
+    if(send_error_cnt > 0)
+    {
+        printf("[Verify] Decode Error Packets=%d\r\n", send_error_cnt);
+        error_cnt++;
+    }
+    if(hash_vec.size() != frame_total)
+    {
+        printf("[Verify] Decoded Frame Count Mismatch!! decoded=%lu index=%lu\r\n",
+               (unsigned long)hash_vec.size(), frame_total);
+        error_cnt++;
+    }
+    printf("[Verify] frames=%lu decoded=%lu bad_structure=%d decode_fps=%.1f threads=%d\r\n",
+           frame_total, (unsigned long)hash_vec.size(), bad_frame_cnt, fps, threads);
+
+    //------------------------------------------------------------------
+    //  与源文件的解码结果逐帧对比
+    if(compare_source)
+    {
+        std::vector<unsigned int> src_hash_vec;
+        double src_fps = 0.0;
+        if(Verify_DecodeSource(input_file, src_hash_vec, src_fps) != 0)
+        {
+            printf("[Verify] Decode Source Error!! %s\r\n", input_file.c_str());
+            error_cnt++;
+        }
+        else
+        {
+            size_t cmp_cnt = (src_hash_vec.size() < hash_vec.size()) ? src_hash_vec.size() : hash_vec.size();
+            size_t mismatch_cnt = 0;
+            long first_mismatch = -1;
+            size_t k = 0;
+            for(k=0;k<cmp_cnt;k++)
+            {
+                if(src_hash_vec.at(k) != hash_vec.at(k))
+                {
+                    if(first_mismatch < 0) first_mismatch = k;
+                    mismatch_cnt++;
+                }
+            }
+            if(src_hash_vec.size() != hash_vec.size()) mismatch_cnt += (src_hash_vec.size() > hash_vec.size()) ?
+                                                                           (src_hash_vec.size() - hash_vec.size()) :
+                                                                           (hash_vec.size() - src_hash_vec.size());
+            printf("[Verify] source_frames=%lu mismatch=%lu first_mismatch=%ld source_decode_fps=%.1f\r\n",
+                   (unsigned long)src_hash_vec.size(), (unsigned long)mismatch_cnt, first_mismatch, src_fps);
+            if(mismatch_cnt > 0) error_cnt++;
+        }
+    }
+
+    //  结果
+    if(error_cnt > 0)
+    {
+        printf("[Verify] FAIL %s\r\n", h264_name.c_str());
+        return -13;
     }
+    printf("[Verify] OK %s\r\n", h264_name.c_str());
+    return 0;
 }
 
 //---------------------------------------------------------------------
-//  H264解码相关函数
+//  拼接相关函数
 
-//  检查是否包含SEI区头部
-//  参数 pdat 为数据首地址
-//  参数 len 为数据有效长度
-//  包含SEI信息头返回true, 否则返回false
-bool H264_CheckSEI_Inside(unsigned char* pdat, int len)
+//  打开拼接输出文件
+//  成功返回0,失败返回-3
+int Concat_Open(std::string& h264_name, std::string& vinf_name)
 {
-    //  检查长度
-    if(len < 6) return false;
+    memset(&ConcatOut, 0, sizeof(ConcatOut));
+    ConcatClipCnt = 0;
+    ConcatSps.clear();
+    ConcatPps.clear();
+
+    //  输出文件名
+    std::string base = (OutputPath == "") ? ConcatName : (OutputPath + "/" + ConcatName);
+    h264_name = base + ".h264";
+    vinf_name = base + ".vinf";
+
+    //  打开输出文件
+    ConcatOut.pfile_outh264 = fopen(h264_name.c_str(), "wb");
+    ConcatOut.pfile_outvinf = fopen(vinf_name.c_str(), "wb");
+    if(NalIndexMode) ConcatOut.pfile_outvnal = Nal_Open(base + ".vnal");
+    if((ConcatOut.pfile_outh264 == 0) || (ConcatOut.pfile_outvinf == 0) || (NalIndexMode && (ConcatOut.pfile_outvnal == 0)))
+    {
+        printf("[Error] Open Concat Output File Error!! %s\r\n", base.c_str());
+        if(ConcatOut.pfile_outh264 != 0) fclose(ConcatOut.pfile_outh264);
+        if(ConcatOut.pfile_outvinf != 0) fclose(ConcatOut.pfile_outvinf);
+        if(ConcatOut.pfile_outvnal != 0) fclose(ConcatOut.pfile_outvnal);
+        ConcatOut.pfile_outh264 = 0;
+        ConcatOut.pfile_outvinf = 0;
+        ConcatOut.pfile_outvnal = 0;
+        return -3;
+    }
+    Io_OpenWriter(ConcatOut);
+    printf("Concat Output:%s\r\n", h264_name.c_str());
+    return 0;
+}
 
-    //  检查指针
-    if(pdat == 0) return false;
+//  开始一个片段,第一个片段时写入信息文件头部(总帧数在关闭时修正),
+//  写入片段标记,SPS/PPS与上一个片段不同时重新写入
+//  成功返回0,失败返回-4 ~ -7
+int Concat_BeginClip(std::string input_file)
+{
+    //  信息文件头部使用第一个片段的参数
+    if(ConcatClipCnt == 0)
+    {
+        fprintf(ConcatOut.pfile_outvinf, "%d %d %0.1f %ld\r\n",
+                ffmpeg_context.Width,
+                ffmpeg_context.Height,
+                ffmpeg_context.FrameRate,
+                0L
+               );
+        Conv_WriteLayoutInfo(ConcatOut.pfile_outvinf);
+    }
 
-    //  当为SEI
-    if((pdat[4] == 0x06)  &&    //  为SEI数据头
-       (pdat[5] == 0x05)        //  暂时只支持user_data_unregistered()语法
-      )
+    //  参数集是否变化
+    std::vector<unsigned char> sps(ffmpeg_context.sps_dat, ffmpeg_context.sps_dat + ffmpeg_context.sps_len);
+    std::vector<unsigned char> pps(ffmpeg_context.pps_dat, ffmpeg_context.pps_dat + ffmpeg_context.pps_len);
+    bool changed = (ConcatClipCnt == 0) || (sps != ConcatSps) || (pps != ConcatPps);
+
+    //  片段标记
+    fprintf(ConcatOut.pfile_outvinf, "#CLIP %d %lu %d %d %0.1f %d %s\r\n",
+            ConcatClipCnt,
+            ConcatOut.frame_cnt,
+            ffmpeg_context.Width,
+            ffmpeg_context.Height,
+            ffmpeg_context.FrameRate,
+            changed ? 1 : 0,
+            GetFileNameExFromPath(input_file).c_str()
+           );
+    if(changed) H264_WriteSpsInfo(ConcatOut.pfile_outvinf);
+    ConcatOut.clip_start = ConcatOut.frame_cnt;
+    ConcatOut.frame_byte_cnt = 0;
+    ConcatOut.frame_crc = 0;
+    ConcatClipCnt++;
+
+    //  写入新的参数集
+    if(changed)
+    {
+        ConcatSps = sps;
+        ConcatPps = pps;
+        return Conv_WriteHeader(ConcatOut);
+    }
+    return 0;
+}
+
+//  关闭拼接输出,修正信息文件头部的总帧数
+void Concat_Close(std::string vinf_name)
+{
+    Io_CloseWriter(ConcatOut);
+    if(ConcatOut.pfile_outvinf != 0) fclose(ConcatOut.pfile_outvinf);
+    ConcatOut.pfile_outvinf = 0;
+    if(ConcatClipCnt > 0) Conv_FixVinfHeader(vinf_name, ConcatOut.frame_cnt);
+    printf("Concat Finish: clips=%d frames=%lu bytes=%llu\r\n",
+           ConcatClipCnt, ConcatOut.frame_cnt, ConcatOut.byte_cnt);
+    Nal_Close(ConcatOut);
+    if(AlignSize > 1) Conv_PrintPadStat(ConcatOut);
+}
+
+//  转换一个视频文件
+//  成功返回0,打开失败返回-2,写入失败返回-3 ~ -7,校验失败返回-13,预演时没有采样表返回-15,
+//  H265使用不支持的输出方式(RTP、拼接)返回-16,转码时像素转换或编码失败返回-17
+//  处理的帧数和字节数通过result返回
+//  拼接模式时写入共享的拼接输出,不单独生成输出文件
+//  开启--recover时,容器无法打开(如没有moov)的文件按恢复模式扫描mdat
+int VideoConv_ConvFile(std::string input_file, SConvResult& result)
+{
+    //  打印当前正在处理的视频文件名字(源文件名字)
+    printf("-----Current Video Conv File:%s\r\n", input_file.c_str());
+
+    //  打开视频文件
+    int re = FFMpeg_OpenVideo(input_file);
+
+    //  打开失败
+    bool recover = false;
+    if(re != 0)
+    {
+        printf("[Error] Open Video File Error!! Return Code=%d\r\n", re);
+        FFMpeg_CloseVideo();
+
+        //  打开、搜索流信息失败或没有视频流时恢复,其他错误(如编码不支持)不恢复
+        if((RecoverRef == "") || (re < -3) || (Recover_Open(input_file) != 0)) return -2;
+        recover = true;
+    }
+
+    //------------------------------------------------------------------
+    //  预演模式,恢复时没有采样表
+    if(DryRunMode && recover)
     {
-        return true;
+        printf("[DryRun] Recovered file has no sample table!! %s\r\n", input_file.c_str());
+        FFMpeg_CloseVideo();
+        return -15;
     }
-    else
+    if(DryRunMode)
     {
-        return false;
+        re = Conv_DryRun(input_file, result);
+        FFMpeg_CloseVideo();
+        return re;
     }
-}
-
-//  获取SEI头部长度,同时获取UUID+用户区长度
-//  参数 pdat 为数据首地址
-//  参数 len 为数据有效长度
-//  返回的长度值 包含SEI头部
-//  即 NAL头部+代码类型+长度字节 的总长度
-//  失败返回小于0
-int H264_SEI_GetHeadLen(unsigned char* pdat, int len, int& uuid_content_len)
-{
-    //  当头部检查通过
-    if(!H264_CheckSEI_Inside(pdat, len)) return -1;
 
-    //  定义长度
-    int total_len = 0;
-    int byte_cnt = 0;
-    while(1)
+    //  RTP打包(RFC 6184)和拼接时的参数集比较只支持H264
+    if((ffmpeg_context.codec == ECodec_H265) && ((RtpCtx.fd >= 0) || (ConcatName != "")))
     {
-        //  获取当前长度字节
-        int tmp_len = pdat[4 + 1 + 1 + byte_cnt] & 0x0FF;
-
-        //  统计
-        byte_cnt++;
-        total_len += tmp_len;
+        printf("[Error] H265 does not support %s output!! %s\r\n",
+               (RtpCtx.fd >= 0) ? "RTP" : "concat", input_file.c_str());
+        FFMpeg_CloseVideo();
+        return -16;
+    }
 
-        //  当到达结尾
-        if(tmp_len != 0x0FF)
+    //------------------------------------------------------------------
+    //  拼接模式
+    if(ConcatName != "")
+    {
+        unsigned long frame_start = ConcatOut.frame_cnt;
+        unsigned long long byte_start = ConcatOut.byte_cnt;
+        re = Concat_BeginClip(input_file);
+        if(re == 0)
         {
-            break;
+            if(ffmpeg_context.transcode) re = Conv_RunTranscode(ConcatOut);
+            else if(PipelineMode)        re = Conv_RunPipeline(ConcatOut);
+            else                         re = Conv_RunSerial(ConcatOut);
         }
+        result.frames = ConcatOut.frame_cnt - frame_start;
+        result.bytes = ConcatOut.byte_cnt - byte_start;
+        FFMpeg_CloseVideo();
+        return re;
     }
 
-    //  设置UUID+用户区长度
-    uuid_content_len = total_len;
-
-    //  返回头部总长度
-    return 4 + 1 + 1 + byte_cnt;
-}
-
-//  获取SEI用户定义区长度
-//  参数 pdat 为数据首地址
-//  参数 len 为数据有效长度
-//  返回的长度值 包含SEI的用户数据区(通常为ASCII文本)
-//  即 自定义数据区 的总长度
-//  失败返回小于0
-int H264_SEI_GetContentLen(unsigned char* pdat, int len)
-{
-    //  获取头部长度 和 UUID+用户区总长度
-    int uuid_content_len = 0;
-    int re = H264_SEI_GetHeadLen(pdat, len, uuid_content_len);
-
-    //  检查
-    if((re >= (4 + 1 + 1 + 1)) &&
-       (uuid_content_len > 16)
-      )
+    //------------------------------------------------------------------
+    //  断点,推流、转码和跟随模式时不保存
+    //  从断点继续时先定位到断点的关键帧,定位失败时重新打开输入从头转换
+    SCheckpoint ckpt;
+    bool resume = false;
+    CkptName = "";
+    CkptSaveCnt = 0;
+    CkptLastMs = Pipe_NowMs();
+    if((CkptSec > 0) && !ffmpeg_context.transcode && !FollowMode && !recover && (RtpCtx.fd < 0) && (StreamFd < 0) &&
+       (Ckpt_StatInput(input_file, CkptInput) == 0))
     {
-        return uuid_content_len - 16;
+        CkptName = Conv_GetOutputName(input_file, ".ckpt");
     }
-    //  错误
-    else
+    if(ResumeMode && (CkptName != "") && (Ckpt_Load(CkptName, ckpt) == 0))
     {
-        return -1;
+        if(Ckpt_Seek(ckpt) == 0)
+        {
+            resume = true;
+            printf("[Resume] From frame %lu, h264=%llu bytes\r\n", ckpt.frame_cnt, ckpt.h264_bytes);
+            if(AnalyzeName != "") printf("[Resume] Analysis covers resumed frames only\r\n");
+        }
+        else
+        {
+            printf("[Resume] Checkpoint frame not found, convert from start\r\n");
+            FFMpeg_CloseVideo();
+            if(FFMpeg_OpenVideo(input_file) != 0)
+            {
+                printf("[Error] Reopen Video File Error!!\r\n");
+                FFMpeg_CloseVideo();
+                return -2;
+            }
+        }
     }
-}
 
-//  获取SEI总长度
-//  参数 pdat 为数据首地址
-//  参数 len 为数据有效长度
-//  返回的长度值 包含整个SEI数据段
-//  即 NAL头部+代码类型+长度字节+UUID+自定义数据区+结尾字节 的总长度
-//  失败返回小于0
-int H264_SEI_GetTotalDataLen_SEI(unsigned char* pdat, int len)
-{
-    //  当头部检查通过
-    if(!H264_CheckSEI_Inside(pdat, len)) return -1;
+    //  输出上下文
+    SConvOutput out;
+    out.frame_byte_cnt = 0;
+    out.frame_cnt = resume ? ckpt.frame_cnt : 0UL;
+    out.byte_cnt = resume ? ckpt.h264_bytes : 0ULL;
+    out.clip_start = 0UL;
+    out.frame_crc = 0;
+    out.map_fd = -1;
+    out.p_map = 0;
+    out.map_size = 0ULL;
+    out.map_pos = 0ULL;
+    out.pad_cnt = resume ? ckpt.pad_cnt : 0ULL;
+    out.pfile_outvnal = 0;
+    out.p_uring = 0;
+    out.write_ms = 0.0;
+    Analyze_Reset(FileAnalyze);
+    Pool_ResetStat();
+
+    //  写入视频信息文件,从断点继续时截断到断点
+    std::string output_vinf_name = Conv_GetOutputName(input_file, ".vinf");
+#if DEBUG_LOG
+    printf("Output Video Info File Name:%s\r\n", output_vinf_name.c_str());
+#endif
+    if(resume) out.pfile_outvinf = Ckpt_OpenTruncate(output_vinf_name, ckpt.vinf_bytes);
+    else       out.pfile_outvinf = fopen(output_vinf_name.c_str(), "wb");
+    if(out.pfile_outvinf == 0)
+    {
+        printf("[Error] Open Video Info File Error!! %s\r\n", output_vinf_name.c_str());
+        FFMpeg_CloseVideo();
+        return -3;
+    }
 
-    //  获取SEI头部的长度 和 UUID+用户区总长度
-    int uuid_content_len = 0;
-    int head_len = H264_SEI_GetHeadLen(pdat, len, uuid_content_len);
+    //  写入信息
+    if(!resume)
+    {
+        fprintf(out.pfile_outvinf, "%d %d %0.1f %ld\r\n",
+                ffmpeg_context.Width,
+                ffmpeg_context.Height,
+                ffmpeg_context.FrameRate,
+                ffmpeg_context.TotalFrame
+               );
+        H264_WriteSpsInfo(out.pfile_outvinf);
+        Conv_WriteLayoutInfo(out.pfile_outvinf);
+    }
 
-    //  检查获取结果
-    if((head_len >= (4 + 1 + 1 + 1)) &&
-       (uuid_content_len > 16)
-      )
+    //  创建只写文件(输出纯H264的视频流文件)
+    std::string output_h264_name = Conv_GetOutputName(input_file, Codec_OutputExt());
+#if DEBUG_LOG
+    printf("Output Video H264 File Name:%s\r\n", output_h264_name.c_str());
+#endif  //  DEBUG_LOG
+    //  推流时不生成H264文件
+    out.pfile_outh264 = 0;
+    if(RtpCtx.fd >= 0)
     {
+        Stream_ResetPacer();
+        Rtp_BeginFile();
+        Rtp_WriteSdp(Conv_GetOutputName(input_file, ".sdp"));
+    }
+    else if(StreamFd >= 0)
+    {
+        Stream_ResetPacer();
     }
-    //  错误
     else
     {
-        return -1;
+        //  预分配并内存映射,失败时使用普通文件,从断点继续时使用普通文件
+        unsigned long long map_size = (MmapMode && !resume && !recover) ? Mmap_EstimateSize() : 0ULL;
+        if((map_size > 0ULL) && (Mmap_Open(out, output_h264_name, map_size) != 0))
+        {
+            printf("[Mmap] Presize Output Error, use stdio!! %s\r\n", strerror(errno));
+        }
+        if(resume)              out.pfile_outh264 = Ckpt_OpenTruncate(output_h264_name, ckpt.h264_bytes);
+        else if(out.p_map == 0) out.pfile_outh264 = fopen(output_h264_name.c_str(), "wb");
+        if((out.p_map == 0) && (out.pfile_outh264 == 0))
+        {
+            printf("[Error] Open H264 File Error!! %s\r\n", output_h264_name.c_str());
+            fclose(out.pfile_outvinf);
+            FFMpeg_CloseVideo();
+            return -3;
+        }
+        Io_OpenWriter(out);
     }
 
-    //  计算总长度
-    return head_len + uuid_content_len + 1;
-}
+    //  NAL子索引,RTP按NAL发送,不需要
+    if(NalIndexMode && (RtpCtx.fd < 0))
+    {
+        std::string vnal_name = Conv_GetOutputName(input_file, ".vnal");
+        if(resume)
+        {
+            out.pfile_outvnal = Ckpt_OpenTruncate(vnal_name, ckpt.vnal_bytes);
+            NalFrameBuf.clear();
+            NalFrameCnt = 0;
+            NalFrameEnd = 0;
+            NalTotalCnt = ckpt.nal_cnt;
+        }
+        else
+        {
+            out.pfile_outvnal = Nal_Open(vnal_name);
+        }
+        if(out.pfile_outvnal == 0)
+        {
+            Io_CloseWriter(out);
+            if(out.p_map != 0) Mmap_Close(out);
+            fclose(out.pfile_outvinf);
+            FFMpeg_CloseVideo();
+            return -3;
+        }
+    }
 
+    //  开始写入一些关键头部信息,从断点继续时已经在文件中
+    re = resume ? 0 : Conv_WriteHeader(out);
+    if(re != 0)
+    {
+        Io_CloseWriter(out);
+        if(out.p_map != 0) Mmap_Close(out);
+        if(out.pfile_outvnal != 0) fclose(out.pfile_outvnal);
+        fclose(out.pfile_outvinf);
+        FFMpeg_CloseVideo();
+        return re;
+    }
 
-//  从SEI区域中提取UUID(固定16个字节)(SEI payload UUID)
-//  参数 pdat 为数据首地址
-//  参数 len 为数据有效长度
-//  操作成功返回有16个字节长度的容器,失败返回空容器
-std::vector<unsigned char> H264_SEI_GetUUID(unsigned char* pdat, int len)
-{
-    //  定义返回变量
-    std::vector<unsigned char> re_vec;
+    //  循环写入每一帧的码流
+    //  分段并行不能使用时返回1,改用其他方式
+    //  分段并行各线程直接pwrite,不与io_uring写入混用
+    re = 1;
+    if((SplitCount > 1) && !ffmpeg_context.transcode && !recover && (out.p_uring == 0) && !resume &&
+       ((out.pfile_outh264 != 0) || (out.p_map != 0)))
+    {
+        re = Conv_RunSplit(out, input_file);
+    }
+    if(re == 1)
+    {
+        if(ffmpeg_context.transcode) re = Conv_RunTranscode(out);
+        else if(PipelineMode)        re = Conv_RunPipeline(out);
+        else                         re = Conv_RunSerial(out);
+    }
 
-    //  计算偏移
-    int uuid_content_len = 0;
-    int uuid_offset = H264_SEI_GetHeadLen(pdat, len, uuid_content_len);
+    //  关闭输出文件
+    if((Io_CloseWriter(out) != 0) && (re == 0)) re = -3;
+    if(out.p_map != 0) Mmap_Close(out);
+    if(AlignSize > 1) Conv_PrintPadStat(out);
+    Nal_Close(out);
+    if((StreamFd >= 0) || (RtpCtx.fd >= 0)) Stream_PrintStat();
+    if(RtpCtx.fd >= 0) Rtp_PrintStat();
+    Pool_PrintStat();
 
-    //  检查
-    if(uuid_offset <= 0) return re_vec;
+    //  视频信息文件写入完成
+    fclose(out.pfile_outvinf);
 
-    //  复制信息
-    int i=0;
-    for(i=0;i<16;i++)
+    //  实际帧数与头部不一致时修正头部(如转码、丢弃了损坏的包)
+    if((re == 0) && (out.frame_cnt != ffmpeg_context.TotalFrame))
     {
-        re_vec.insert(re_vec.end(), pdat[uuid_offset + i]);
+        Conv_FixVinfHeader(output_vinf_name, out.frame_cnt);
     }
 
-    //  返回
-    return re_vec;
-}
+    //  码流分析
+    if((re == 0) && (AnalyzeName != ""))
+    {
+        Analyze_EndFile(input_file, Conv_GetOutputName(input_file, ".json"));
+    }
 
-//  从SEI区域中提取用户自定义数据(SEI payload content)
-//  参数 pdat 为数据首地址
-//  参数 len 为数据有效长度
-//  操作成功返回非0字节长度的容器,失败返回空容器
-std::vector<unsigned char> H264_SEI_GetContent(unsigned char* pdat, int len)
-{
-    //  定义返回变量
-    std::vector<unsigned char> re_vec;
+    //  成功时删除断点文件,失败时保留用于--resume
+    if(CkptName != "")
+    {
+        if(CkptSaveCnt > 0) printf("[Ckpt] Saved %d checkpoints\r\n", CkptSaveCnt);
+        if(re == 0) remove(CkptName.c_str());
+        CkptName = "";
+    }
 
-    //  计算偏移
-    int uuid_content_len = 0;
-    int uuid_offset = H264_SEI_GetHeadLen(pdat, len, uuid_content_len);
+    //  记录结果
+    result.frames = out.frame_cnt;
+    result.bytes = out.byte_cnt;
 
-    //  检查
-    if(uuid_offset <= 0) return re_vec;
-    if(uuid_content_len <= 16) return re_vec;
+    //  释放相关资源
+    bool transcode = ffmpeg_context.transcode;
+    FFMpeg_CloseVideo();
 
-    //  计算偏移
-    int content_offset = uuid_offset + 16;
+    //  校验输出,转码的输出与源文件的解码结果本来就不同,不做对比
+    if((re == 0) && VerifyMode && ((StreamFd >= 0) || (RtpCtx.fd >= 0)))
+    {
+        printf("[Verify] Stream output, skip verify\r\n");
+    }
+    else if((re == 0) && VerifyMode)
+    {
+        if(transcode && VerifySource) printf("[Verify] Transcoded output, skip source compare\r\n");
+        if(recover && VerifySource)   printf("[Verify] Recovered input can not be decoded, skip source compare\r\n");
+        re = Verify_File(input_file, output_h264_name, output_vinf_name, VerifySource && !transcode && !recover);
+    }
+    return re;
+}
 
-    //  计算长度
-    int content_len = uuid_content_len - 16;
+//---------------------------------------------------------------------
+//  批量处理相关函数
 
-    //  复制信息
+//  解析清单文件中的一行,拆分为路径和若干个 键=值 选项
+//  空行或注释行返回false
+bool Batch_ParseManifestLine(std::string line, SInputItem& item)
+{
+    //  拆分成单词,双引号中的空格不作为分隔
+    std::vector<std::string> words;
+    std::string word;
+    bool in_quote = false;
+    bool has_word = false;
+    int len = line.size();
     int i=0;
-    for(i=0;i<content_len;i++)
+    for(i=0;i<len;i++)
     {
-        re_vec.insert(re_vec.end(), pdat[content_offset + i]);
+        char ch = line.at(i);
+        if(ch == '"')
+        {
+            in_quote = !in_quote;
+            has_word = true;
+        }
+        else if(((ch == ' ') || (ch == '\t')) && !in_quote)
+        {
+            if(has_word) words.push_back(word);
+            word.clear();
+            has_word = false;
+        }
+        else
+        {
+            word += ch;
+            has_word = true;
+        }
     }
+    if(has_word) words.push_back(word);
 
-    //  返回
-    return re_vec;
-}
+    //  空行或者注释行
+    if(words.size() == 0) return false;
+    if(words.at(0).at(0) == '#') return false;
 
-//  以ASCII形式dump出vector中的信息
-void ASCII_DumpVector(std::vector<unsigned char> in_vec)
-{
-    //  检查长度
-    int len = in_vec.size();
-    if(len <= 0)
+    //  第一个单词为文件路径,其余为选项
+    item.path = words.at(0);
+    for(i=1;i<(int)words.size();i++)
     {
-        printf("[Error] [Vector is NULL!!]\r\n");
-        return;
+        std::string key = words.at(i);
+        std::string value;
+        size_t pos = key.find('=');
+        if(pos != std::string::npos)
+        {
+            value = key.substr(pos + 1);
+            key = key.substr(0, pos);
+        }
+        if(key == "out")           item.out_path = value;
+        else if(key == "pipeline") item.pipeline = atoi(value.c_str());
+        else printf("[Warning] Unknown Manifest Option:%s (%s)\r\n", key.c_str(), item.path.c_str());
     }
+    return true;
+}
 
-    //  申请内存
-    unsigned char* pbuf = new unsigned char[len + 1];
-    if(pbuf == 0)
+//  读取清单文件,将其中的文件追加到输入列表
+//  成功返回0,打开失败返回-1
+int Batch_LoadManifest(std::string manifest_name)
+{
+    FILE* pfile = fopen(manifest_name.c_str(), "rb");
+    if(pfile == 0)
     {
-        printf("[Error] new Error!!\r\n");
-        return;
+        printf("[Error] Open Manifest File Error!! %s\r\n", manifest_name.c_str());
+        return -1;
     }
-    memset(pbuf, 0, len + 1);
 
-    //  复制数据
-    int i=0;
-    for(i=0;i<len;i++)
+    char line[4096];
+    while(fgets(line, sizeof(line), pfile) != 0)
     {
-        pbuf[i] = in_vec.at(i);
+        SInputItem item;
+        item.index = 0;
+        item.pipeline = -1;
+        if(Batch_ParseManifestLine(DeleteNR(line), item))
+        {
+            InputFileVec.insert(InputFileVec.end(), item);
+        }
     }
+    fclose(pfile);
+    return 0;
+}
 
-    //  打印
-    printf("%s\r\n", pbuf);
+//  写入报告文件头部
+void Batch_WriteReportHeader(FILE* pfile, int total)
+{
+    fprintf(pfile, "# VideoConv report shard=%d/%d total=%d\r\n", ShardIndex, ShardCount, total);
+}
 
-    //  结束
-    delete [] pbuf;
+//  写入一个文件的结果
+void Batch_WriteReportLine(FILE* pfile, const SConvResult& result)
+{
+    fprintf(pfile, "%d\t%s\t%d\t%lu\t%llu\t%.3f\t%s\r\n",
+            result.index,
+            (result.code == 0) ? "OK" : "FAIL",
+            result.code,
+            result.frames,
+            result.bytes,
+            result.seconds,
+            result.path.c_str()
+           );
+    fflush(pfile);
 }
 
-//  以十六进制dump出UUID值
-void HexUUID_DumpVector(std::vector<unsigned char> in_vec)
+//  读取一个报告文件,结果追加到容器中,报告头部中的输入总数通过total返回
+//  成功返回0,打开失败返回-1
+int Batch_LoadReport(std::string report_name, std::vector<SConvResult>& results, int& total)
 {
-    //  检查长度
-    int len = in_vec.size();
-    if(len != 16)
+    FILE* pfile = fopen(report_name.c_str(), "rb");
+    if(pfile == 0)
     {
-        printf("[Error] UUID len Error!!\r\n");
-        return;
+        printf("[Error] Open Report File Error!! %s\r\n", report_name.c_str());
+        return -1;
     }
 
-    //  申请内存
-    unsigned char* pbuf = new unsigned char[len];
-    if(pbuf == 0)
+    char line[4096];
+    while(fgets(line, sizeof(line), pfile) != 0)
     {
-        printf("[Error] new Error!!\r\n");
-        return;
+        std::string str = DeleteNR(line);
+        if(str.size() == 0) continue;
+
+        //  头部
+        if(str.at(0) == '#')
+        {
+            size_t pos = str.find("total=");
+            if(pos != std::string::npos)
+            {
+                int t = atoi(str.c_str() + pos + 6);
+                if(t > total) total = t;
+            }
+            continue;
+        }
+
+        //  结果行,输入文件名放在最后,可能含有空格
+        SConvResult result;
+        char status[16];
+        int path_offset = 0;
+        if(sscanf(str.c_str(), "%d\t%15s\t%d\t%lu\t%llu\t%lf\t%n",
+                  &result.index, status, &result.code,
+                  &result.frames, &result.bytes, &result.seconds, &path_offset) < 6)
+        {
+            printf("[Warning] Bad Report Line:%s\r\n", str.c_str());
+            continue;
+        }
+        result.path = str.substr(path_offset);
+        results.push_back(result);
     }
-    memset(pbuf, 0, len);
+    fclose(pfile);
+    return 0;
+}
 
-    //  打印UUID的各个部分
+//  合并多个分片的报告
+//  按序号排序,同一序号出现多次时以后面的报告为准,并检查是否有缺失的序号
+//  成功返回0,有文件失败或缺失返回-1,读写报告出错返回-2
+int Batch_MergeReports(std::string output_name, std::vector<SInputItem>& report_vec)
+{
+    std::vector<SConvResult> results;
+    int total = 0;
     int i=0;
-    for(i=0;i<4;i++)
+    for(i=0;i<(int)report_vec.size();i++)
     {
-        printf("%02X" ,in_vec.at(i));
+        if(Batch_LoadReport(report_vec.at(i).path, results, total) != 0) return -2;
     }
-    printf("-");
-    for(i=0;i<2;i++)
+
+    //  按序号排序(稳定排序,保证后面的报告排在后面)
+    std::stable_sort(results.begin(), results.end(),
+                     [](const SConvResult& a, const SConvResult& b) { return a.index < b.index; });
+
+    //  去重
+    std::vector<SConvResult> merged;
+    for(i=0;i<(int)results.size();i++)
     {
-        printf("%02X" ,in_vec.at(4 + i));
+        if((merged.size() > 0) && (merged.back().index == results.at(i).index)) merged.back() = results.at(i);
+        else merged.push_back(results.at(i));
     }
-    printf("-");
-    for(i=0;i<2;i++)
+
+    //  写入合并后的报告
+    FILE* pfile = fopen(output_name.c_str(), "wb");
+    if(pfile == 0)
     {
-        printf("%02X" ,in_vec.at(4 + 2 + i));
+        printf("[Error] Open Merge Output File Error!! %s\r\n", output_name.c_str());
+        return -2;
     }
-    printf("-");
-    for(i=0;i<2;i++)
+    ShardIndex = 0;
+    ShardCount = 1;
+    Batch_WriteReportHeader(pfile, total);
+
+    int ok_cnt = 0;
+    int fail_cnt = 0;
+    unsigned long frames = 0UL;
+    unsigned long long bytes = 0ULL;
+    double seconds = 0.0;
+    for(i=0;i<(int)merged.size();i++)
     {
-        printf("%02X" ,in_vec.at(4 + 2 + 2 + i));
+        Batch_WriteReportLine(pfile, merged.at(i));
+        if(merged.at(i).code == 0) ok_cnt++;
+        else                       fail_cnt++;
+        frames += merged.at(i).frames;
+        bytes += merged.at(i).bytes;
+        seconds += merged.at(i).seconds;
     }
-    printf("-");
-    for(i=0;i<6;i++)
+    fclose(pfile);
+
+    //  统计缺失的序号
+    int missing_cnt = total - (int)merged.size();
+    if(missing_cnt < 0) missing_cnt = 0;
+
+    printf("Merge Report: ok=%d fail=%d missing=%d frames=%lu bytes=%llu cpu_time=%.1fs\r\n",
+           ok_cnt, fail_cnt, missing_cnt, frames, bytes, seconds);
+    if(missing_cnt > 0)
     {
-        printf("%02X" ,in_vec.at(4 + 2 + 2 + 2 + i));
+        int idx = 0;
+        int j = 0;
+        printf("Missing Index:");
+        for(idx=0;idx<total;idx++)
+        {
+            while((j < (int)merged.size()) && (merged.at(j).index < idx)) j++;
+            if((j >= (int)merged.size()) || (merged.at(j).index != idx)) printf(" %d", idx);
+        }
+        printf("\r\n");
     }
-    printf("\r\n");
 
-    //  结束
-    delete [] pbuf;
+    if((fail_cnt > 0) || (missing_cnt > 0)) return -1;
+    return 0;
 }
 
 //---------------------------------------------------------------------
@@ -875,6 +8087,7 @@ int main(int argc, char** argv)
 {
     //  初始化参数
     ffmpeg_context.p_fmt_ctx = NULL;
+    ffmpeg_context.p_avio = NULL;
     ffmpeg_context.p_codec_ctx = NULL;
     ffmpeg_context.p_codec_par = NULL;
     ffmpeg_context.p_codec = NULL;
@@ -884,17 +8097,31 @@ int main(int argc, char** argv)
     ffmpeg_context.video_stream = 0;
     ffmpeg_context.audio_stream = 0;
 
+    ffmpeg_context.codec = ECodec_H264;
+    ffmpeg_context.vps_dat = 0;
+    ffmpeg_context.vps_len = 0;
     ffmpeg_context.sps_dat = 0;
     ffmpeg_context.sps_len = 0;
     ffmpeg_context.pps_dat = 0;
     ffmpeg_context.pps_len = 0;
+    ffmpeg_context.slice_extra_bits = 0;
 
     ffmpeg_context.avcodec_open_already = false;
+    ffmpeg_context.transcode = false;
+    ffmpeg_context.framing = EFraming_AVCC;
+    ffmpeg_context.nal_length_size = 4;
+    ffmpeg_context.framing_checked = false;
+    ffmpeg_context.sps_valid = false;
+    ffmpeg_context.p_enc_ctx = NULL;
+    ffmpeg_context.p_sws_ctx = NULL;
+    ffmpeg_context.p_tc_frame = NULL;
 
     ffmpeg_context.FrameRate = 0.0f;
     ffmpeg_context.Width = 0;
     ffmpeg_context.Height = 0;
     ffmpeg_context.TotalFrame = 0UL;
+    RtpCtx.fd = -1;
+    RecoverCtx.fd = -1;
 
     //  检查输入参数
     if(argc < 2)
@@ -913,13 +8140,113 @@ int main(int argc, char** argv)
             //  当为表示输出路径设置的开关
             if(strcmp("-o", argv[i]) == 0)
             {
-                CurrentInputType = EInputType_OutputPath;
+                CurrentInputType = EInputType_OutputPath;
+            }
+            //  流水线模式
+            else if(strcmp("--pipeline", argv[i]) == 0)
+            {
+                PipelineMode = true;
+            }
+            //  流水线队列深度
+            else if(strcmp("--pipeline-depth", argv[i]) == 0)
+            {
+                CurrentInputType = EInputType_PipelineDepth;
+            }
+            //  清单文件
+            else if(strcmp("--manifest", argv[i]) == 0)
+            {
+                CurrentInputType = EInputType_Manifest;
+            }
+            //  分片
+            else if(strcmp("--shard", argv[i]) == 0)
+            {
+                CurrentInputType = EInputType_Shard;
+            }
+            //  出错继续
+            else if(strcmp("--keep-going", argv[i]) == 0)
+            {
+                KeepGoing = true;
+            }
+            //  结果报告
+            else if(strcmp("--report", argv[i]) == 0)
+            {
+                CurrentInputType = EInputType_Report;
+            }
+            //  合并报告
+            else if(strcmp("--merge-reports", argv[i]) == 0)
+            {
+                CurrentInputType = EInputType_MergeReports;
             }
+            //  转码相关
+            else if(strcmp("--transcode", argv[i]) == 0)   TranscodeMode = true;
+            else if(strcmp("--tc-encoder", argv[i]) == 0)  CurrentInputType = EInputType_TcEncoder;
+            else if(strcmp("--tc-profile", argv[i]) == 0)  CurrentInputType = EInputType_TcProfile;
+            else if(strcmp("--tc-level", argv[i]) == 0)    CurrentInputType = EInputType_TcLevel;
+            else if(strcmp("--tc-preset", argv[i]) == 0)   CurrentInputType = EInputType_TcPreset;
+            else if(strcmp("--tc-crf", argv[i]) == 0)      CurrentInputType = EInputType_TcCrf;
+            else if(strcmp("--tc-bitrate", argv[i]) == 0)  CurrentInputType = EInputType_TcBitrate;
+            else if(strcmp("--tc-gop", argv[i]) == 0)      CurrentInputType = EInputType_TcGop;
+            else if(strcmp("--tc-threads", argv[i]) == 0)  CurrentInputType = EInputType_TcThreads;
+            //  校验相关
+            else if(strcmp("--verify", argv[i]) == 0)         VerifyMode = true;
+            else if(strcmp("--verify-source", argv[i]) == 0)  { VerifyMode = true; VerifySource = true; }
+            else if(strcmp("--verify-threads", argv[i]) == 0) CurrentInputType = EInputType_VerifyThreads;
+            //  推流相关
+            else if(strcmp("--stream", argv[i]) == 0)         CurrentInputType = EInputType_Stream;
+            else if(strcmp("--pace", argv[i]) == 0)           CurrentInputType = EInputType_StreamPace;
+            //  RTP相关
+            else if(strcmp("--rtp", argv[i]) == 0)            CurrentInputType = EInputType_Rtp;
+            else if(strcmp("--rtp-mtu", argv[i]) == 0)        CurrentInputType = EInputType_RtpMtu;
+            else if(strcmp("--rtp-pt", argv[i]) == 0)         CurrentInputType = EInputType_RtpPt;
+            //  拼接
+            else if(strcmp("--concat", argv[i]) == 0)         CurrentInputType = EInputType_Concat;
+            //  CRC相关
+            else if(strcmp("--crc", argv[i]) == 0)            CrcMode = true;
+            else if(strcmp("--check", argv[i]) == 0)          CheckMode = true;
+            //  内存映射输出
+            else if(strcmp("--mmap", argv[i]) == 0)           MmapMode = true;
+            //  码流分析
+            else if(strcmp("--analyze", argv[i]) == 0)        CurrentInputType = EInputType_Analyze;
+            else if(strcmp("--analyze-window", argv[i]) == 0) CurrentInputType = EInputType_AnalyzeWindow;
+            //  分段并行
+            else if(strcmp("--split", argv[i]) == 0)          CurrentInputType = EInputType_Split;
+            //  预演模式
+            else if(strcmp("--dry-run", argv[i]) == 0)        DryRunMode = true;
+            //  帧对齐和AUD
+            else if(strcmp("--align", argv[i]) == 0)          CurrentInputType = EInputType_Align;
+            else if(strcmp("--pad", argv[i]) == 0)            CurrentInputType = EInputType_Pad;
+            else if(strcmp("--aud", argv[i]) == 0)            AudMode = true;
+            //  输出封装格式
+            else if(strcmp("--framing", argv[i]) == 0)        CurrentInputType = EInputType_Framing;
+            //  NAL子索引
+            else if(strcmp("--nal-index", argv[i]) == 0)      NalIndexMode = true;
+            //  读写后端
+            else if(strcmp("--io", argv[i]) == 0)             CurrentInputType = EInputType_Io;
+            //  跟随模式
+            else if(strcmp("--follow", argv[i]) == 0)         CurrentInputType = EInputType_Follow;
+            else if(strcmp("--sync-ms", argv[i]) == 0)        CurrentInputType = EInputType_SyncMs;
+            //  断点和继续
+            else if(strcmp("--checkpoint", argv[i]) == 0)     CurrentInputType = EInputType_Checkpoint;
+            else if(strcmp("--resume", argv[i]) == 0)         ResumeMode = true;
+            //  时间线跟踪
+            else if(strcmp("--trace", argv[i]) == 0)          CurrentInputType = EInputType_Trace;
+            //  内存预算
+            else if(strcmp("--mem-budget", argv[i]) == 0)     CurrentInputType = EInputType_MemBudget;
+            //  损坏文件恢复
+            else if(strcmp("--recover", argv[i]) == 0)        CurrentInputType = EInputType_Recover;
+            else if(strcmp("--recover-fps", argv[i]) == 0)    CurrentInputType = EInputType_RecoverFps;
+            //  自定义输入读取
+            else if(strcmp("--io-buffer", argv[i]) == 0)      CurrentInputType = EInputType_IoBuffer;
+            else if(strcmp("--readahead", argv[i]) == 0)      CurrentInputType = EInputType_Readahead;
             //  其他情况
             else
             {
                 //  将文件名含完整路径部分插入输入文件列表中
-                InputFileVec.insert(InputFileVec.end(), argv[i]);
+                SInputItem item;
+                item.path = argv[i];
+                item.index = 0;
+                item.pipeline = -1;
+                InputFileVec.insert(InputFileVec.end(), item);
             }
         }
         //  当为输出路径
@@ -931,329 +8258,538 @@ int main(int argc, char** argv)
             //  恢复开关到默认
             CurrentInputType = EInputType_None;
         }
-        //  错误类型
-        else
+        //  当为流水线队列深度
+        else if(CurrentInputType == EInputType_PipelineDepth)
         {
-            printf("Error Input Type!!\r\n");
-            return -2;
+            PipelineDepth = atoi(argv[i]);
+            if(PipelineDepth < 2) PipelineDepth = 2;
+            CurrentInputType = EInputType_None;
         }
-    }
-
-    //  打印识别结果
-    int input_file_total = InputFileVec.size();
-#if DEBUG_LOG
-    printf("Total Input File Count is %d\r\n", input_file_total);
-    printf("Input File List:\r\n");
-    for(i=0;i<input_file_total;i++)
-    {
-        printf("    %s\r\n", InputFileVec.at(i).c_str());
-    }
-#endif  //  DEBUG_LOG
-
-    //  定义返回值
-    int re = 0;
-
-    //  循环操作视频文件
-    for(i=0;i<input_file_total;i++)
-    {
-        //  打印当前正在处理的视频文件名字(源文件名字)
-        printf("-----Current Video Conv File:%s\r\n", InputFileVec.at(i).c_str());
-
-        //  提取输入视频文件的路径
-        std::string input_video_path = GetOnlyFilePath(InputFileVec.at(i));
-
-        //  提取纯文件名部分(不含扩展名)
-        std::string input_video_only_name = GetOnlyFileNameNoEx(InputFileVec.at(i));
-
-        //  打开视频文件
-        re = FFMpeg_OpenVideo(InputFileVec.at(i));
-
-        //  当打开成功
-        if(re == 0)
+        //  当为清单文件
+        else if(CurrentInputType == EInputType_Manifest)
+        {
+            if(Batch_LoadManifest(argv[i]) != 0) return -2;
+            CurrentInputType = EInputType_None;
+        }
+        //  当为分片设置
+        else if(CurrentInputType == EInputType_Shard)
+        {
+            if((sscanf(argv[i], "%d/%d", &ShardIndex, &ShardCount) != 2) ||
+               (ShardCount < 1) || (ShardIndex < 0) || (ShardIndex >= ShardCount))
+            {
+                printf("Error Shard Arg!! %s\r\n", argv[i]);
+                return -2;
+            }
+            CurrentInputType = EInputType_None;
+        }
+        //  当为报告文件
+        else if(CurrentInputType == EInputType_Report)
+        {
+            ReportPath = argv[i];
+            CurrentInputType = EInputType_None;
+        }
+        //  当为合并报告的输出文件
+        else if(CurrentInputType == EInputType_MergeReports)
+        {
+            MergeOutputPath = argv[i];
+            CurrentInputType = EInputType_None;
+        }
+        //  当为转码相关参数
+        else if(CurrentInputType == EInputType_TcEncoder)
+        {
+            TranscodeEncoder = argv[i];
+            CurrentInputType = EInputType_None;
+        }
+        else if(CurrentInputType == EInputType_TcProfile)
+        {
+            TranscodeProfile = argv[i];
+            if((TranscodeProfile != "baseline") && (TranscodeProfile != "main") && (TranscodeProfile != "high"))
+            {
+                printf("Error Transcode Profile!! %s\r\n", argv[i]);
+                return -2;
+            }
+            CurrentInputType = EInputType_None;
+        }
+        else if(CurrentInputType == EInputType_TcLevel)
+        {
+            //  支持4.0和40两种写法
+            double level = atof(argv[i]);
+            TranscodeLevel = (level < 10.0) ? (int)(level * 10.0 + 0.5) : (int)level;
+            CurrentInputType = EInputType_None;
+        }
+        else if(CurrentInputType == EInputType_TcPreset)
+        {
+            TranscodePreset = argv[i];
+            CurrentInputType = EInputType_None;
+        }
+        else if(CurrentInputType == EInputType_TcCrf)
+        {
+            TranscodeCrf = atoi(argv[i]);
+            CurrentInputType = EInputType_None;
+        }
+        else if(CurrentInputType == EInputType_TcBitrate)
+        {
+            TranscodeBitrate = atoi(argv[i]);
+            CurrentInputType = EInputType_None;
+        }
+        else if(CurrentInputType == EInputType_TcGop)
         {
-            //  写入视频信息文件
-            std::string output_vinf_name;
-            //  当输出目录为空目录
-            if(OutputPath == "")
+            TranscodeGop = atoi(argv[i]);
+            CurrentInputType = EInputType_None;
+        }
+        else if(CurrentInputType == EInputType_TcThreads)
+        {
+            TranscodeThreads = atoi(argv[i]);
+            CurrentInputType = EInputType_None;
+        }
+        //  当为校验线程数
+        else if(CurrentInputType == EInputType_VerifyThreads)
+        {
+            VerifyThreads = atoi(argv[i]);
+            CurrentInputType = EInputType_None;
+        }
+        //  当为推流目标
+        else if(CurrentInputType == EInputType_Stream)
+        {
+            StreamTarget = argv[i];
+            CurrentInputType = EInputType_None;
+        }
+        //  当为RTP相关参数
+        else if(CurrentInputType == EInputType_Rtp)
+        {
+            RtpTarget = argv[i];
+            CurrentInputType = EInputType_None;
+        }
+        else if(CurrentInputType == EInputType_RtpMtu)
+        {
+            RtpMtu = atoi(argv[i]);
+            CurrentInputType = EInputType_None;
+        }
+        else if(CurrentInputType == EInputType_RtpPt)
+        {
+            RtpPt = atoi(argv[i]);
+            CurrentInputType = EInputType_None;
+        }
+        //  当为拼接输出名字
+        else if(CurrentInputType == EInputType_Concat)
+        {
+            ConcatName = argv[i];
+            CurrentInputType = EInputType_None;
+        }
+        //  当为分析汇总报告文件
+        else if(CurrentInputType == EInputType_Analyze)
+        {
+            AnalyzeName = argv[i];
+            CurrentInputType = EInputType_None;
+        }
+        //  当为单个文件的分段数
+        else if(CurrentInputType == EInputType_Split)
+        {
+            SplitCount = atoi(argv[i]);
+            if((SplitCount < 1) || (SplitCount > 256))
+            {
+                printf("Error Split Count!! %s\r\n", argv[i]);
+                return -2;
+            }
+            CurrentInputType = EInputType_None;
+        }
+        //  当为帧对齐字节数
+        else if(CurrentInputType == EInputType_Align)
+        {
+            AlignSize = atoi(argv[i]);
+            if((AlignSize < 1) || (AlignSize > 1024 * 1024) || ((AlignSize & (AlignSize - 1)) != 0))
             {
-                //  使用输入源文件路径
-                if(input_video_path == "") output_vinf_name = input_video_only_name + ".vinf";
-                else                       output_vinf_name = input_video_path + "/" + input_video_only_name + ".vinf";
+                printf("Error Align Size!! %s\r\n", argv[i]);
+                return -2;
             }
-            //  输出目录不为空
+            CurrentInputType = EInputType_None;
+        }
+        //  当为填充方式
+        else if(CurrentInputType == EInputType_Pad)
+        {
+            if(strcmp("zero", argv[i]) == 0)        PadFiller = false;
+            else if(strcmp("filler", argv[i]) == 0) PadFiller = true;
             else
             {
-                //  使用设定路径
-                output_vinf_name = OutputPath + "/" + input_video_only_name + ".vinf";
+                printf("Error Pad Arg!! %s\r\n", argv[i]);
+                return -2;
             }
-        #if DEBUG_LOG
-            printf("Output Video Info File Name:%s\r\n", output_vinf_name.c_str());
-        #endif
-            FILE* pfile_outvinf = fopen(output_vinf_name.c_str(), "wb");
-
-            //  写入信息
-            fprintf(pfile_outvinf, "%d %d %0.1f %ld\r\n",
-                    ffmpeg_context.Width,
-                    ffmpeg_context.Height,
-                    ffmpeg_context.FrameRate,
-                    ffmpeg_context.TotalFrame
-                   );
-
-            //  累计本帧字节数
-            int frame_byte_cnt = 0;
-
-            //  创建只写文件(输出纯H264的视频流文件)
-            std::string output_h264_name;
-            //  当输出目录为空目录
-            if(OutputPath == "")
+            CurrentInputType = EInputType_None;
+        }
+        //  当为输出封装格式
+        else if(CurrentInputType == EInputType_Framing)
+        {
+            if(strcmp("annexb", argv[i]) == 0)    OutFraming = EFraming_AnnexB;
+            else if(strcmp("avcc", argv[i]) == 0) OutFraming = EFraming_AVCC;
+            else
+            {
+                printf("Error Framing Arg!! %s\r\n", argv[i]);
+                return -2;
+            }
+            CurrentInputType = EInputType_None;
+        }
+        //  当为跟随模式的超时秒数
+        else if(CurrentInputType == EInputType_Follow)
+        {
+            FollowTimeoutSec = atoi(argv[i]);
+            if(FollowTimeoutSec <= 0)
+            {
+                printf("Error Follow Timeout!! %s\r\n", argv[i]);
+                return -2;
+            }
+            FollowMode = true;
+            CurrentInputType = EInputType_None;
+        }
+        //  当为跟随模式的同步间隔
+        else if(CurrentInputType == EInputType_SyncMs)
+        {
+            FollowSyncMs = atoi(argv[i]);
+            if(FollowSyncMs < 0)
+            {
+                printf("Error Sync Interval!! %s\r\n", argv[i]);
+                return -2;
+            }
+            CurrentInputType = EInputType_None;
+        }
+        //  当为断点间隔
+        else if(CurrentInputType == EInputType_Checkpoint)
+        {
+            CkptSec = atoi(argv[i]);
+            if(CkptSec <= 0)
+            {
+                printf("Error Checkpoint Interval!! %s\r\n", argv[i]);
+                return -2;
+            }
+            CurrentInputType = EInputType_None;
+        }
+        //  当为跟踪文件
+        else if(CurrentInputType == EInputType_Trace)
+        {
+            TraceName = argv[i];
+            CurrentInputType = EInputType_None;
+        }
+        //  当为内存预算
+        else if(CurrentInputType == EInputType_MemBudget)
+        {
+            MemBudgetMB = atoi(argv[i]);
+            if(MemBudgetMB < 0)
+            {
+                printf("Error Memory Budget!! %s\r\n", argv[i]);
+                return -2;
+            }
+            CurrentInputType = EInputType_None;
+        }
+        //  当为恢复模式的参考文件
+        else if(CurrentInputType == EInputType_Recover)
+        {
+            RecoverRef = argv[i];
+            CurrentInputType = EInputType_None;
+        }
+        //  当为恢复时的帧率
+        else if(CurrentInputType == EInputType_RecoverFps)
+        {
+            RecoverFps = atof(argv[i]);
+            if(RecoverFps <= 0.0f)
             {
-                //  使用输入源文件路径
-                if(input_video_path == "") output_h264_name = input_video_only_name + ".h264";
-                else                       output_h264_name = input_video_path + "/" + input_video_only_name + ".h264";
+                printf("Error Recover Frame Rate!! %s\r\n", argv[i]);
+                return -2;
             }
-            //  输出目录不为空
+            CurrentInputType = EInputType_None;
+        }
+        //  当为读写后端
+        else if(CurrentInputType == EInputType_Io)
+        {
+            if(strcmp("stdio", argv[i]) == 0)      IoMode = EIoMode_Stdio;
+            else if(strcmp("uring", argv[i]) == 0) IoMode = EIoMode_Uring;
             else
             {
-                //  使用设定路径
-                output_h264_name = OutputPath + "/" + input_video_only_name + ".h264";
+                printf("Error IO Arg!! %s\r\n", argv[i]);
+                return -2;
             }
-        #if DEBUG_LOG
-            printf("Output Video H264 File Name:%s\r\n", output_h264_name.c_str());
-        #endif  //  DEBUG_LOG
-            FILE* pfile_outh264 = fopen(output_h264_name.c_str(), "wb");
-
-            //  开始写入一些关键头部信息
-            //------------------------------------------------------------------
-            //  写入SPS
-            //  写入每个部分之前都先写入开始代码
-        #if DEBUG_LOG
-            printf("Begin Write SPS...\r\n");
-        #endif  //  DEBUG_LOG
-            re = fwrite(startcode, 1, sizeof(startcode), pfile_outh264);
-            if(re != sizeof(startcode))
+            CurrentInputType = EInputType_None;
+        }
+        //  当为输入读取缓冲区大小
+        else if(CurrentInputType == EInputType_IoBuffer)
+        {
+            AvioBufferKB = atoi(argv[i]);
+            if((AvioBufferKB < 0) || (AvioBufferKB > 1024 * 1024))
             {
-                printf("[Error] SPS StartCode Write Error!! in_byte=%ld, re=%d\r\n", sizeof(startcode), re);
-                fclose(pfile_outh264);
-                FFMpeg_CloseVideo();
-                return -4;
+                printf("Error IO Buffer Size!! %s\r\n", argv[i]);
+                return -2;
             }
-            frame_byte_cnt += sizeof(startcode);
-
-            //  写入SPS数据区
-            re = fwrite(ffmpeg_context.sps_dat, 1, ffmpeg_context.sps_len, pfile_outh264);
-            if(re != ffmpeg_context.sps_len)
+            CurrentInputType = EInputType_None;
+        }
+        else if(CurrentInputType == EInputType_Readahead)
+        {
+            AvioReadaheadMB = atoi(argv[i]);
+            if(AvioReadaheadMB < 0)
             {
-                printf("[Error] SPS Data Write Error!! in_byte=%d, re=%d\r\n", ffmpeg_context.sps_len, re);
-                fclose(pfile_outh264);
-                FFMpeg_CloseVideo();
-                return -5;
+                printf("Error Readahead Size!! %s\r\n", argv[i]);
+                return -2;
             }
-            frame_byte_cnt += ffmpeg_context.sps_len;
-            
-            //------------------------------------------------------------------
-            //  写入PPS
-            //  写入每个部分之前都先写入开始代码
-        #if DEBUG_LOG
-            printf("Begin Write PPS...\r\n");
-        #endif  //  DEBUG_LOG
-            re = fwrite(startcode, 1, sizeof(startcode), pfile_outh264);
-            if(re != sizeof(startcode))
+            CurrentInputType = EInputType_None;
+        }
+        else if(CurrentInputType == EInputType_AnalyzeWindow)
+        {
+            AnalyzeWindow = atof(argv[i]);
+            if(AnalyzeWindow <= 0.0)
             {
-                printf("[Error] PPS StartCode Write Error!! in_byte=%ld, re=%d\r\n", sizeof(startcode), re);
-                fclose(pfile_outh264);
-                FFMpeg_CloseVideo();
-                return -6;
+                printf("Error Analyze Window!! %s\r\n", argv[i]);
+                return -2;
             }
-            frame_byte_cnt += sizeof(startcode);
-
-            //  写入PPS数据区
-            re = fwrite(ffmpeg_context.pps_dat, 1, ffmpeg_context.pps_len, pfile_outh264);
-            if(re != ffmpeg_context.pps_len)
+            CurrentInputType = EInputType_None;
+        }
+        //  当为推流节拍方式
+        else if(CurrentInputType == EInputType_StreamPace)
+        {
+            if(strcmp("fps", argv[i]) == 0)       StreamPace = EStreamPace_Fps;
+            else if(strcmp("pts", argv[i]) == 0)  StreamPace = EStreamPace_Pts;
+            else if(strcmp("none", argv[i]) == 0) StreamPace = EStreamPace_None;
+            else
             {
-                printf("[Error] PPS Data Write Error!! in_byte=%d, re=%d\r\n", ffmpeg_context.pps_len, re);
-                fclose(pfile_outh264);
-                FFMpeg_CloseVideo();
-                return -7;
+                printf("Error Pace Arg!! %s\r\n", argv[i]);
+                return -2;
             }
-            frame_byte_cnt += ffmpeg_context.pps_len;
+            CurrentInputType = EInputType_None;
+        }
+        //  错误类型
+        else
+        {
+            printf("Error Input Type!!\r\n");
+            return -2;
+        }
+    }
 
-            //  定义包
-            AVPacket *pkt = 0;
+    //  合并报告模式,此时输入的文件为各个分片的报告
+    if(MergeOutputPath != "")
+    {
+        return Batch_MergeReports(MergeOutputPath, InputFileVec);
+    }
 
-            // 分配原始文件流packet的缓存
-            pkt = av_packet_alloc();
+    //  从断点继续时同时保存新的断点
+    if(ResumeMode && (CkptSec == 0)) CkptSec = 10;
 
-            //  定义帧计数器
-            unsigned long frame_cnt = 0UL;
+    //  预演只根据采样表计算,转码的输出大小无法预估
+    if(DryRunMode && TranscodeMode)
+    {
+        printf("--dry-run can not be used with --transcode!!\r\n");
+        return -2;
+    }
 
-            //------------------------------------------------------------------
-            //  循环写入每一帧的码流
-            //  开始循环抓取每一帧
-        #if DEBUG_LOG
-            printf("Begin while(1)...\r\n");
-        #endif  //  DEBUG_LOG
-            while(1)
-            {
-                //  检索视频包
-                //  从视频文件中获取一个包
-            #if DEBUG_LOG
-                printf("av_read_frame...\r\n");
-            #endif  //  DEBUG_LOG
-                while(av_read_frame(ffmpeg_context.p_fmt_ctx, pkt) >= 0)
-                {
-                    //  当读取到一帧视频的时候，则跳出
-                    if(pkt->stream_index == ffmpeg_context.v_idx)
-                    {
-                        //  找到了
-                    #if 1
-                        //  当为数据被破坏的包
-                        if((pkt->flags & AV_PKT_FLAG_CORRUPT) != 0)
-                        {
-                            av_packet_unref(pkt);   //  丢弃
-                        }
-                        //  不安全的结构的包
-                        else if((pkt->flags & AV_PKT_FLAG_DISCARD) != 0)
-                        {
-                            av_packet_unref(pkt);   //  丢弃
-                        }
-                        //  可能被解码器丢弃的包
-                        else if((pkt->flags & AV_PKT_FLAG_DISPOSABLE) != 0)
-                        {
-                            //av_packet_unref(pkt);   //  丢弃
-                            break;
-                        }
-                        //  正常的数据包
-                        else
-                        {
-                            break;
-                        }
-                    #else
-                        //  当为关键帧
-                        if((pkt->flags & AV_PKT_FLAG_KEY) != 0)
-                        {
-                            break;
-                        }
-                        //  不为关键帧
-                        else
-                        {
-                            av_packet_unref(pkt);   //  丢弃
-                        }
-                    #endif
-                    }
-                    else
-                    {
-                        av_packet_unref(pkt);
-                    }
-                }
+    //  预演不读取视频数据,无法计算每帧的CRC32C,写入的校验值会使--check和--verify全部报错
+    if(DryRunMode && CrcMode)
+    {
+        printf("--dry-run can not be used with --crc!!\r\n");
+        return -2;
+    }
+
+    //  跟随模式,通过自定义读取等待文件增长
+    //  输出按顺序增量写入并定期同步,不能使用预估大小的内存映射、分段并行和io_uring
+    if(FollowMode)
+    {
+        if(DryRunMode)
+        {
+            printf("--follow can not be used with --dry-run!!\r\n");
+            return -2;
+        }
+        if(AvioBufferKB == 0) AvioBufferKB = 256;
+        if(MmapMode || (SplitCount > 1) || (IoMode != EIoMode_Stdio))
+        {
+            printf("[Warning] --mmap, --split and --io uring are ignored with --follow\r\n");
+            MmapMode = false;
+            SplitCount = 0;
+            IoMode = EIoMode_Stdio;
+        }
+    }
 
-            #if DEBUG_LOG
-                printf("memcpy startcode...\r\n");
-                printf("pkt->size = %d\r\n", pkt->size);
-            #endif  //  DEBUG_LOG
+    //  io_uring后端,没有编译时使用stdio
+    //  输入通过自定义读取,没有指定缓冲区大小时每次读取一块
+    if(IoMode == EIoMode_Uring)
+    {
+#if USE_IO_URING
+        if(AvioBufferKB == 0) AvioBufferKB = URING_BLOCK / 1024;
+#else
+        printf("[Warning] io_uring is not compiled in (make USE_IO_URING=1), use stdio\r\n");
+        IoMode = EIoMode_Stdio;
+#endif  //  USE_IO_URING
+    }
 
-                //  检查包长度
-                if(pkt->size < sizeof(startcode))
-                {
-                    //ffmpeg_context.TotalFrame--;      //  少一帧
-                    av_packet_unref(pkt);    //  跳出
-                    break;
-                }
+    //  检查模式,输入为已经生成的文件
+    if(CheckMode)
+    {
+        int bad_file_cnt = 0;
+        for(i=0;i<(int)InputFileVec.size();i++)
+        {
+            if((i % ShardCount) != ShardIndex) continue;
+            std::string path = InputFileVec.at(i).path;
+            std::string dir = GetOnlyFilePath(path);
+            std::string base = GetOnlyFileNameNoEx(path);
+            if(dir != "") base = dir + "/" + base;
+            //  H265的输出文件扩展名为.h265
+            std::string video_name = base + ".h264";
+            if((access(video_name.c_str(), F_OK) != 0) && (access((base + ".h265").c_str(), F_OK) == 0)) video_name = base + ".h265";
+            if(Crc_CheckFile(video_name, base + ".vinf") != 0) bad_file_cnt++;
+        }
+        printf("[Check] Bad Files=%d\r\n", bad_file_cnt);
+        return (bad_file_cnt == 0) ? 0 : -14;
+    }
 
-                //  替换本数据流的开始代码
-                memcpy(pkt->data, startcode, sizeof(startcode));
+    //  按出现顺序编号
+    int input_file_total = InputFileVec.size();
+    for(i=0;i<input_file_total;i++)
+    {
+        InputFileVec.at(i).index = i;
+    }
 
-                //  检查该帧中是否含有SEI信息
-            #if DEBUG_LOG
-                printf("check sei...\r\n");
-            #endif  //  DEBUG_LOG
-                if(H264_CheckSEI_Inside(pkt->data, pkt->size))
-                {
-                    //  打印SEI的UUID
-                    printf("H264 Video SEI Payload UUID:");
-                    HexUUID_DumpVector(H264_SEI_GetUUID(pkt->data, pkt->size));
-
-                    //  打印SEI的用户信息
-                #if DEBUG_LOG
-                    printf("H264 Video SEI Payload Content:");
-                    ASCII_DumpVector(H264_SEI_GetContent(pkt->data, pkt->size));
-                #endif  //  DEBUG_LOG
-
-                    //  获得整个SEI段的总长度
-                    int total_sei_len = H264_SEI_GetTotalDataLen_SEI(pkt->data, pkt->size);
-
-                    //  当合法
-                    if(total_sei_len > 0)
-                    {
-                        //  修改SEI段后面的关键帧的StartCode
-                        memcpy(pkt->data + total_sei_len, startcode, sizeof(startcode));
-                    }
-                }
+    //  打印识别结果
+#if DEBUG_LOG
+    printf("Total Input File Count is %d\r\n", input_file_total);
+    printf("Input File List:\r\n");
+    for(i=0;i<input_file_total;i++)
+    {
+        printf("    %s\r\n", InputFileVec.at(i).path.c_str());
+    }
+#endif  //  DEBUG_LOG
 
-                //  保存h264码流
-            #if DEBUG_LOG
-                printf("fwrite...\r\n");
-            #endif  //  DEBUG_LOG
-                re = fwrite(pkt->data, 1, pkt->size, pfile_outh264);
+    //  读取恢复模式的参考
+    if((RecoverRef != "") && (Recover_LoadRef(RecoverRef) != 0)) return -2;
 
-                //  检查文件是否写入成功
-                //  当写入失败
-                if(re != pkt->size)
-                {
-                    printf("[Error] H264 Output Video File Write Error!! in_byte=%d, re=%d\r\n", pkt->size, re);
-                    av_packet_unref(pkt);
-                    AVPacket *ppkt[1];
-                    ppkt[0] = pkt;
-                    av_packet_free(ppkt);
-                    fclose(pfile_outh264);
-                    FFMpeg_CloseVideo();
-                    return -3;
-                }
-                frame_byte_cnt += pkt->size;
+    //  打开报告文件
+    FILE* pfile_report = 0;
+    if(ReportPath != "")
+    {
+        pfile_report = fopen(ReportPath.c_str(), "wb");
+        if(pfile_report == 0)
+        {
+            printf("[Error] Open Report File Error!! %s\r\n", ReportPath.c_str());
+            return -2;
+        }
+        Batch_WriteReportHeader(pfile_report, input_file_total);
+    }
 
-                //  将本次写入的尺寸统计到信息文件中
-                fprintf(pfile_outvinf, "%d\r\n", frame_byte_cnt);
-                frame_byte_cnt = 0;
+    //  打开RTP目标
+    if((RtpTarget != "") && (StreamTarget != ""))
+    {
+        printf("--stream and --rtp can not be used together!!\r\n");
+        if(pfile_report != 0) fclose(pfile_report);
+        return -2;
+    }
+    if(RtpTarget != "")
+    {
+        //  RTP按NAL打包,对齐、AUD和输出封装格式没有意义
+        if((AlignSize > 1) || AudMode || (OutFraming != EFraming_AnnexB))
+        {
+            printf("[Warning] --align, --aud and --framing are ignored with --rtp\r\n");
+            AlignSize = 0;
+            AudMode = false;
+            OutFraming = EFraming_AnnexB;
+        }
+        if(Rtp_Open(RtpTarget) != 0)
+        {
+            if(pfile_report != 0) fclose(pfile_report);
+            return -2;
+        }
+    }
 
-                //  统计一帧
-            #if DEBUG_LOG
-                printf("frame = %ld...\r\n", frame_cnt);
-            #endif  //  DEBUG_LOG
-                frame_cnt++;
+    //  打开推流目标
+    if(StreamTarget != "")
+    {
+        if(Stream_Open(StreamTarget) != 0)
+        {
+            if(pfile_report != 0) fclose(pfile_report);
+            return -2;
+        }
+    }
 
-                //  当达到视频末尾
-                if(frame_cnt >= ffmpeg_context.TotalFrame)
-                {
-                    av_packet_unref(pkt);
-                    break;
-                }
-            }
+    //  打开拼接输出
+    std::string concat_h264_name;
+    std::string concat_vinf_name;
+    if(ConcatName != "")
+    {
+        if((StreamTarget != "") || (RtpTarget != "") || DryRunMode)
+        {
+            printf("--concat can not be used with --stream, --rtp or --dry-run!!\r\n");
+            if(pfile_report != 0) fclose(pfile_report);
+            return -2;
+        }
+        if(Concat_Open(concat_h264_name, concat_vinf_name) != 0)
+        {
+            if(pfile_report != 0) fclose(pfile_report);
+            return -3;
+        }
+    }
+    Analyze_Reset(FileAnalyze);
+    Analyze_Reset(BatchAnalyze);
 
-            //  释放包
-            AVPacket *ppkt[1];
-            ppkt[0] = pkt;
-            av_packet_free(ppkt);
+    //  打开跟踪文件,失败时不跟踪
+    if(TraceName != "") Trace_Open(TraceName);
+    Pool_Init();
 
-            //  关闭输出文件
-            fclose(pfile_outh264);
+    //  保存全局设置,单文件选项处理完成后恢复
+    std::string global_output_path = OutputPath;
+    bool global_pipeline_mode = PipelineMode;
 
-            //  视频信息文件写入完成
-            fclose(pfile_outvinf);
+    //  循环操作视频文件
+    int first_error = 0;
+    for(i=0;i<input_file_total;i++)
+    {
+        //  不属于本分片的跳过
+        const SInputItem& item = InputFileVec.at(i);
+        if((item.index % ShardCount) != ShardIndex) continue;
+
+        //  应用单文件选项
+        OutputPath = (item.out_path != "") ? item.out_path : global_output_path;
+        PipelineMode = (item.pipeline >= 0) ? (item.pipeline != 0) : global_pipeline_mode;
+
+        //  转换并记录结果
+        SConvResult result;
+        result.index = item.index;
+        result.frames = 0UL;
+        result.bytes = 0ULL;
+        result.path = item.path;
+        Trace_BeginFile(item.index, item.path);
+        double t0 = Pipe_NowMs();
+        result.code = VideoConv_ConvFile(item.path, result);
+        result.seconds = (Pipe_NowMs() - t0) / 1000.0;
+        Trace_Add("file", t0, result.code);
+        if(pfile_report != 0) Batch_WriteReportLine(pfile_report, result);
+
+        //  出错处理
+        if(result.code != 0)
+        {
+            if(first_error == 0) first_error = result.code;
+            if(!KeepGoing) break;
+            printf("[Warning] Skip Failed File:%s\r\n", item.path.c_str());
+        }
+    }
 
+    //  关闭拼接输出并校验
+    if(ConcatName != "")
+    {
+        Concat_Close(concat_vinf_name);
+        if((AnalyzeName != "") && (ConcatClipCnt > 0))
+        {
+            std::string json_name = concat_vinf_name.substr(0, concat_vinf_name.size() - 5) + ".json";
+            Analyze_EndFile(concat_h264_name, json_name);
         }
-        //  打开失败
-        else
+        if(VerifyMode && (ConcatClipCnt > 0))
         {
-            printf("[Error] Open Video File Error!! Return Code=%d\r\n", re);
-            FFMpeg_CloseVideo();
-            return -2;
+            int re = Verify_File("", concat_h264_name, concat_vinf_name, false);
+            if((re != 0) && (first_error == 0)) first_error = re;
         }
-
-        //  释放相关资源
-        FFMpeg_CloseVideo();
     }
 
+    //  写入分析汇总
+    if(AnalyzeName != "") Analyze_WriteBatch();
 
-    //  程序正常结束
-    return 0;
+    //  关闭报告文件和推流目标
+    if(pfile_report != 0) fclose(pfile_report);
+    Stream_Close();
+    Rtp_Close();
+    Trace_Close();
+    Pool_Uninit();
+
+    //  程序结束,有失败的文件时返回第一个错误码
+    return first_error;
 }
 